@@ -6,10 +6,11 @@
 **/
 #include <readline/readline.h>
 #include <readline/history.h>
+#include <pthread.h>
 
 #include "common.h"
 
-extern VMachine* vm;
+static VMachine* vm = NULL;
 
 // note that longer vars with the same leading letters need to appear before shorter ones.
 // parm, envname, help, required, default, once
@@ -19,29 +20,186 @@ BEGIN_CONFIG
     CONFIG_LIST("-i", "FPATH", "Specify directories to search for imports", 0, ".:include", 0)
     CONFIG_BOOL("-D", "DFILE_ONLY", "Output the dot file only. No object output", 0, 0, 0)
     CONFIG_STR("-d", "DUMP_FILE", "Specify the file name to dump the AST into", 0, "ast_dump.dot", 1)
+    CONFIG_BOOL("-b", "BATCH_SCAN", "Scan each input into a token array before parsing", 0, 0, 0)
+    CONFIG_NUM("-j", "JOBS", "Compile the input files on this many threads", 0, 1, 0)
+    CONFIG_STR("-C", "CACHE_DIR", "Keep the compiled input files in this directory", 0, "", 0)
+    CONFIG_BOOL("-c", "COMPILE_ONLY", "Write the bytecode for the input file to OUTFILE and do not run it", 0, 0, 0)
+    CONFIG_STR("--profile-json", "PROFILE_JSON", "Write the --profile data to this file as JSON", 0, "", 0)
+    CONFIG_NUM("--profile-rate", "PROFILE_RATE", "Time one in this many instructions with --profile", 0, 64, 0)
+    CONFIG_BOOL("--profile", "PROFILE", "Count and time the instructions that run and print a table at exit", 0, 0, 0)
+    CONFIG_STR("--pairs", "PAIR_FILE", "Count the opcode pairs that run and write them to this file at exit", 0, "", 0)
+    CONFIG_STR("--fuse", "FUSE", "Superinstructions to use: all, none, or a pair count file from --pairs", 0, "all", 0)
+    CONFIG_BOOL("--trace", "TRACE", "Record the instructions that run and print the last of them at exit", 0, 0, 0)
     CONFIG_LIST(NULL, "INFILES", "List of input files", 0, NULL, 0)
 END_CONFIG
 
+static int inputs = 0; // number of REPL lines or files compiled
+
+#ifdef _USE_LOGGING
+// keeps the lines that the compiler threads log from running together
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void log_lock(bool lock, void* udata) {
+
+    (void)udata;
+    if(lock)
+        pthread_mutex_lock(&log_mutex);
+    else
+        pthread_mutex_unlock(&log_mutex);
+}
+#endif
+
+static InterpretResult run_code() {
+
+    // run the code block, but do not free the VM or destroy the code.
+    // after a runtime error there is no value to print
+    InterpretResult res = run_vmachine(vm);
+    if(res == INTERPRET_OK) {
+        printf("Value = ");
+        print_value(peek_value_stack(vm));
+        printf("\n");
+    }
+    return res;
+}
+
 static InterpretResult interpret() {
 
-    reset_vmachine();
+    inputs++;
+    reset_vmachine(vm);
     // call the compiler to create the code buffer
     // compile reads directly from the scanner
-    compile();
+    if(!compile(vm->block))
+        return INTERPRET_COMPILE_ERROR;
+    return run_code();
+}
 
-    // run the code block, but do not free the VM or destroy the code.
-    InterpretResult res = run_vmachine(vm);
-    printf("Value = ");
-    print_value(peek_value_stack());
-    printf("\n");
+/**
+    @brief Run a block that was loaded from a file. The loaded code cannot
+    grow, so the machine gets a new block afterward for the files that follow.
+
+    @param block
+**/
+static InterpretResult interpret_block(codeBlock* block) {
+
+    inputs++;
+    reset_vmachine(vm);
+    load_vmachine(vm, block);
+    InterpretResult res = run_code();
+    load_vmachine(vm, create_codeblock());
     return res;
 }
 
+/**
+    @brief Run an input file from the cache, or compile it and put it in the
+    cache. Code that had errors or warnings is not put in the cache, so that
+    they are reported every time the file is run.
+
+    @param fname
+**/
+static InterpretResult interpret_cached(const char* fname) {
+
+    uint64_t key;
+    if(!cache_key(fname, &key)) {
+        open_scanner_file(fname);   // reports the error
+        return interpret();
+    }
+
+    codeBlock* block = cache_load(key);
+    if(block != NULL)
+        return interpret_block(block);
+
+    // the entry must only have the code for this file
+    inputs++;
+    reset_vmachine(vm);
+    load_vmachine(vm, create_codeblock());
+    int messages = get_num_errors() + get_num_warnings();
+    open_scanner_file(fname);
+    if(!compile(vm->block))
+        return INTERPRET_COMPILE_ERROR;
+    if(get_num_errors() + get_num_warnings() == messages)
+        cache_store(key, vm->block);
+    return run_code();
+}
+
+/**
+    @brief Compile the input file and write its code to OUTFILE rather than
+    running it. Nothing is written if there are errors.
+
+**/
+static void write_output() {
+
+    int count = 0;
+    reset_config_list("INFILES");
+    while(iterate_config("INFILES") != NULL)
+        count++;
+
+    if(count != 1) {
+        command_error("-c needs exactly one input file");
+        return;
+    }
+
+    reset_config_list("INFILES");
+    const char* fname = iterate_config("INFILES");
+    if(is_bytecode_file(fname)) {
+        command_error("\"%s\" is already bytecode", fname);
+        return;
+    }
+
+    inputs++;
+    open_scanner_file(fname);
+    if(compile(vm->block))
+        write_bytecode(vm->block, GET_CONFIG_STR("OUTFILE"));
+}
+
+/**
+    @brief Compile all of the input files at the same time, then run them one
+    after another in the order that they were given. The errors for each file
+    are reported just before it runs, the same as when they are compiled one
+    at a time.
+
+    @param threads
+**/
+static void interpret_files(int threads) {
+
+    int count = 0;
+    reset_config_list("INFILES");
+    while(iterate_config("INFILES") != NULL)
+        count++;
+
+    compile_job_t* jobs = MALLOC(sizeof(compile_job_t) * count);
+    reset_config_list("INFILES");
+    for(int i = 0; i < count; i++) {
+        jobs[i].fname = iterate_config("INFILES");
+        jobs[i].block = create_codeblock();
+        jobs[i].errors = create_error_log();
+    }
+
+    compile_files(jobs, count, threads);
+
+    int i;
+    for(i = 0; i < count; i++) {
+        flush_error_log(jobs[i].errors);
+        inputs++;
+        reset_vmachine(vm);
+        load_vmachine(vm, jobs[i].block);
+        if(!jobs[i].compiled || run_code() != INTERPRET_OK)
+            break;
+    }
+
+    // the rest are not run
+    for(i++; i < count; i++) {
+        flush_error_log(jobs[i].errors);
+        free_codeblock(jobs[i].block);
+    }
+
+    FREE(jobs);
+}
+
 static void repl() {
 
     bool finished = false;
 
-    printf("\natlang v0.1 REPL interface. (Ctrl-D to exit)\n\n");
+    printf("\natlang v" COMPILER_VERSION " REPL interface. (Ctrl-D to exit)\n\n");
     rl_bind_key('\t', rl_insert);
 
     char* buf;
@@ -68,20 +226,112 @@ static void repl() {
     printf("\n");
 }
 
+/**
+    @brief Print the trace when the program stops, including when it stops
+    on a fatal or runtime error. After a normal exit the machine is gone and
+    the trace has already been printed.
+
+**/
+static void dump_trace() {
+
+    if(vm != NULL)
+        dump_vmachine_trace(vm, stderr);
+}
+
+/**
+    @brief Write the pair counts when the program stops, the same way as the
+    trace.
+
+**/
+static void dump_pairs() {
+
+    const char* fname = GET_CONFIG_STR("PAIR_FILE");
+    if(vm == NULL || vm->pairs == NULL || fname[0] == '\0')
+        return;
+
+    FILE* fp = fopen(fname, "w");
+    if(fp == NULL) {
+        fprintf(stderr, "cannot open pair count file \"%s\": %s\n", fname, strerror(errno));
+        return;
+    }
+    write_vmachine_pairs(vm, fp);
+    fclose(fp);
+    count_vmachine_pairs(vm, false);
+}
+
+/**
+    @brief Print the profile after the error summary, and write it as JSON
+    if that was asked for. Like the trace, it is also reported when the
+    program stops on a fatal error.
+
+**/
+static void report_profile() {
+
+    if(vm == NULL || vm->profile == NULL)
+        return;
+
+    if(GET_CONFIG_BOOL("PROFILE"))
+        report_vmachine_profile(vm, stderr);
+
+    const char* fname = GET_CONFIG_STR("PROFILE_JSON");
+    if(fname[0] != '\0') {
+        FILE* fp = fopen(fname, "w");
+        if(fp == NULL)
+            fprintf(stderr, "cannot open profile file \"%s\": %s\n", fname, strerror(errno));
+        else {
+            write_vmachine_profile(vm, fp);
+            fclose(fp);
+        }
+    }
+}
+
 static void init_things(int argc, char** argv) {
 
     init_memory();
     configure(argc, argv);
     init_errors(stderr);
     init_scanner();
-    init_vmachine();
+    init_cache(GET_CONFIG_STR("CACHE_DIR"));
+    vm = create_vmachine();
+
+    if(GET_CONFIG_BOOL("TRACE")) {
+        trace_vmachine(vm, true);
+        atexit(dump_trace);
+    }
+
+    // The pairs are counted on code that is not fused, so that the file
+    // says which superinstructions to make.
+    if(GET_CONFIG_STR("PAIR_FILE")[0] != '\0') {
+        init_fusion("none");
+        count_vmachine_pairs(vm, true);
+        atexit(dump_pairs);
+    }
+    else
+        init_fusion(GET_CONFIG_STR("FUSE"));
+
+    if(GET_CONFIG_BOOL("PROFILE") || GET_CONFIG_STR("PROFILE_JSON")[0] != '\0') {
+        int rate = GET_CONFIG_NUM("PROFILE_RATE");
+        if(rate < 1)
+            fatal_error("the profile rate must be at least 1, not %d", rate);
+        profile_vmachine(vm, rate);
+        atexit(report_profile);
+    }
 }
 
 static void uninit_things() {
 
+    if(GET_CONFIG_NUM("VERBOSE") > 0)
+        print_memory_stats(stderr, inputs);
+
+    dump_trace();
+    dump_pairs();
     destroy_config();
+    destroy_cache();
     destroy_scanner();
-    destroy_vmachine();
+    destroy_vmachine(vm);
+    vm = NULL;
+    destroy_strings();
+    destroy_wide_numbers();
     destroy_memory();
 }
 
@@ -89,6 +339,7 @@ int main(int argc, char** argv) {
 
 #ifdef _USE_LOGGING
     log_set_level(LOG_DEBUG);
+    log_set_lock(log_lock, NULL);
 #endif
 
     log_debug("program start");
@@ -96,11 +347,22 @@ int main(int argc, char** argv) {
 
     if(get_config("INFILES") == NULL)
         repl();
+    else if(GET_CONFIG_BOOL("COMPILE_ONLY"))
+        write_output();
+    else if(GET_CONFIG_NUM("JOBS") > 1)
+        interpret_files(GET_CONFIG_NUM("JOBS"));
     else {
         reset_config_list("INFILES");
         for(char* str = iterate_config("INFILES"); str != NULL; str = iterate_config("INFILES")) {
-            open_scanner_file(str);
-            int retv = interpret();
+            int retv;
+            if(is_bytecode_file(str))
+                retv = interpret_block(load_bytecode(str));
+            else if(cache_enabled())
+                retv = interpret_cached(str);
+            else {
+                open_scanner_file(str);
+                retv = interpret();
+            }
             if(retv != INTERPRET_OK)
                 break;
         }
@@ -109,6 +371,8 @@ int main(int argc, char** argv) {
 
     int numerr = get_num_errors();
     fprintf(stderr, "\n    errors: %d warnings: %d\n", numerr, get_num_warnings());
+    report_cache(stderr);
+    report_profile();
     uninit_things();
     log_debug("program end");
     return numerr;
@@ -0,0 +1,373 @@
+/**
+    @file bytecode.c
+
+    @brief Write a code block to a file, and load it back. See bytecode.h for
+    the layout.
+
+    A loaded file is mapped, and the code in the block points straight into
+    the mapping. Only the constants are built, so the time to load does not
+    depend on the size of the source that the file was compiled from.
+
+**/
+// mmap() and friends are POSIX, and --std=c99 hides them.
+#define _POSIX_C_SOURCE 200809L
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common.h"
+
+/**
+    @brief Return the number of words that the instruction uses, or 0 if the
+    opcode is not valid.
+
+    @param op
+    @return size_t
+**/
+static size_t instruction_size(uint16_t op) {
+
+    if(op >= OP_COUNT)
+        return 0;
+    return 1 + opcode_operands(op);
+}
+
+/**
+    @brief Return true if the file starts with the bytecode magic number.
+
+    @param fname
+    @return bool
+**/
+bool is_bytecode_file(const char* fname) {
+
+    char magic[sizeof(((bc_header_t*)0)->magic)];
+
+    int fd = open(fname, O_RDONLY);
+    if(fd < 0)
+        return false;
+    ssize_t len = read(fd, magic, sizeof(magic));
+    close(fd);
+
+    return len == (ssize_t)sizeof(magic) && !memcmp(magic, BYTECODE_MAGIC, sizeof(magic));
+}
+
+/**
+    @brief Write the code block to the file.
+
+    @param block
+    @param fname
+    @param msg -- what went wrong, when false is returned
+    @param size -- size of the msg buffer
+    @return bool
+**/
+static bool save_bytecode(codeBlock* block, const char* fname, char* msg, size_t size) {
+
+    log_debug("enter %s", fname);
+    Value** values = raw_value_list(block);
+    size_t nconstants = value_list_size(block);
+    size_t ncode = code_list_size(block);
+
+    bc_constant_t* constants = CALLOC(MAX(nconstants, 1), sizeof(bc_constant_t));
+    size_t nstrings = 0;
+
+    for(size_t i = 0; i < nconstants; i++) {
+        Value* val = values[i];
+        ValueType type = VALUE_TYPE(val);
+        constants[i].type = (uint8_t)type;
+        switch(type) {
+            case VAL_INUM: constants[i].bits = (uint64_t)AS_INUM(val); break;
+            case VAL_UNUM: constants[i].bits = AS_UNUM(val); break;
+            case VAL_FNUM: {
+                    double num = AS_FNUM(val);
+                    memcpy(&constants[i].bits, &num, sizeof(uint64_t));
+                }
+                break;
+            case VAL_BOOL: constants[i].bits = AS_BOOL(val); break;
+            case VAL_NOTHING: break;
+            case VAL_OBJ:
+                if(value_is_string(val)) {
+                    ObjString* str = value_as_string(val);
+                    constants[i].bits = nstrings;
+                    constants[i].len = str->len;
+                    nstrings += str->len + 1;
+                    break;
+                }
+                fatal_error("cannot write an object of type %d to \"%s\"", AS_OBJ(val)->type, fname);
+                break;
+            default:
+                fatal_error("cannot write a value of type %d to \"%s\"", type, fname);
+        }
+    }
+
+    bc_header_t header = {
+        .version = BYTECODE_VERSION,
+        .byte_order = BYTECODE_ORDER,
+        .nconstants = (uint32_t)nconstants,
+        .ncode = (uint32_t)ncode,
+        .nstrings = (uint32_t)nstrings,
+    };
+    memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+
+    FILE* fp = fopen(fname, "wb");
+    if(fp == NULL) {
+        snprintf(msg, size, "Cannot open output file: \"%s\": %s", fname, strerror(errno));
+        FREE(constants);
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            fwrite(constants, sizeof(bc_constant_t), nconstants, fp) == nconstants &&
+            fwrite(raw_code_list(block), sizeof(uint16_t), ncode, fp) == ncode;
+    for(size_t i = 0; ok && i < nconstants; i++)
+        if(constants[i].type == VAL_OBJ)
+            ok = fwrite(value_as_cstring(values[i]), 1, constants[i].len + 1, fp) == constants[i].len + 1;
+
+    if(fclose(fp) != 0 || !ok) {
+        snprintf(msg, size, "Cannot write output file: \"%s\": %s", fname, strerror(errno));
+        FREE(constants);
+        return false;
+    }
+
+    FREE(constants);
+    log_debug("leave %lu words, %lu constants", ncode, nconstants);
+    return true;
+}
+
+/**
+    @brief Write the code block to the file. Anything that goes wrong is a
+    fatal error.
+
+    @param block
+    @param fname
+**/
+void write_bytecode(codeBlock* block, const char* fname) {
+
+    char msg[256];
+    if(!save_bytecode(block, fname, msg, sizeof(msg)))
+        fatal_error("%s", msg);
+}
+
+/**
+    @brief Write the code block to the file if it can be done. A file that
+    was partly written is left for the caller to remove.
+
+    @param block
+    @param fname
+    @return bool -- false if the file could not be written
+**/
+bool try_write_bytecode(codeBlock* block, const char* fname) {
+
+    char msg[256];
+    bool ok = save_bytecode(block, fname, msg, sizeof(msg));
+    if(!ok)
+        log_debug("%s", msg);
+    return ok;
+}
+
+/**
+    @brief Check that the code only has valid opcodes, that the constants it
+    uses are in the pool and that it ends with a return, so the VM can run it
+    without checking.
+
+    @param code
+    @param ncode
+    @param nconstants
+    @return const char* -- what is wrong, or NULL
+**/
+static const char* check_code(const uint16_t* code, size_t ncode, size_t nconstants) {
+
+    size_t last = 0;
+    for(size_t ip = 0; ip < ncode; ip += instruction_size(code[ip])) {
+        size_t size = instruction_size(code[ip]);
+        if(size == 0)
+            return "invalid opcode";
+        if(ip + size > ncode)
+            return "instruction runs past the end of the code";
+        for(size_t i = 1; i < size; i++)
+            if(code[ip + i] >= nconstants)
+                return "constant is not in the pool";
+        last = ip;
+    }
+
+    if(ncode == 0 || code[last] != OP_RETURN)
+        return "code does not end with a return";
+    return NULL;
+}
+
+/**
+    @brief Check that every constant has a known type and that every string
+    is inside the string area and ends there with a terminator.
+
+    @param constants
+    @param nconstants
+    @param strings
+    @param nstrings
+    @return const char* -- what is wrong, or NULL
+**/
+static const char* check_constants(const bc_constant_t* constants, size_t nconstants,
+                const char* strings, size_t nstrings) {
+
+    for(size_t i = 0; i < nconstants; i++) {
+        switch(constants[i].type) {
+            case VAL_INUM: case VAL_UNUM: case VAL_FNUM: case VAL_BOOL: case VAL_NOTHING:
+                break;
+            case VAL_OBJ: {
+                    // bits + len could wrap around, so neither is added to the other
+                    uint64_t ofst = constants[i].bits;
+                    if(ofst >= nstrings || constants[i].len >= nstrings - ofst)
+                        return "string is out of range";
+                    if(strings[ofst + constants[i].len] != '\0')
+                        return "string is not terminated";
+                }
+                break;
+            default:
+                return "constant has an invalid type";
+        }
+    }
+    return NULL;
+}
+
+/**
+    @brief Map a bytecode file and make a code block from it. The code stays
+    in the mapping, which belongs to the block until it is freed.
+
+    @param fname
+    @param msg -- what is wrong with the file, when NULL is returned
+    @param size -- size of the msg buffer
+    @return codeBlock*
+**/
+static codeBlock* map_bytecode(const char* fname, char* msg, size_t size) {
+
+    log_debug("enter %s", fname);
+    int fd = open(fname, O_RDONLY);
+    if(fd < 0) {
+        snprintf(msg, size, "Cannot open input file: \"%s\": %s", fname, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(bc_header_t)) {
+        close(fd);
+        snprintf(msg, size, "bytecode file \"%s\" is too short", fname);
+        return NULL;
+    }
+
+    size_t map_size = st.st_size;
+    const char* map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        snprintf(msg, size, "Cannot map input file: \"%s\": %s", fname, strerror(errno));
+        return NULL;
+    }
+
+    const bc_header_t* header = (const bc_header_t*)map;
+    size_t const_ofst = sizeof(bc_header_t);
+    size_t code_ofst = const_ofst + (size_t)header->nconstants * sizeof(bc_constant_t);
+    size_t string_ofst = code_ofst + (size_t)header->ncode * sizeof(uint16_t);
+    const uint16_t* code = (const uint16_t*)(map + code_ofst);
+    const bc_constant_t* constants = (const bc_constant_t*)(map + const_ofst);
+    const char* strings = map + string_ofst;
+
+    if(memcmp(header->magic, BYTECODE_MAGIC, sizeof(header->magic)))
+        snprintf(msg, size, "\"%s\" is not a bytecode file", fname);
+    else if(header->byte_order != BYTECODE_ORDER)
+        snprintf(msg, size, "bytecode file \"%s\" was written with another byte order", fname);
+    else if(header->version != BYTECODE_VERSION)
+        snprintf(msg, size, "bytecode file \"%s\" is version %d, expected version %d",
+                fname, header->version, BYTECODE_VERSION);
+    else if(string_ofst + header->nstrings != map_size)
+        snprintf(msg, size, "bytecode file \"%s\" has the wrong size", fname);
+    else {
+        const char* err = check_code(code, header->ncode, header->nconstants);
+        if(err == NULL)
+            err = check_constants(constants, header->nconstants, strings, header->nstrings);
+        if(err == NULL)
+            msg = NULL;
+        else
+            snprintf(msg, size, "bytecode file \"%s\": %s", fname, err);
+    }
+
+    if(msg != NULL) {
+        munmap((void*)map, map_size);
+        return NULL;
+    }
+
+    codeBlock* block = POOL_DS(codeBlock);
+    block->constants = create_value_list();
+    block->pool = create_hash_table();
+    block->mapping = map;
+    block->mapping_size = map_size;
+
+    // the list is never written, so its buffer can be the mapping
+    block->code = MALLOC(sizeof(u16_list_t));
+    block->code->buffer = (uint16_t*)code;
+    block->code->nitems = block->code->capacity = header->ncode;
+    block->code->index = 0;
+
+    for(size_t i = 0; i < header->nconstants; i++) {
+        Value val = INVALID_VALUE;
+        switch(constants[i].type) {
+            case VAL_INUM: val = INUM_VALUE((int64_t)constants[i].bits); break;
+            case VAL_UNUM: val = UNUM_VALUE(constants[i].bits); break;
+            case VAL_FNUM: {
+                    double num;
+                    memcpy(&num, &constants[i].bits, sizeof(double));
+                    val = FNUM_VALUE(num);
+                }
+                break;
+            case VAL_BOOL: val = BOOL_VALUE(constants[i].bits != 0); break;
+            case VAL_NOTHING: val = NOTHING_VALUE; break;
+            case VAL_OBJ:
+                val = OBJ_VALUE(create_string_object(&strings[constants[i].bits], constants[i].len));
+                break;
+        }
+        write_value_list(block, create_value(val));
+    }
+
+    log_debug("leave %u words, %u constants", header->ncode, header->nconstants);
+    return block;
+}
+
+/**
+    @brief Load a bytecode file. Anything that is wrong with the file is a
+    fatal error.
+
+    @param fname
+    @return codeBlock*
+**/
+codeBlock* load_bytecode(const char* fname) {
+
+    char msg[256];
+    codeBlock* block = map_bytecode(fname, msg, sizeof(msg));
+    if(block == NULL)
+        fatal_error("%s", msg);
+    return block;
+}
+
+/**
+    @brief Load a bytecode file if it is there and valid.
+
+    @param fname
+    @return codeBlock* -- NULL if the file cannot be used
+**/
+codeBlock* try_load_bytecode(const char* fname) {
+
+    char msg[256];
+    codeBlock* block = map_bytecode(fname, msg, sizeof(msg));
+    if(block == NULL)
+        log_debug("%s", msg);
+    return block;
+}
+
+/**
+    @brief Release the code of a block that was loaded by load_bytecode().
+
+    @param block
+**/
+void unmap_bytecode(codeBlock* block) {
+
+    FREE(block->code);  // the words are in the mapping
+    munmap((void*)block->mapping, block->mapping_size);
+    block->code = NULL;
+    block->mapping = NULL;
+}
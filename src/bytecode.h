@@ -0,0 +1,51 @@
+/**
+    @file bytecode.h
+
+    @brief Read and write code blocks as bytecode files.
+
+**/
+#ifndef __BYTECODE_H__
+#define __BYTECODE_H__
+
+#include "common.h"
+
+/*
+ * A bytecode file is laid out like this. All numbers are in the byte order
+ * of the machine that wrote the file, which is checked when it is loaded.
+ *
+ *   bc_header_t
+ *   bc_constant_t[nconstants]
+ *   uint16_t code[ncode]
+ *   char strings[nstrings]    -- each one is terminated
+ *
+ * Change BYTECODE_VERSION when the layout or the opcodes change.
+ */
+#define BYTECODE_MAGIC      "ATBC"
+#define BYTECODE_VERSION    2
+#define BYTECODE_ORDER      0x0102
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t byte_order;
+    uint32_t nconstants;
+    uint32_t ncode;         // words of code
+    uint32_t nstrings;      // bytes of string data
+    uint32_t reserved;
+} bc_header_t;
+
+typedef struct {
+    uint8_t type;           // ValueType
+    uint8_t reserved[3];
+    uint32_t len;           // length of a string
+    uint64_t bits;          // a number, or the offset of a string
+} bc_constant_t;
+
+bool is_bytecode_file(const char* fname);
+void write_bytecode(codeBlock* block, const char* fname);
+bool try_write_bytecode(codeBlock* block, const char* fname);
+codeBlock* load_bytecode(const char* fname);
+codeBlock* try_load_bytecode(const char* fname);
+void unmap_bytecode(codeBlock* block);
+
+#endif
@@ -0,0 +1,178 @@
+/**
+    @file cache.c
+
+    @brief The compile cache. See cache.h.
+
+    The key for a file is an FNV-1a hash of the compiler version, the bytecode
+    version, the superinstructions in use and the text of the file. The entry for a key is the file
+    "<dir>/<key>.bc". It is written to a temporary name and then renamed, so
+    a reader never sees half of one, even from another process. An entry that
+    cannot be loaded is a miss and is written over.
+
+**/
+// mkdir(), access() and getpid() are POSIX, and --std=c99 hides them.
+#define _POSIX_C_SOURCE 200809L
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "cache.h"
+
+#define FNV_OFFSET  0xcbf29ce484222325ULL
+#define FNV_PRIME   0x100000001b3ULL
+
+static char* cache_dir = NULL;
+static int hits = 0;
+static int misses = 0;
+static int stores = 0;
+
+static inline uint64_t __attribute__((always_inline)) fnv_hash(uint64_t hash, const void* data, size_t len) {
+
+    const uint8_t* ptr = (const uint8_t*)data;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= ptr[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static void cache_path(uint64_t key, char* buf, size_t size) {
+
+    snprintf(buf, size, "%s/%016lx.bc", cache_dir, (unsigned long)key);
+}
+
+/**
+    @brief Use the directory for the cache. It is made if it is not there. If
+    it cannot be used, there is a warning and nothing is cached. An empty name
+    leaves the cache off.
+
+    @param dir
+**/
+void init_cache(const char* dir) {
+
+    if(dir == NULL || dir[0] == '\0')
+        return;
+
+    if(mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        warning("cannot make the cache directory \"%s\": %s", dir, strerror(errno));
+        return;
+    }
+
+    if(access(dir, W_OK | X_OK) != 0) {
+        warning("cannot use the cache directory \"%s\": %s", dir, strerror(errno));
+        return;
+    }
+
+    cache_dir = STRDUP(dir);
+    log_debug("cache in %s", cache_dir);
+}
+
+bool cache_enabled() {
+
+    return cache_dir != NULL;
+}
+
+/**
+    @brief Make the cache key for an input file.
+
+    @param fname
+    @param key
+    @return bool -- false if the file cannot be read
+**/
+bool cache_key(const char* fname, uint64_t* key) {
+
+    int fd = open(fname, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    uint16_t version = BYTECODE_VERSION;
+    uint32_t fused = fusion_mask();
+    uint64_t hash = fnv_hash(FNV_OFFSET, COMPILER_VERSION, sizeof(COMPILER_VERSION));
+    hash = fnv_hash(hash, &version, sizeof(version));
+    hash = fnv_hash(hash, &fused, sizeof(fused));
+
+    char buf[1024*64];
+    ssize_t len;
+    while((len = read(fd, buf, sizeof(buf))) > 0)
+        hash = fnv_hash(hash, buf, len);
+    close(fd);
+
+    if(len < 0)
+        return false;
+
+    *key = hash;
+    return true;
+}
+
+/**
+    @brief Load the code for the key, if it is in the cache.
+
+    @param key
+    @return codeBlock* -- NULL if it is not
+**/
+codeBlock* cache_load(uint64_t key) {
+
+    char path[1024];
+    cache_path(key, path, sizeof(path));
+
+    codeBlock* block = try_load_bytecode(path);
+    if(block != NULL)
+        __atomic_fetch_add(&hits, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_add(&misses, 1, __ATOMIC_RELAXED);
+
+    log_debug("%s %s", (block != NULL)? "hit": "miss", path);
+    return block;
+}
+
+/**
+    @brief Put the code for the key in the cache. A store that fails is
+    logged and dropped, because the cache is only a speedup.
+
+    @param key
+    @param block
+**/
+void cache_store(uint64_t key, codeBlock* block) {
+
+    static int serial = 0;
+    char path[1024];
+    char temp[1100];
+
+    cache_path(key, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.%ld.%d", path, (long)getpid(),
+            __atomic_fetch_add(&serial, 1, __ATOMIC_RELAXED));
+
+    // a full disk, or a directory that was removed, only costs the store
+    if(!try_write_bytecode(block, temp)) {
+        log_debug("cannot store %s", path);
+        remove(temp);
+        return;
+    }
+    if(rename(temp, path) != 0) {
+        log_debug("cannot rename %s: %s", temp, strerror(errno));
+        remove(temp);
+        return;
+    }
+
+    __atomic_fetch_add(&stores, 1, __ATOMIC_RELAXED);
+}
+
+/**
+    @brief Print the number of hits and misses, if the cache is on.
+
+    @param fp
+**/
+void report_cache(FILE* fp) {
+
+    if(cache_dir != NULL)
+        fprintf(fp, "    cache hits: %d misses: %d stored: %d\n", hits, misses, stores);
+}
+
+void destroy_cache() {
+
+    if(cache_dir != NULL) {
+        FREE(cache_dir);
+        cache_dir = NULL;
+    }
+}
@@ -0,0 +1,28 @@
+/**
+    @file cache.h
+
+    @brief Keep the compiled code for input files in a directory, so a file
+    that has not changed is not compiled again.
+
+**/
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "common.h"
+
+/*
+ * A cache entry is a bytecode file named for the hash of the source text and
+ * the compiler version. Change COMPILER_VERSION when the code that the
+ * compiler makes for the same source changes, so the old entries are not used.
+ */
+#define COMPILER_VERSION    "0.2"
+
+void init_cache(const char* dir);
+bool cache_enabled();
+bool cache_key(const char* fname, uint64_t* key);
+codeBlock* cache_load(uint64_t key);
+void cache_store(uint64_t key, codeBlock* block);
+void report_cache(FILE* fp);
+void destroy_cache();
+
+#endif
@@ -0,0 +1,177 @@
+/**
+    @file charspan.h
+
+    @brief Character classes for the scanner, and functions that find the
+    end of a run of characters in a buffer, 16 or 32 bytes at a time where
+    the CPU allows it.
+
+    The class table replaces the <ctype.h> functions in the scanner. It does
+    not depend on the locale, and one load answers any combination of
+    classes. The classes match the "C" locale.
+
+    The span functions are used by the scanner to skip white space and
+    identifier tails without going through get_char() for each character.
+    Build with AVX2 enabled (-mavx2, see USE_AVX2 in CMakeLists.txt) to use
+    32 byte blocks. SSE2 is always there on x86-64. Other targets get the
+    scalar loops, and so does any build that defines _SCALAR_SPAN, so that
+    the benchmarks can compare them.
+
+**/
+#ifndef __CHARSPAN_H__
+#define __CHARSPAN_H__
+
+#if !defined(_SCALAR_SPAN) && defined(__AVX2__)
+#   define SPAN_AVX2
+#   include <immintrin.h>
+#elif !defined(_SCALAR_SPAN) && defined(__SSE2__)
+#   define SPAN_SSE2
+#   include <emmintrin.h>
+#endif
+
+#define CC_SPACE    0x01
+#define CC_DIGIT    0x02
+#define CC_HEX      0x04
+#define CC_IDSTART  0x08
+#define CC_IDCONT   0x10
+#define CC_OPSTART  0x20    // handled by read_punct()
+
+#define CC_ALPHA    (CC_IDSTART | CC_IDCONT)
+#define CC_ALPHAHEX (CC_IDSTART | CC_IDCONT | CC_HEX)
+
+static const uint8_t char_class[256] = {
+    ['\t' ... '\r'] = CC_SPACE,
+    [' '] = CC_SPACE,
+    ['0' ... '9'] = CC_DIGIT | CC_HEX | CC_IDCONT,
+    ['A' ... 'F'] = CC_ALPHAHEX,
+    ['G' ... 'Z'] = CC_ALPHA,
+    ['a' ... 'f'] = CC_ALPHAHEX,
+    ['g' ... 'z'] = CC_ALPHA,
+    ['_'] = CC_ALPHA,
+    ['*'] = CC_OPSTART, ['%'] = CC_OPSTART, [','] = CC_OPSTART, [';'] = CC_OPSTART,
+    [':'] = CC_OPSTART, ['['] = CC_OPSTART, [']'] = CC_OPSTART, ['{'] = CC_OPSTART,
+    ['}'] = CC_OPSTART, ['('] = CC_OPSTART, [')'] = CC_OPSTART, ['.'] = CC_OPSTART,
+    ['|'] = CC_OPSTART, ['&'] = CC_OPSTART, ['='] = CC_OPSTART, ['<'] = CC_OPSTART,
+    ['>'] = CC_OPSTART, ['-'] = CC_OPSTART, ['+'] = CC_OPSTART, ['!'] = CC_OPSTART,
+};
+
+/*
+ * The END_FILE and END_INPUT codes from get_char() fit in a byte and have
+ * no class.
+ *
+ * A build that defines _CTYPE_CLASS asks <ctype.h> instead, the way that the
+ * scanner did before the table, so that the benchmarks can compare them.
+ * There is no ctype function for the operator starts, so those are a switch.
+ */
+#ifdef _CTYPE_CLASS
+#include <ctype.h>
+
+static inline bool __attribute__((always_inline)) ctype_is(int ch, int cls) {
+
+    bool opstart = false;
+    switch(ch) {
+        case '*': case '%': case ',': case ';': case ':': case '[': case ']':
+        case '{': case '}': case '(': case ')': case '.': case '|': case '&':
+        case '=': case '<': case '>': case '-': case '+': case '!':
+            opstart = true;
+    }
+
+    return ((cls & CC_SPACE) && isspace(ch)) ||
+            ((cls & CC_DIGIT) && isdigit(ch)) ||
+            ((cls & CC_HEX) && isxdigit(ch)) ||
+            ((cls & CC_IDSTART) && (isalpha(ch) || ch == '_')) ||
+            ((cls & CC_IDCONT) && (isalnum(ch) || ch == '_')) ||
+            ((cls & CC_OPSTART) && opstart);
+}
+
+#define CHAR_IS(ch, cls)    ctype_is((uint8_t)(ch), (cls))
+#else
+#define CHAR_IS(ch, cls)    (char_class[(uint8_t)(ch)] & (cls))
+#endif
+
+static inline bool __attribute__((always_inline)) is_space_char(int ch) {
+    return CHAR_IS(ch, CC_SPACE);
+}
+
+static inline bool __attribute__((always_inline)) is_ident_char(int ch) {
+    return CHAR_IS(ch, CC_IDCONT);
+}
+
+/*
+ * Signed compares are all that SSE2 has, so a range check adds an offset
+ * that moves lo to -128 and then checks for less than -128 + the range size.
+ */
+#if defined(SPAN_AVX2)
+typedef __m256i span_vec_t;
+#   define SPAN_WIDTH 32
+#   define SPAN_LOAD(p)         _mm256_loadu_si256((const __m256i*)(p))
+#   define SPAN_SET(c)          _mm256_set1_epi8((char)(c))
+#   define SPAN_EQ(v, c)        _mm256_cmpeq_epi8(v, SPAN_SET(c))
+#   define SPAN_OR(a, b)        _mm256_or_si256(a, b)
+#   define SPAN_IN(v, lo, hi)   _mm256_cmpgt_epi8(SPAN_SET(-128 + ((hi) - (lo) + 1)), \
+                                    _mm256_add_epi8(v, SPAN_SET(128 - (lo))))
+#   define SPAN_MASK(v)         (uint32_t)_mm256_movemask_epi8(v)
+#   define SPAN_FULL            0xFFFFFFFFu
+#elif defined(SPAN_SSE2)
+typedef __m128i span_vec_t;
+#   define SPAN_WIDTH 16
+#   define SPAN_LOAD(p)         _mm_loadu_si128((const __m128i*)(p))
+#   define SPAN_SET(c)          _mm_set1_epi8((char)(c))
+#   define SPAN_EQ(v, c)        _mm_cmpeq_epi8(v, SPAN_SET(c))
+#   define SPAN_OR(a, b)        _mm_or_si128(a, b)
+#   define SPAN_IN(v, lo, hi)   _mm_cmplt_epi8(_mm_add_epi8(v, SPAN_SET(128 - (lo))), \
+                                    SPAN_SET(-128 + ((hi) - (lo) + 1)))
+#   define SPAN_MASK(v)         (uint32_t)_mm_movemask_epi8(v)
+#   define SPAN_FULL            0xFFFFu
+#endif
+
+/**
+    @brief Return a pointer to the first character at or after p that is not
+    white space, or end if there is none.
+
+    @param p
+    @param end
+    @return const char*
+**/
+static inline const char* span_space(const char* p, const char* end) {
+
+#ifdef SPAN_WIDTH
+    while(end - p >= SPAN_WIDTH) {
+        span_vec_t v = SPAN_LOAD(p);
+        uint32_t mask = SPAN_MASK(SPAN_OR(SPAN_EQ(v, ' '), SPAN_IN(v, '\t', '\r')));
+        if(mask != SPAN_FULL)
+            return p + __builtin_ctz(~mask);
+        p += SPAN_WIDTH;
+    }
+#endif
+    while(p < end && is_space_char((unsigned char)*p))
+        p++;
+    return p;
+}
+
+/**
+    @brief Return a pointer to the first character at or after p that cannot
+    be part of an identifier, or end if there is none.
+
+    @param p
+    @param end
+    @return const char*
+**/
+static inline const char* span_ident(const char* p, const char* end) {
+
+#ifdef SPAN_WIDTH
+    while(end - p >= SPAN_WIDTH) {
+        span_vec_t v = SPAN_LOAD(p);
+        span_vec_t alpha = SPAN_IN(SPAN_OR(v, SPAN_SET(0x20)), 'a', 'z');
+        span_vec_t digit = SPAN_IN(v, '0', '9');
+        uint32_t mask = SPAN_MASK(SPAN_OR(SPAN_OR(alpha, digit), SPAN_EQ(v, '_')));
+        if(mask != SPAN_FULL)
+            return p + __builtin_ctz(~mask);
+        p += SPAN_WIDTH;
+    }
+#endif
+    while(p < end && is_ident_char((unsigned char)*p))
+        p++;
+    return p;
+}
+
+#endif
@@ -32,7 +32,7 @@ void init_char_buffer(char_buffer_t chbuf) {
 
 char_buffer_t create_char_buffer() {
 
-    __chbuf_t* buf = ALLOC_DS(__chbuf_t);
+    __chbuf_t* buf = POOL_DS(__chbuf_t);
     init_char_buffer(buf);
     return (char_buffer_t)buf;
 }
@@ -43,7 +43,7 @@ void destroy_char_buffer(char_buffer_t chbuf) {
         __chbuf_t* buf = (__chbuf_t*)chbuf;
         if(buf->buffer != NULL)
             FREE(buf->buffer);
-        FREE(buf);
+        POOL_FREE(buf, __chbuf_t);
     }
 }
 
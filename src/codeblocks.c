@@ -6,19 +6,67 @@
 **/
 #include "common.h"
 
-extern VMachine* vm;
 
 codeBlock* create_codeblock() {
 
-    codeBlock* cb = ALLOC_DS(codeBlock);
+    codeBlock* cb = POOL_DS(codeBlock);
     cb->code = create_code_list();
     cb->constants = create_value_list();
+    cb->pool = create_hash_table();
     return cb;
 }
 
-void emit_opcode(uint16_t word) {
+void emit_opcode(codeBlock* block, uint16_t word) {
 
-    write_code_list(vm->block, word);
+    write_code_list(block, word);
+}
+
+/**
+    @brief Return the offset where the next word of code will be written.
+
+    @param block
+    @return size_t
+**/
+size_t code_offset(codeBlock* block) {
+
+    return code_list_size(block);
+}
+
+/**
+    @brief Throw away the code that was emitted from the offset to the end.
+    The constants that the code refers to stay in the pool. See
+    truncate_constants().
+
+    @param block
+    @param offset
+**/
+void truncate_code(codeBlock* block, size_t offset) {
+
+    truncate_code_list(block, offset);
+}
+
+/**
+    @brief Return the word of code at the offset.
+
+    @param block
+    @param offset
+    @return uint16_t
+**/
+uint16_t get_code(codeBlock* block, size_t offset) {
+
+    return raw_code_list(block)[offset];
+}
+
+/**
+    @brief Return the constant at the index in the constant pool.
+
+    @param block
+    @param index
+    @return Value*
+**/
+Value* get_constant(codeBlock* block, size_t index) {
+
+    return raw_value_list(block)[index];
 }
 
 void free_codeblock(codeBlock* block) {
@@ -29,71 +77,172 @@ void free_codeblock(codeBlock* block) {
     Value** vlist = raw_value_list(block);
     int vsize = (int)value_list_size(block);
     log_debug("value stack size = %d", vsize);
-    for(int i = 0; i < vsize; i++)
-        FREE(vlist[i]);
+    for(int i = 0; i < vsize; i++) {
+        if(IS_OBJ(vlist[i]))
+            free_object(AS_OBJ(vlist[i]));
+        free_value(vlist[i]);
+    }
 
     free_value_list(block);
+    destroy_hash_table(block->pool);
     //printf("code size = %d\n", (int)code_list_size(block->code));
-    free_code_list(block);
+    if(block->mapping != NULL)
+        unmap_bytecode(block);
+    else
+        free_code_list(block);
 
-    FREE(block);
+    POOL_FREE(block, codeBlock);
     log_debug("leave");
 }
 
-Value* create_value(ValueType type) {
+/**
+    @brief Copy the value into one that is allocated, for the constant pool.
 
-    Value* val = ALLOC_DS(Value);
-    val->type = type;
+    @param value
+    @return Value*
+**/
+Value* create_value(Value value) {
+
+    Value* val = POOL_DS(Value);
+    *val = value;
     return val;
 }
 
 void free_value(Value* val) {
 
-    FREE(val);
+    POOL_FREE(val, Value);
+}
+
+size_t emit_fnum_value(codeBlock* block, double num) {
+
+    emit_opcode(block, OP_CONSTANT);
+    return add_constant(block, create_value(FNUM_VALUE(num)));
 }
 
-size_t emit_fnum_value(double num) {
+size_t emit_unum_value(codeBlock* block, uint64_t num) {
 
-    emit_opcode(OP_CONSTANT);
-    Value* val = create_value(VAL_FNUM);
-    val->as.fnum = num;
-    return add_constant(val);
+    emit_opcode(block, OP_CONSTANT);
+    return add_constant(block, create_value(UNUM_VALUE(num)));
 }
 
-size_t emit_unum_value(uint64_t num) {
+size_t emit_inum_value(codeBlock* block, int64_t num) {
 
-    emit_opcode(OP_CONSTANT);
-    Value* val = create_value(VAL_UNUM);
-    val->as.unum = num;
-    return add_constant(val);
+    emit_opcode(block, OP_CONSTANT);
+    return add_constant(block, create_value(INUM_VALUE(num)));
 }
 
-size_t emit_inum_value(int64_t num) {
+size_t emit_obj_value(codeBlock* block, Obj* obj) {
 
-    emit_opcode(OP_CONSTANT);
-    Value* val = create_value(VAL_INUM);
-    val->as.inum = num;
-    return add_constant(val);
+    emit_opcode(block, OP_CONSTANT);
+    return add_constant(block, create_value(OBJ_VALUE(obj)));
 }
 
-size_t emit_obj_value(Obj* obj) {
+#define CONSTANT_KEY_SIZE 32    // "s:" and a pointer, or a type and 16 digits
+
+/**
+    @brief Make the key that identifies a constant in the pool. Numbers are
+    keyed on their type and bits, so 0.0 and -0.0 stay separate. Strings are
+    interned, so they are keyed on the address of the interned object. Returns
+    false if the value cannot be pooled.
+
+    @param value
+    @param key -- Buffer of CONSTANT_KEY_SIZE to build the key in.
+    @return bool
+**/
+static bool constant_key(Value* value, char* key) {
+
+    uint64_t bits;
+
+    ValueType type = VALUE_TYPE(value);
 
-    emit_opcode(OP_CONSTANT);
-    Value* val = create_value(VAL_OBJ);
-    val->as.obj = obj;
-    return add_constant(val);
+    switch(type) {
+        case VAL_INUM: bits = (uint64_t)AS_INUM(value); break;
+        case VAL_UNUM: bits = AS_UNUM(value); break;
+        case VAL_FNUM: {
+                double num = AS_FNUM(value);
+                memcpy(&bits, &num, sizeof(bits));
+            }
+            break;
+        case VAL_OBJ:
+            if(value_is_string(value)) {
+                ObjString* str = intern_string(value_as_string(value));
+                if((Obj*)str != AS_OBJ(value)) {
+                    free_object(AS_OBJ(value));
+                    *value = OBJ_VALUE(str);
+                }
+                snprintf(key, CONSTANT_KEY_SIZE, "s:%p", (void*)str);
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+
+    snprintf(key, CONSTANT_KEY_SIZE, "%d:%016lx", (int)type, (unsigned long)bits);
+    return true;
 }
 
-size_t add_constant(Value* value) {
+/**
+    @brief Add a constant to the pool and write its index into the code. If
+    the same constant is already in the pool, then the existing slot is used
+    and the value (and its object) is freed. The pool owns the value either
+    way.
+
+    @param block
+    @param value
+    @return size_t -- index of the constant
+**/
+size_t add_constant(codeBlock* block, Value* value) {
 
-    write_value_list(vm->block, value);
-    write_code_list(vm->block, value_list_size(vm->block) - 1);
-    return value_list_size(vm->block) - 1;
+    char key[CONSTANT_KEY_SIZE];
+    size_t index;
+
+    if(constant_key(value, key)) {
+        if(HASH_NO_ERROR == find_hash(block->pool, key, &index, sizeof(index))) {
+            if(IS_OBJ(value))
+                free_object(AS_OBJ(value));
+            free_value(value);
+        }
+        else {
+            write_value_list(block, value);
+            index = value_list_size(block) - 1;
+            insert_hash(block->pool, key, &index, sizeof(index));
+        }
+    }
+    else {
+        write_value_list(block, value);
+        index = value_list_size(block) - 1;
+    }
+
+    write_code_list(block, index);
+    return index;
+}
+
+/**
+    @brief Throw away the constants that were added to the pool after it had
+    count of them, with their objects and their keys, so that the same value
+    gets a new slot if it is added again. No code may still refer to them.
+
+    @param block
+    @param count
+**/
+void truncate_constants(codeBlock* block, size_t count) {
+
+    char key[CONSTANT_KEY_SIZE];
+
+    while((size_t)value_list_size(block) > count) {
+        Value* value = pop_ptr_list(block->constants);
+        if(constant_key(value, key))
+            remove_hash(block->pool, key);
+        if(IS_OBJ(value))
+            free_object(AS_OBJ(value));
+        free_value(value);
+    }
 }
 
 static void print_object(const Value* val) {
 
-    switch(val->as.obj->type) {
+    switch(AS_OBJ(val)->type) {
         case OBJ_STRING:
             printf("%s", value_as_cstring((Value*)val));
             break;
@@ -102,21 +251,26 @@ static void print_object(const Value* val) {
 
 void print_value(const Value* value) {
 
-    switch(value->type) {
+    if(value == NULL) {
+        printf("no value");
+        return;
+    }
+
+    switch(VALUE_TYPE(value)) {
         case VAL_FNUM:
-            printf("%0.3f", value->as.fnum);
+            printf("%0.3f", AS_FNUM(value));
             break;
         case VAL_UNUM:
-            printf("0x%lX", value->as.unum);
+            printf("0x%lX", AS_UNUM(value));
             break;
         case VAL_INUM:
-            printf("%ld", value->as.inum);
+            printf("%ld", AS_INUM(value));
             break;
         case VAL_NOTHING:
             printf("nothing");
             break;
         case VAL_BOOL:
-            printf("%s", value->as.bval? "true": "false");
+            printf("%s", AS_BOOL(value)? "true": "false");
             break;
         case VAL_OBJ:
             print_object(value);
@@ -29,6 +29,149 @@ typedef ptr_list_t ValueArray;
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
+/*
+ * A Value has two layouts. Only the macros below know which one is in use, so
+ * the rest of the code never touches the fields of a Value directly. The
+ * macros that read a Value take a pointer to it, and the ones that make a
+ * Value return it by value.
+ *
+ * By default a Value is a ValueType tag and a union, which is 16 bytes. When
+ * the build defines NAN_BOXING, a Value is one 64 bit word. A double is
+ * stored as itself. Everything else is hidden in the payload of a quiet NaN,
+ * with a tag in the sign bit and the two bits under the quiet bit:
+ *
+ *      0 11111111111 11 tt <48 bits>   tt = 01 int, 10 uint, 11 bool/nothing
+ *      1 11111111111 11 00 <pointer>   Obj*
+ *      1 11111111111 11 01 <pointer>   wideNumber*
+ *
+ * An int or a uint that does not fit in 48 bits goes into a wideNumber. The
+ * ones in the constants are interned like strings. The ones that the VM makes
+ * belong to the machine until it is reset, like the objects that it makes. A
+ * Value that holds one can be copied and dropped like any other.
+ */
+#ifdef NAN_BOXING
+
+typedef struct {
+    uint64_t bits;
+} Value;
+
+typedef struct {
+    ValueType type;     // VAL_INUM or VAL_UNUM
+    union {
+        uint64_t unum;
+        int64_t inum;
+    } as;
+} wideNumber;
+
+#define NB_QNAN         ((uint64_t)0x7ffc000000000000)
+#define NB_SIGN         ((uint64_t)0x8000000000000000)
+#define NB_PAYLOAD      ((uint64_t)0x0000ffffffffffff)
+#define NB_TAG_MASK     (NB_SIGN | NB_QNAN | ((uint64_t)3 << 48))
+#define NB_TAG_INUM     (NB_QNAN | ((uint64_t)1 << 48))
+#define NB_TAG_UNUM     (NB_QNAN | ((uint64_t)2 << 48))
+#define NB_TAG_MISC     (NB_QNAN | ((uint64_t)3 << 48))
+#define NB_TAG_OBJ      (NB_SIGN | NB_QNAN)
+#define NB_TAG_WIDE     (NB_SIGN | NB_QNAN | ((uint64_t)1 << 48))
+#define NB_FALSE        (NB_TAG_MISC | 0)
+#define NB_TRUE         (NB_TAG_MISC | 1)
+#define NB_NOTHING      (NB_TAG_MISC | 2)
+#define NB_INVALID      (NB_TAG_MISC | 3)
+#define NB_CANON_NAN    ((uint64_t)0x7ff8000000000000)
+
+const wideNumber* box_wide_number(ValueType, uint64_t);
+
+static inline const wideNumber* __attribute__((always_inline)) nb_wide(uint64_t bits) {
+    return (const wideNumber*)(uintptr_t)(bits & NB_PAYLOAD);
+}
+
+static inline ValueType __attribute__((always_inline)) nb_type(uint64_t bits) {
+
+    if((bits & NB_QNAN) != NB_QNAN)
+        return VAL_FNUM;
+
+    switch(bits & NB_TAG_MASK) {
+        case NB_TAG_INUM: return VAL_INUM;
+        case NB_TAG_UNUM: return VAL_UNUM;
+        case NB_TAG_OBJ:  return VAL_OBJ;
+        case NB_TAG_WIDE: return nb_wide(bits)->type;
+        case NB_TAG_MISC:
+            return (bits == NB_TRUE || bits == NB_FALSE)? VAL_BOOL:
+                        (bits == NB_NOTHING)? VAL_NOTHING: VAL_INVALID;
+        default: return VAL_INVALID;
+    }
+}
+
+static inline int64_t __attribute__((always_inline)) nb_as_inum(uint64_t bits) {
+
+    if((bits & NB_TAG_MASK) == NB_TAG_WIDE)
+        return nb_wide(bits)->as.inum;
+    return (int64_t)(bits << 16) >> 16;
+}
+
+static inline uint64_t __attribute__((always_inline)) nb_as_unum(uint64_t bits) {
+
+    if((bits & NB_TAG_MASK) == NB_TAG_WIDE)
+        return nb_wide(bits)->as.unum;
+    return bits & NB_PAYLOAD;
+}
+
+static inline double __attribute__((always_inline)) nb_as_fnum(uint64_t bits) {
+
+    double num;
+    memcpy(&num, &bits, sizeof(num));
+    return num;
+}
+
+static inline Value __attribute__((always_inline)) nb_inum(int64_t num) {
+
+    if(((int64_t)((uint64_t)num << 16) >> 16) == num)
+        return (Value){NB_TAG_INUM | ((uint64_t)num & NB_PAYLOAD)};
+    return (Value){NB_TAG_WIDE | (uintptr_t)box_wide_number(VAL_INUM, (uint64_t)num)};
+}
+
+static inline Value __attribute__((always_inline)) nb_unum(uint64_t num) {
+
+    if(num <= NB_PAYLOAD)
+        return (Value){NB_TAG_UNUM | num};
+    return (Value){NB_TAG_WIDE | (uintptr_t)box_wide_number(VAL_UNUM, num)};
+}
+
+static inline Value __attribute__((always_inline)) nb_fnum(double num) {
+
+    uint64_t bits;
+    memcpy(&bits, &num, sizeof(bits));
+    // a NaN with the tag bits set would read back as something else
+    if((bits & NB_QNAN) == NB_QNAN)
+        bits = NB_CANON_NAN;
+    return (Value){bits};
+}
+
+#define VALUE_TYPE(v)       nb_type((v)->bits)
+#define AS_INUM(v)          nb_as_inum((v)->bits)
+#define AS_UNUM(v)          nb_as_unum((v)->bits)
+#define AS_FNUM(v)          nb_as_fnum((v)->bits)
+#define AS_BOOL(v)          ((v)->bits == NB_TRUE)
+#define AS_OBJ(v)           ((Obj*)(uintptr_t)((v)->bits & NB_PAYLOAD))
+
+#define INUM_VALUE(n)       nb_inum(n)
+#define UNUM_VALUE(n)       nb_unum(n)
+#define FNUM_VALUE(n)       nb_fnum(n)
+#define BOOL_VALUE(b)       ((Value){(b)? NB_TRUE: NB_FALSE})
+#define OBJ_VALUE(o)        ((Value){NB_TAG_OBJ | (uintptr_t)(o)})
+#define NOTHING_VALUE       ((Value){NB_NOTHING})
+#define INVALID_VALUE       ((Value){NB_INVALID})
+
+#define IS_FNUM(v)          (((v)->bits & NB_QNAN) != NB_QNAN)
+#define IS_BOOL(v)          ((v)->bits == NB_TRUE || (v)->bits == NB_FALSE)
+#define IS_NOTHING(v)       ((v)->bits == NB_NOTHING)
+#define IS_OBJ(v)           (((v)->bits & NB_TAG_MASK) == NB_TAG_OBJ)
+#define IS_NUMBER(v)        (IS_FNUM(v) || \
+                                ((v)->bits & NB_TAG_MASK) == NB_TAG_INUM || \
+                                ((v)->bits & NB_TAG_MASK) == NB_TAG_UNUM || \
+                                ((v)->bits & NB_TAG_MASK) == NB_TAG_WIDE)
+
+#else
+
 typedef struct {
     ValueType type;
     union {
@@ -40,10 +183,36 @@ typedef struct {
     } as;
 } Value;
 
+#define VALUE_TYPE(v)       ((v)->type)
+#define AS_INUM(v)          ((v)->as.inum)
+#define AS_UNUM(v)          ((v)->as.unum)
+#define AS_FNUM(v)          ((v)->as.fnum)
+#define AS_BOOL(v)          ((v)->as.bval)
+#define AS_OBJ(v)           ((v)->as.obj)
+
+#define INUM_VALUE(n)       ((Value){.type = VAL_INUM, .as.inum = (n)})
+#define UNUM_VALUE(n)       ((Value){.type = VAL_UNUM, .as.unum = (n)})
+#define FNUM_VALUE(n)       ((Value){.type = VAL_FNUM, .as.fnum = (n)})
+#define BOOL_VALUE(b)       ((Value){.type = VAL_BOOL, .as.bval = (b)})
+#define OBJ_VALUE(o)        ((Value){.type = VAL_OBJ, .as.obj = (Obj*)(o)})
+#define NOTHING_VALUE       ((Value){.type = VAL_NOTHING})
+#define INVALID_VALUE       ((Value){.type = VAL_INVALID})
+
+#define IS_FNUM(v)          ((v)->type == VAL_FNUM)
+#define IS_BOOL(v)          ((v)->type == VAL_BOOL)
+#define IS_NOTHING(v)       ((v)->type == VAL_NOTHING)
+#define IS_OBJ(v)           ((v)->type == VAL_OBJ)
+#define IS_NUMBER(v)        ((v)->type == VAL_FNUM || \
+                                (v)->type == VAL_INUM || \
+                                (v)->type == VAL_UNUM)
+
+#endif
+
 #define create_code_list        (codeArray*)create_u16_list
 #define free_code_list(b)       destroy_u16_list((b)->code)
 #define write_code_list(b, v)   append_u16_list((b)->code, v)
 #define code_list_size(b)       ((b)->code->nitems)
+#define truncate_code_list(b, n) truncate_u16_list((b)->code, n)
 #define raw_code_list(b)        ((b)->code->buffer)
 typedef u16_list_t codeArray;
 
@@ -66,46 +235,113 @@ typedef enum {
     OP_LTE,
     OP_GTE,
     OP_RETURN,
+
+    // Type-specialized operations. The compiler emits these when it knows
+    // that both operands already have the same type, so the VM does not
+    // need to normalize them.
+    OP_ADD_I64,
+    OP_SUB_I64,
+    OP_MUL_I64,
+    OP_DIV_I64,
+    OP_MOD_I64,
+    OP_ADD_U64,
+    OP_SUB_U64,
+    OP_MUL_U64,
+    OP_DIV_U64,
+    OP_MOD_U64,
+    OP_ADD_F64,
+    OP_SUB_F64,
+    OP_MUL_F64,
+    OP_DIV_F64,
+    OP_MOD_F64,
+    OP_EQ_I64,
+    OP_NEQ_I64,
+    OP_LT_I64,
+    OP_GT_I64,
+    OP_LTE_I64,
+    OP_GTE_I64,
+    OP_EQ_U64,
+    OP_NEQ_U64,
+    OP_LT_U64,
+    OP_GT_U64,
+    OP_LTE_U64,
+    OP_GTE_U64,
+    OP_LT_F64,
+    OP_GT_F64,
+    OP_LTE_F64,
+    OP_GTE_F64,
+
+    // Superinstructions. fuse_code() replaces an OP_CONSTANT and the
+    // operation after it with the _CONST form, which has the index of the
+    // constant as its operand. The _CONST_CONST form replaces two
+    // OP_CONSTANTs and the operation, and has both indexes.
+    OP_ADD_CONST,
+    OP_SUB_CONST,
+    OP_MUL_CONST,
+    OP_DIV_CONST,
+    OP_MOD_CONST,
+    OP_EQ_CONST,
+    OP_NEQ_CONST,
+    OP_LT_CONST,
+    OP_GT_CONST,
+    OP_LTE_CONST,
+    OP_GTE_CONST,
+    OP_ADD_CONST_CONST,
+    OP_SUB_CONST_CONST,
+    OP_MUL_CONST_CONST,
+    OP_DIV_CONST_CONST,
+    OP_MOD_CONST_CONST,
+    OP_EQ_CONST_CONST,
+    OP_NEQ_CONST_CONST,
+    OP_LT_CONST_CONST,
+    OP_GT_CONST_CONST,
+    OP_LTE_CONST_CONST,
+    OP_GTE_CONST_CONST,
+
+    OP_COUNT,   // number of opcodes. Must be last.
 } OpCode;
 
+/**
+    @brief Return the number of constant indexes that follow the opcode in
+    the code.
+
+    @param op
+    @return int
+**/
+static inline int __attribute__((always_inline)) opcode_operands(uint16_t op) {
+
+    if(op == OP_CONSTANT || (op >= OP_ADD_CONST && op <= OP_GTE_CONST))
+        return 1;
+    else if(op >= OP_ADD_CONST_CONST && op <= OP_GTE_CONST_CONST)
+        return 2;
+    return 0;
+}
+
 typedef struct {
     codeArray* code;
     ValueArray* constants;
+    hashtable_t* pool;  // constant key -> index in constants
+    const void* mapping;    // the bytecode file that the code is in, or NULL
+    size_t mapping_size;
 } codeBlock;
 
 codeBlock* create_codeblock();
 void free_codeblock(codeBlock*);
 
-void emit_opcode(uint16_t);
-size_t emit_fnum_value(double);
-size_t emit_unum_value(uint64_t);
-size_t emit_inum_value(int64_t);
-size_t emit_obj_value(Obj*);
-size_t add_constant(Value*);
+void emit_opcode(codeBlock*, uint16_t);
+size_t code_offset(codeBlock*);
+void truncate_code(codeBlock*, size_t);
+uint16_t get_code(codeBlock*, size_t);
+Value* get_constant(codeBlock*, size_t);
+size_t emit_fnum_value(codeBlock*, double);
+size_t emit_unum_value(codeBlock*, uint64_t);
+size_t emit_inum_value(codeBlock*, int64_t);
+size_t emit_obj_value(codeBlock*, Obj*);
+size_t add_constant(codeBlock*, Value*);
+void truncate_constants(codeBlock*, size_t);
 
-Value* create_value(ValueType);
+Value* create_value(Value);
 void free_value(Value*);
 void print_value(const Value*);
-// bool value_is_number(Value*);
-// bool value_is_bool(Value*);
-// bool value_is_void(Value*);
-
-static inline bool __attribute__((always_inline)) value_is_number(Value* val) {
-    return (val->type == VAL_FNUM ||
-        val->type == VAL_INUM ||
-        val->type == VAL_UNUM);
-}
-
-static inline bool __attribute__((always_inline)) value_is_bool(Value* val) {
-    return val->type == VAL_BOOL;
-}
-
-static inline bool __attribute__((always_inline)) value_is_nothing(Value* val) {
-    return val->type == VAL_NOTHING;
-}
-
-static inline bool __attribute__((always_inline)) value_is_object(Value* val) {
-    return val->type == VAL_OBJ;
-}
 
 #endif
@@ -1,9 +1,6 @@
 #ifndef __COMMON_H__
 #define __COMMON_H__
 
-#define DEBUG_TRACE_EXECUTION
-#define DEBUG_PRINT_CODE
-
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,9 +22,13 @@
 #include "configure.h"
 
 #include "scanner.h"
-#include "compiler.h"
 #include "codeblocks.h"
+#include "bytecode.h"
+#include "cache.h"
+#include "fusion.h"
+#include "compiler.h"
 #include "object.h"
+#include "numbers.h"
 #include "vmachine.h"
 #include "disassembler.h"
 
@@ -4,6 +4,10 @@
     @brief
 
 **/
+// flockfile() is POSIX, and --std=c99 hides it.
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+
 #include "common.h"
 
 //#include "vmachine.h"
@@ -11,60 +15,196 @@
 #   include "disassembler.h"
 #endif
 
-Parser parser;
-
-void advance() {
+void advance(Parser* parser) {
+
+    if(parser->tokens != NULL) {
+        // the two slots take turns being crnt and prev
+        Token* next = (parser->crnt == &parser->slots[0])? &parser->slots[1]: &parser->slots[0];
+        parser->prev = parser->crnt;
+        do {
+            load_token(parser->tokens, parser->index++, next);
+            // Skip error tokens that are delivered by the scanner.
+        } while(next->type == ERROR_TOKEN);
+        parser->crnt = next;
+        return;
+    }
 
-    if(parser.prev != NULL)
-        FREE(parser.prev);
+    free_token(parser->prev);
 
-    parser.prev = parser.crnt;
+    parser->prev = parser->crnt;
     while(true) {
-        parser.crnt = get_tok();
-        if(parser.crnt->type != ERROR_TOKEN)
+        parser->crnt = get_tok();
+        if(parser->crnt->type != ERROR_TOKEN)
             break;
         // Skip error tokens that are delivered by the scanner.
         // The scanner has already posted an error.
     }
 }
 
-void consume(TokenType type) {
+void consume(Parser* parser, TokenType type) {
 
-    if(parser.crnt->type == type) {
-        advance();
+    if(parser->crnt->type == type) {
+        advance(parser);
         return;
     }
 
-    if(parser.panicMode)
+    if(parser->panicMode)
         return;
 
-    parser.hadError = true;
-    syntax("expected a %s but got a %s", token_to_str(type), token_to_str(parser.crnt->type));
-    parser.panicMode = true;
+    parser->hadError = true;
+    syntax("expected a %s but got a %s", token_to_str(type), token_to_str(parser->crnt->type));
+    parser->panicMode = true;
 }
 
 
 /**
-    @brief Compile from the input stream.
+    @brief Compile from the input stream into the code block.
     This assumes that there is an open input stream for the scanner to scan
     from.
 
     The compiler and the parser are integrated together.
+
+    If there are errors, the code for this input is taken back out of the
+    block, so that it is never run.
+
+    The tokens of the input are in the line arena of the thread, and none of
+    them outlive the compile, so the arena is released here for each input.
+
+    @param block
+    @return bool -- false if there were errors
 **/
-void compile() {
+bool compile(codeBlock* block) {
 
-    parser.hadError = false;
-    parser.panicMode = false;
+    Parser parser = {.block = block, .exprType = VAL_INVALID};
+    size_t start = code_offset(block);
+    int errors = get_thread_errors();
 
-    advance();
-    expression();
-    consume(END_OF_FILE);
-    consume(END_OF_INPUT);
+    reset_arena(ARENA_LINE);
+    if(GET_CONFIG_BOOL("BATCH_SCAN")) {
+        parser.tokens = scan_tokens();
+        parser.index = 0;
+    }
+
+    advance(&parser);
+    expression(&parser);
+    consume(&parser, END_OF_FILE);
+    consume(&parser, END_OF_INPUT);
 
-    emit_opcode(OP_RETURN);
+    emit_opcode(block, OP_RETURN);
+
+    if(parser.tokens != NULL)
+        free_token_buffer(parser.tokens);
+    else {
+        free_token(parser.prev);
+        free_token(parser.crnt);
+    }
+
+    bool ok = (get_thread_errors() == errors);
+    int fused = 0;
+    if(ok)
+        fused = fuse_code(block, start);
+    else
+        truncate_code(block, start);
+
+    log_debug("constant folding removed %d instructions", parser.folded);
+    log_debug("fusion removed %d instructions", fused);
 #ifdef DEBUG_PRINT_CODE
     //if(!parser.hadError) {
-    disassemble_codeblock("code");
+    flockfile(stdout);  // keep listings from other threads out of this one
+    disassemble_codeblock(block, "code");
+    printf("constant folding removed %d instructions\n", parser.folded);
+    printf("fusion removed %d instructions\n", fused);
+    funlockfile(stdout);
     //}
 #endif
+
+    return ok;
+}
+
+/*
+ * The files that compile_files() hands out to its threads. Each thread takes
+ * the next file until there are none left.
+ */
+typedef struct {
+    compile_job_t* jobs;
+    int count;
+    int next;
+} job_queue_t;
+
+static void* compile_worker(void* arg) {
+
+    job_queue_t* queue = (job_queue_t*)arg;
+
+    int index;
+    while((index = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->count) {
+        compile_job_t* job = &queue->jobs[index];
+        log_debug("compile %s", job->fname);
+
+        job->compiled = true;
+        if(is_bytecode_file(job->fname)) {
+            free_codeblock(job->block);
+            job->block = load_bytecode(job->fname);
+            continue;
+        }
+
+        uint64_t key;
+        bool keyed = cache_enabled() && cache_key(job->fname, &key);
+        if(keyed) {
+            codeBlock* cached = cache_load(key);
+            if(cached != NULL) {
+                free_codeblock(job->block);
+                job->block = cached;
+                continue;
+            }
+        }
+
+        // A file with a syntax error can leave input behind. A new scanner
+        // keeps it out of the next file.
+        scanner_t* scanner = create_scanner();
+        set_scanner(scanner);
+        set_error_log(job->errors);
+
+        open_scanner_file(job->fname);
+        job->compiled = compile(job->block);
+
+        // code that has messages is compiled again, so they are seen again
+        if(keyed && error_log_is_empty(job->errors))
+            cache_store(key, job->block);
+
+        set_error_log(NULL);
+        set_scanner(NULL);
+        free_scanner(scanner);
+    }
+
+    release_thread_memory();
+    return NULL;
+}
+
+/**
+    @brief Compile the input files on a number of threads. Each job needs a
+    file name, an empty code block and an error log. Bytecode files, and files
+    that are in the cache, are loaded into a new block instead. A job that
+    had errors is marked as not compiled. The messages
+    for a file go to its log, so that the caller can report them in input order.
+
+    @param jobs
+    @param count
+    @param threads
+**/
+void compile_files(compile_job_t* jobs, int count, int threads) {
+
+    job_queue_t queue = {.jobs = jobs, .count = count, .next = 0};
+
+    threads = MAX(1, MIN(threads, count));
+    pthread_t* tids = MALLOC(sizeof(pthread_t) * threads);
+
+    log_debug("compile %d files on %d threads", count, threads);
+    for(int i = 0; i < threads; i++)
+        if(pthread_create(&tids[i], NULL, compile_worker, &queue) != 0)
+            fatal_error("cannot create a compiler thread");
+
+    for(int i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+
+    FREE(tids);
 }
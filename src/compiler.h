@@ -9,16 +9,39 @@
 
 #include "common.h"
 
+/*
+ * The state of one compile. compile() keeps it on the stack and passes it to
+ * the parse functions, so any number of compiles can run at the same time.
+ */
 typedef struct {
+    codeBlock* block;       // where the code is emitted
     Token* crnt;
     Token* prev;
+    token_buffer_t* tokens; // the scanned input, or NULL to scan as we go
+    size_t index;           // next token in tokens
+    Token slots[2];         // crnt and prev when reading from tokens
     bool hadError;
     bool panicMode;
+    ValueType exprType; // type of the last expression, or VAL_INVALID if unknown
+    size_t exprStart;   // code offset where the last expression starts
+    size_t constStart;  // constants in the pool when it started
+    int folded;         // number of instructions removed by constant folding
 } Parser;
 
-void advance();
-void consume(TokenType type);
-void expression();
-void compile();
+/*
+ * One input file for compile_files().
+ */
+typedef struct {
+    const char* fname;
+    codeBlock* block;       // the code is emitted here
+    error_log_t* errors;    // the messages are held here
+    bool compiled;          // false if the file had errors
+} compile_job_t;
+
+void advance(Parser*);
+void consume(Parser*, TokenType type);
+void expression(Parser*);
+bool compile(codeBlock*);
+void compile_files(compile_job_t*, int, int);
 
 #endif
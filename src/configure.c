@@ -150,7 +150,7 @@ int configure(int argc, char** argv) {
 
     init_config();
 
-    strncpy(prog_name, argv[0], sizeof(prog_name));
+    strncpy(prog_name, argv[0], sizeof(prog_name) - 1);
     for(idx = 1; idx < argc; idx++) {
         config = find_config_by_arg(argv[idx]);
         if(config == NULL) {
@@ -6,7 +6,79 @@
 **/
 #include "common.h"
 
-extern VMachine* vm;
+static const char* opcode_names[OP_COUNT] = {
+    [OP_CONSTANT]   = "OP_CONSTANT",
+    [OP_ADD]        = "OP_ADD",
+    [OP_SUB]        = "OP_SUB",
+    [OP_MUL]        = "OP_MUL",
+    [OP_DIV]        = "OP_DIV",
+    [OP_MOD]        = "OP_MOD",
+    [OP_EQUALITY]   = "OP_EQUALITY",
+    [OP_NEQ]        = "OP_NEQ",
+    [OP_LT]         = "OP_LT",
+    [OP_GT]         = "OP_GT",
+    [OP_LTE]        = "OP_LTE",
+    [OP_GTE]        = "OP_GTE",
+    [OP_NEG]        = "OP_NEG",
+    [OP_NOTHING]    = "OP_NOTHING",
+    [OP_TRUE]       = "OP_TRUE",
+    [OP_FALSE]      = "OP_FALSE",
+    [OP_NOT]        = "OP_NOT",
+    [OP_RETURN]     = "OP_RETURN",
+    [OP_ADD_I64]    = "OP_ADD_I64",
+    [OP_SUB_I64]    = "OP_SUB_I64",
+    [OP_MUL_I64]    = "OP_MUL_I64",
+    [OP_DIV_I64]    = "OP_DIV_I64",
+    [OP_MOD_I64]    = "OP_MOD_I64",
+    [OP_ADD_U64]    = "OP_ADD_U64",
+    [OP_SUB_U64]    = "OP_SUB_U64",
+    [OP_MUL_U64]    = "OP_MUL_U64",
+    [OP_DIV_U64]    = "OP_DIV_U64",
+    [OP_MOD_U64]    = "OP_MOD_U64",
+    [OP_ADD_F64]    = "OP_ADD_F64",
+    [OP_SUB_F64]    = "OP_SUB_F64",
+    [OP_MUL_F64]    = "OP_MUL_F64",
+    [OP_DIV_F64]    = "OP_DIV_F64",
+    [OP_MOD_F64]    = "OP_MOD_F64",
+    [OP_EQ_I64]     = "OP_EQ_I64",
+    [OP_NEQ_I64]    = "OP_NEQ_I64",
+    [OP_LT_I64]     = "OP_LT_I64",
+    [OP_GT_I64]     = "OP_GT_I64",
+    [OP_LTE_I64]    = "OP_LTE_I64",
+    [OP_GTE_I64]    = "OP_GTE_I64",
+    [OP_EQ_U64]     = "OP_EQ_U64",
+    [OP_NEQ_U64]    = "OP_NEQ_U64",
+    [OP_LT_U64]     = "OP_LT_U64",
+    [OP_GT_U64]     = "OP_GT_U64",
+    [OP_LTE_U64]    = "OP_LTE_U64",
+    [OP_GTE_U64]    = "OP_GTE_U64",
+    [OP_LT_F64]     = "OP_LT_F64",
+    [OP_GT_F64]     = "OP_GT_F64",
+    [OP_LTE_F64]    = "OP_LTE_F64",
+    [OP_GTE_F64]    = "OP_GTE_F64",
+    [OP_ADD_CONST]   = "OP_ADD_CONST",
+    [OP_SUB_CONST]   = "OP_SUB_CONST",
+    [OP_MUL_CONST]   = "OP_MUL_CONST",
+    [OP_DIV_CONST]   = "OP_DIV_CONST",
+    [OP_MOD_CONST]   = "OP_MOD_CONST",
+    [OP_EQ_CONST]    = "OP_EQ_CONST",
+    [OP_NEQ_CONST]   = "OP_NEQ_CONST",
+    [OP_LT_CONST]    = "OP_LT_CONST",
+    [OP_GT_CONST]    = "OP_GT_CONST",
+    [OP_LTE_CONST]   = "OP_LTE_CONST",
+    [OP_GTE_CONST]   = "OP_GTE_CONST",
+    [OP_ADD_CONST_CONST] = "OP_ADD_CONST_CONST",
+    [OP_SUB_CONST_CONST] = "OP_SUB_CONST_CONST",
+    [OP_MUL_CONST_CONST] = "OP_MUL_CONST_CONST",
+    [OP_DIV_CONST_CONST] = "OP_DIV_CONST_CONST",
+    [OP_MOD_CONST_CONST] = "OP_MOD_CONST_CONST",
+    [OP_EQ_CONST_CONST]  = "OP_EQ_CONST_CONST",
+    [OP_NEQ_CONST_CONST] = "OP_NEQ_CONST_CONST",
+    [OP_LT_CONST_CONST]  = "OP_LT_CONST_CONST",
+    [OP_GT_CONST_CONST]  = "OP_GT_CONST_CONST",
+    [OP_LTE_CONST_CONST] = "OP_LTE_CONST_CONST",
+    [OP_GTE_CONST_CONST] = "OP_GTE_CONST_CONST",
+};
 
 static size_t simple_instruction(const char* name, size_t offset) {
 
@@ -14,58 +86,71 @@ static size_t simple_instruction(const char* name, size_t offset) {
     return offset + 1;
 }
 
-static size_t constant_instruction(const char* name, codeBlock* cb, size_t offset) {
+/*
+ * Print an instruction that has the indexes of one or more constants after
+ * the opcode, with the values of the constants.
+ */
+static size_t constant_instruction(const char* name, codeBlock* cb, size_t offset, int count) {
 
     uint16_t* code = raw_code_list(cb);
-    uint16_t constant = code[offset + 1];
-    printf("%-16s %4d ", name, constant);
     Value** vals = raw_value_list(cb);
-    print_value(vals[constant]);
+    printf("%-16s", name);
+    for(int i = 1; i <= count; i++) {
+        printf(" %4d ", code[offset + i]);
+        print_value(vals[code[offset + i]]);
+    }
     printf("\n");
 
-    return offset + 2;
+    return offset + 1 + count;
 }
 
-void disassemble_codeblock(const char* name) {
+void disassemble_codeblock(codeBlock* code_block, const char* name) {
 
     printf("\ndisassemble block\n\n== %s ==\n", name);
 
-    codeBlock* code_block = vm->block;
     size_t length = code_list_size(code_block);
     for(size_t offset = 0; offset < length; /* empty */) {
         offset = disassemble_instruction(code_block, offset);
     }
 }
 
+/**
+    @brief Return the name of the opcode.
+
+    @param op
+    @return const char* -- NULL if it is not an opcode
+**/
+const char* opcode_name(uint16_t op) {
+
+    return (op < OP_COUNT)? opcode_names[op]: NULL;
+}
+
+/**
+    @brief Return the opcode that has the name.
+
+    @param name
+    @return int -- the opcode, or -1 if there is none with the name
+**/
+int opcode_by_name(const char* name) {
+
+    for(int op = 0; op < OP_COUNT; op++)
+        if(opcode_names[op] != NULL && !strcmp(opcode_names[op], name))
+            return op;
+    return -1;
+}
+
 int disassemble_instruction(codeBlock* code_block, size_t offset) {
 
     printf("%04lu ", offset);
 
     uint16_t* code = raw_code_list(code_block);
     uint16_t instruction = code[offset];
-    switch(instruction) {
-        case OP_CONSTANT:
-            return constant_instruction("OP_CONSTANT", code_block, offset);
-        case OP_ADD:    return simple_instruction("OP_ADD", offset);
-        case OP_SUB:    return simple_instruction("OP_SUB", offset);
-        case OP_MUL:    return simple_instruction("OP_MUL", offset);
-        case OP_DIV:    return simple_instruction("OP_DIV", offset);
-        case OP_MOD:    return simple_instruction("OP_MOD", offset);
-        case OP_EQUALITY: return simple_instruction("OP_EQUALITY", offset);
-        case OP_NEQ:    return simple_instruction("OP_NEQ", offset);
-        case OP_LT:     return simple_instruction("OP_LT", offset);
-        case OP_GT:     return simple_instruction("OP_GT", offset);
-        case OP_LTE:    return simple_instruction("OP_LTE", offset);
-        case OP_GTE:    return simple_instruction("OP_GTE", offset);
-        case OP_NEG:    return simple_instruction("OP_NEG", offset);
-        case OP_NOTHING: return simple_instruction("OP_NOTHING", offset);
-        case OP_TRUE:   return simple_instruction("OP_TRUE", offset);
-        case OP_FALSE:  return simple_instruction("OP_FALSE", offset);
-        case OP_NOT:    return simple_instruction("OP_NOT", offset);
-        case OP_RETURN: return simple_instruction("OP_RETURN", offset);
-        default:
-            printf("OPCODE ERROR: Unknown opcode %d\n", instruction);
-            return offset + 1;
-    }
-}
+    if(opcode_operands(instruction) > 0)
+        return constant_instruction(opcode_name(instruction), code_block, offset,
+                    opcode_operands(instruction));
+    else if(opcode_name(instruction) != NULL)
+        return simple_instruction(opcode_name(instruction), offset);
 
+    printf("OPCODE ERROR: Unknown opcode %d\n", instruction);
+    return offset + 1;
+}
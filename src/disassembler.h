@@ -9,7 +9,9 @@
 
 #include "common.h"
 
-void disassemble_codeblock(const char*);
+void disassemble_codeblock(codeBlock*, const char*);
 int disassemble_instruction(codeBlock*, size_t);
+const char* opcode_name(uint16_t);
+int opcode_by_name(const char*);
 
 #endif
@@ -1,5 +1,6 @@
 #include "common.h"
 #include <stdarg.h>
+#include <setjmp.h>
 
 #include "scanner.h"
 
@@ -9,8 +10,40 @@ static struct {
     int warnings;
 } errors;
 
+// The totals are shared by all of the threads, and machines post runtime
+// errors and warnings to them from any thread, so they only change atomically.
+#define ADD_TOTAL(total, n) __atomic_fetch_add(&(total), (n), __ATOMIC_RELAXED)
+#define GET_TOTAL(total) __atomic_load_n(&(total), __ATOMIC_RELAXED)
+
+// Errors that this thread has added to the totals. A compile only looks at
+// its own, so an error in a machine on another thread cannot fail it.
+static __thread int thread_errors = 0;
+
+static inline void count_error() {
+
+    ADD_TOTAL(errors.errors, 1);
+    thread_errors++;
+}
+
+// Where runtime_error() goes instead of exit() while a machine runs on this
+// thread. See set_runtime_handler().
+static __thread jmp_buf* runtime_handler = NULL;
+
 // messages longer than this will be truncated to this length.
-static char msg_buff[132];
+#define MSG_BUFF_SIZE 132
+
+/*
+ * The syntax errors and warnings for one input. When a thread has a log set,
+ * the messages and counts are held in it until flush_error_log(), so inputs
+ * that are compiled at the same time are reported in input order.
+ */
+struct _error_log_t {
+    char_buffer_t text;
+    int errors;
+    int warnings;
+};
+
+static __thread error_log_t* error_log = NULL;
 
 // static void report() {
 //     // TODO: tie this into verbosity
@@ -25,9 +58,102 @@ void init_errors(FILE* fp) {
     //atexit(report);
 }
 
+/**
+    @brief Count the message and print it, or hold it in the error log of
+    this thread if there is one.
+
+    @param msg
+    @param is_error
+**/
+static void post_message(const char* msg, bool is_error) {
+
+    if(error_log != NULL) {
+        add_char_buffer_str(error_log->text, msg);
+        add_char_buffer(error_log->text, '\n');
+        if(is_error)
+            error_log->errors++;
+        else
+            error_log->warnings++;
+    }
+    else {
+        if(is_error)
+            count_error();
+        else
+            ADD_TOTAL(errors.warnings, 1);
+        fprintf(stderr, "%s\n", msg);
+    }
+}
+
+/**
+    @brief Create an empty error log.
+
+    @return error_log_t*
+**/
+error_log_t* create_error_log() {
+
+    error_log_t* log = ALLOC_DS(error_log_t);
+    log->text = create_char_buffer();
+    return log;
+}
+
+/**
+    @brief Make the log the one that syntax() and warning() post to in this
+    thread. NULL posts them directly.
+
+    @param log
+    @return error_log_t* -- the log that was in use before
+**/
+error_log_t* set_error_log(error_log_t* log) {
+
+    error_log_t* prev = error_log;
+    error_log = log;
+    return prev;
+}
+
+/**
+    @brief Print the messages in the log, add its counts to the totals and
+    free it. This is only called by the main thread.
+
+    @param log
+**/
+void flush_error_log(error_log_t* log) {
+
+    if(log != NULL) {
+        fputs(get_char_buffer(log->text), stderr);
+        ADD_TOTAL(errors.errors, log->errors);
+        ADD_TOTAL(errors.warnings, log->warnings);
+        destroy_char_buffer(log->text);
+        FREE(log);
+    }
+}
+
+/**
+    @brief Return the number of errors that this thread has posted, to its
+    log if it has one and to the totals if not. The errors that other threads
+    post to the totals are not counted.
+
+    @return int
+**/
+int get_thread_errors() {
+
+    return (error_log != NULL)? error_log->errors: thread_errors;
+}
+
+/**
+    @brief Return true if nothing has been posted to the log.
+
+    @param log
+    @return bool
+**/
+bool error_log_is_empty(error_log_t* log) {
+
+    return log->errors == 0 && log->warnings == 0;
+}
+
 void syntax(const char* str, ...) {
 
     va_list args;
+    char msg_buff[MSG_BUFF_SIZE];
     const char* name = get_file_name();
     int lnum = get_line_no();
     int col = get_column_no();
@@ -42,13 +168,13 @@ void syntax(const char* str, ...) {
     va_start(args, str);
     vsnprintf(&msg_buff[len], sizeof(msg_buff) - len, str, args);
     va_end(args);
-    errors.errors++;
-    fprintf(stderr, "%s\n", msg_buff);
+    post_message(msg_buff, true);
 }
 
 void warning(const char* str, ...) {
 
     va_list args;
+    char msg_buff[MSG_BUFF_SIZE];
     const char* name = get_file_name();
     int lnum = get_line_no();
     int col = get_column_no();
@@ -63,13 +189,13 @@ void warning(const char* str, ...) {
     va_start(args, str);
     vsnprintf(&msg_buff[len], sizeof(msg_buff) - len, str, args);
     va_end(args);
-    errors.warnings++;
-    fprintf(stderr, "%s\n", msg_buff);
+    post_message(msg_buff, false);
 }
 
 void fatal_error(const char* str, ...) {
 
     va_list args;
+    char msg_buff[MSG_BUFF_SIZE];
 
     snprintf(msg_buff, sizeof(msg_buff), "FATAL ERROR: ");
 
@@ -78,14 +204,37 @@ void fatal_error(const char* str, ...) {
     va_start(args, str);
     vsnprintf(&msg_buff[len], sizeof(msg_buff) - len, str, args);
     va_end(args);
-    errors.errors++;
+    count_error();
     fprintf(stderr, "%s\n", msg_buff);
     exit(1);
 }
 
+/**
+    @brief Make runtime_error() jump to the handler on this thread, instead
+    of ending the program, until it is called again with NULL. run_vmachine()
+    does this, so that an error only stops the machine that had it.
+
+    @param handler
+    @return jmp_buf* -- the handler that was set before
+**/
+jmp_buf* set_runtime_handler(jmp_buf* handler) {
+
+    jmp_buf* prev = runtime_handler;
+    runtime_handler = handler;
+    return prev;
+}
+
+/**
+    @brief Post an error from the running code. This does not return. It
+    jumps to the handler of the machine that is running on this thread, or
+    ends the program if there is none.
+
+    @param str
+**/
 void runtime_error(const char* str, ...) {
 
     va_list args;
+    char msg_buff[MSG_BUFF_SIZE];
 
     snprintf(msg_buff, sizeof(msg_buff), "RUNTIME ERROR: ");
 
@@ -94,14 +243,17 @@ void runtime_error(const char* str, ...) {
     va_start(args, str);
     vsnprintf(&msg_buff[len], sizeof(msg_buff) - len, str, args);
     va_end(args);
-    errors.errors++;
+    count_error();
     fprintf(stderr, "%s\n", msg_buff);
+    if(runtime_handler != NULL)
+        longjmp(*runtime_handler, 1);
     exit(1);
 }
 
 void runtime_warning(const char* str, ...) {
 
     va_list args;
+    char msg_buff[MSG_BUFF_SIZE];
 
     snprintf(msg_buff, sizeof(msg_buff), "RUNTIME WARNING: ");
 
@@ -110,13 +262,14 @@ void runtime_warning(const char* str, ...) {
     va_start(args, str);
     vsnprintf(&msg_buff[len], sizeof(msg_buff) - len, str, args);
     va_end(args);
-    errors.warnings++;
+    ADD_TOTAL(errors.warnings, 1);
     fprintf(stderr, "%s\n", msg_buff);
 }
 
 void command_error(const char* str, ...) {
 
     va_list args;
+    char msg_buff[MSG_BUFF_SIZE];
 
     snprintf(msg_buff, sizeof(msg_buff), "Command line error: ");
 
@@ -125,27 +278,27 @@ void command_error(const char* str, ...) {
     va_start(args, str);
     vsnprintf(&msg_buff[len], sizeof(msg_buff) - len, str, args);
     va_end(args);
-    errors.errors++;
+    count_error();
     fprintf(stderr, "%s\n", msg_buff);
 }
 
 int get_num_errors() {
 
-    return errors.errors;
+    return GET_TOTAL(errors.errors);
 }
 
 int get_num_warnings() {
 
-    return errors.warnings;
+    return GET_TOTAL(errors.warnings);
 }
 
 void inc_error_count() {
 
-    errors.errors ++;
+    count_error();
 }
 
 void inc_warning_count() {
-    errors.warnings ++;
+    ADD_TOTAL(errors.warnings, 1);
 }
 
 FILE* get_err_stream() {
@@ -170,6 +323,7 @@ void internal_assert(const char* file, const char* func, int line, const char* e
 
     if(!expr_val) {
         va_list args;
+        char msg_buff[MSG_BUFF_SIZE];
 
         snprintf(msg_buff, sizeof(msg_buff), "fatal error: %s: %s:%d assert failed: (%s): ", file, func, line, expr);
 
@@ -178,7 +332,7 @@ void internal_assert(const char* file, const char* func, int line, const char* e
         va_start(args, str);
         vsnprintf(&msg_buff[len], sizeof(msg_buff) - len, str, args);
         va_end(args);
-        errors.errors++;
+        count_error();
         fprintf(stderr, "%s\n", msg_buff);
         exit(1);
     }
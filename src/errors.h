@@ -2,11 +2,20 @@
 #define __ERRORS_H__
 
 #include "common.h"
+#include <setjmp.h>
+
+typedef struct _error_log_t error_log_t;
 
 void init_errors(FILE* fp);
+error_log_t* create_error_log();
+error_log_t* set_error_log(error_log_t*);
+void flush_error_log(error_log_t*);
+bool error_log_is_empty(error_log_t*);
+int get_thread_errors();
 void syntax(const char* str, ...);
 void warning(const char* str, ...);
 void fatal_error(const char* str, ...);
+jmp_buf* set_runtime_handler(jmp_buf* handler);
 void runtime_error(const char* str, ...);
 void runtime_warning(const char* str, ...);
 void command_error(const char* str, ...);
@@ -2,23 +2,23 @@
     @brief
 
 **/
+#include <math.h>
+
 #include "common.h"
 #include "expression.h"
 #include "scanner.h"
 #include "compiler.h"
 #include "vmachine.h"
 
-extern Parser parser;
-
-static void fnum();
-static void inum();
-static void unum();
-static void grouping();
-static void unary();
-static void abinary();
-static void cbinary();
-static void literal();
-static void string();
+static void fnum(Parser*);
+static void inum(Parser*);
+static void unum(Parser*);
+static void grouping(Parser*);
+static void unary(Parser*);
+static void abinary(Parser*);
+static void cbinary(Parser*);
+static void literal(Parser*);
+static void string(Parser*);
 
 static ParseRule rules[] = {
     [END_OF_INPUT] = {NULL,      NULL,       PREC_NONE},
@@ -97,117 +97,524 @@ static ParseRule rules[] = {
     [NAMESPACE_TOKEN] = {NULL,      NULL,       PREC_NONE},
 };
 
-static void fnum() {
+static void fnum(Parser* parser) {
+
+    emit_fnum_value(parser->block, parser->prev->num.fnum);
+    parser->exprType = VAL_FNUM;
+}
+
+static void inum(Parser* parser) {
 
-    double num = strtod(parser.prev->str, NULL);
-    emit_fnum_value(num);
+    // the scanner leaves 2^63 as INT64_MIN for unary() to negate
+    if(parser->prev->num.inum == INT64_MIN)
+        syntax("signed number is too large: 9223372036854775808");
+    emit_inum_value(parser->block, parser->prev->num.inum);
+    parser->exprType = VAL_INUM;
 }
 
-static void inum() {
+static void unum(Parser* parser) {
 
-    int64_t num = strtol(parser.prev->str, NULL, 10);
-    emit_inum_value(num);
+    emit_unum_value(parser->block, parser->prev->num.unum);
+    parser->exprType = VAL_UNUM;
 }
 
-static void unum() {
+static void grouping(Parser* parser) {
 
-    uint64_t num = strtol(parser.prev->str, NULL, 16);
-    emit_unum_value(num);
+    expression(parser);
+    consume(parser, CPAR_TOKEN);
 }
 
-static void grouping() {
+/**
+    @brief If the code from start to end is exactly one instruction that
+    pushes a literal, then copy the literal into val and return true.
+
+    @param parser
+    @param start
+    @param end
+    @param val
+    @return bool
+**/
+static bool literal_value(Parser* parser, size_t start, size_t end, Value* val) {
+
+    if(start >= end)
+        return false;
+
+    switch(get_code(parser->block, start)) {
+        case OP_CONSTANT:
+            if(end != start + 2)
+                return false;
+            *val = *get_constant(parser->block, get_code(parser->block, start + 1));
+            return true;
+        case OP_TRUE:
+        case OP_FALSE:
+            if(end != start + 1)
+                return false;
+            *val = BOOL_VALUE(get_code(parser->block, start) == OP_TRUE);
+            return true;
+        case OP_NOTHING:
+            if(end != start + 1)
+                return false;
+            *val = NOTHING_VALUE;
+            return true;
+        default:
+            return false;
+    }
+}
 
-    expression();
-    consume(CPAR_TOKEN);
+/**
+    @brief Replace the code from start to the end with a single instruction
+    that pushes the folded value. The constants that the operands added to
+    the pool are only used by that code, so they go too, and are never
+    written to a bytecode or cache file. The ones that were already in the
+    pool are left.
+
+    @param parser
+    @param start
+    @param consts -- number of constants in the pool at the start
+    @param val
+    @param removed -- number of instructions that the fold saves
+**/
+static void emit_folded(Parser* parser, size_t start, size_t consts, Value* val, int removed) {
+
+    truncate_code(parser->block, start);
+    truncate_constants(parser->block, consts);
+    switch(VALUE_TYPE(val)) {
+        case VAL_INUM: emit_inum_value(parser->block, AS_INUM(val)); break;
+        case VAL_UNUM: emit_unum_value(parser->block, AS_UNUM(val)); break;
+        case VAL_FNUM: emit_fnum_value(parser->block, AS_FNUM(val)); break;
+        case VAL_BOOL: emit_opcode(parser->block, AS_BOOL(val)? OP_TRUE: OP_FALSE); break;
+        case VAL_NOTHING: emit_opcode(parser->block, OP_NOTHING); break;
+        case VAL_OBJ: emit_obj_value(parser->block, AS_OBJ(val)); break;
+        default:
+            fatal_error("invalid value type in emit_folded()");
+    }
+    parser->exprType = VALUE_TYPE(val);
+    parser->folded += removed;
+}
+
+/**
+    @brief Fold a unary operation on a literal. Returns false when the VM
+    would post an error for it, so that the error still happens at run time.
+
+    @param type
+    @param op
+    @param result
+    @return bool
+**/
+static bool fold_unary(TokenType type, Value* op, Value* result) {
+
+    switch(type) {
+        case SUB_TOKEN:
+            switch(VALUE_TYPE(op)) {
+                case VAL_INUM: *result = INUM_VALUE((int64_t)(0 - (uint64_t)AS_INUM(op))); return true;
+                case VAL_UNUM: *result = UNUM_VALUE(-AS_UNUM(op)); return true;
+                case VAL_FNUM: *result = FNUM_VALUE(-AS_FNUM(op)); return true;
+                case VAL_BOOL: *result = BOOL_VALUE(AS_BOOL(op)); return true;
+                default: return false;
+            }
+        case NOT_TOKEN:
+            *result = BOOL_VALUE(IS_NOTHING(op) || (IS_BOOL(op) && !AS_BOOL(op)));
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+    @brief Fold an arithmetic operation on two literals. Only operands of the
+    same type are folded, because normalize_operands() in the VM leaves those
+    as they are. Anything that the VM would convert, warn about, or post an
+    error for is left for the VM.
+
+    @param type
+    @param op1
+    @param op2
+    @param result
+    @return bool
+**/
+static bool fold_arithmetic(TokenType type, Value* op1, Value* op2, Value* result) {
+
+    if(VALUE_TYPE(op1) != VALUE_TYPE(op2))
+        return false;
+
+    switch(VALUE_TYPE(op1)) {
+        case VAL_INUM: {
+                // wrap around the way that the hardware does in the VM
+                int64_t n1 = AS_INUM(op1);
+                int64_t n2 = AS_INUM(op2);
+                uint64_t a = (uint64_t)n1;
+                uint64_t b = (uint64_t)n2;
+                switch(type) {
+                    case ADD_TOKEN: *result = INUM_VALUE((int64_t)(a + b)); return true;
+                    case SUB_TOKEN: *result = INUM_VALUE((int64_t)(a - b)); return true;
+                    case MUL_TOKEN: *result = INUM_VALUE((int64_t)(a * b)); return true;
+                    case SLASH_TOKEN:
+                    case MOD_TOKEN:
+                        if(n2 == 0 || (n2 == -1 && n1 == INT64_MIN))
+                            return false;
+                        *result = INUM_VALUE((type == SLASH_TOKEN)? n1 / n2: n1 % n2);
+                        return true;
+                    default: return false;
+                }
+            }
+        case VAL_UNUM: {
+                uint64_t n1 = AS_UNUM(op1);
+                uint64_t n2 = AS_UNUM(op2);
+                switch(type) {
+                    case ADD_TOKEN: *result = UNUM_VALUE(n1 + n2); return true;
+                    case SUB_TOKEN: *result = UNUM_VALUE(n1 - n2); return true;
+                    case MUL_TOKEN: *result = UNUM_VALUE(n1 * n2); return true;
+                    case SLASH_TOKEN:
+                    case MOD_TOKEN:
+                        if(n2 == 0)
+                            return false;
+                        *result = UNUM_VALUE((type == SLASH_TOKEN)? n1 / n2: n1 % n2);
+                        return true;
+                    default: return false;
+                }
+            }
+        case VAL_FNUM: {
+                double n1 = AS_FNUM(op1);
+                double n2 = AS_FNUM(op2);
+                switch(type) {
+                    case ADD_TOKEN: *result = FNUM_VALUE(n1 + n2); return true;
+                    case SUB_TOKEN: *result = FNUM_VALUE(n1 - n2); return true;
+                    case MUL_TOKEN: *result = FNUM_VALUE(n1 * n2); return true;
+                    case SLASH_TOKEN: *result = FNUM_VALUE(n1 / n2); return true;
+                    case MOD_TOKEN: *result = FNUM_VALUE(fmod(n1, n2)); return true;
+                    default: return false;
+                }
+            }
+        case VAL_OBJ:
+            if(type == ADD_TOKEN && value_is_string(op1) && value_is_string(op2)) {
+                Obj* obj = arithmetic_objects(op1, op2, OP_ADD);
+                *result = OBJ_VALUE(obj);
+                return obj != NULL;
+            }
+            return false;
+        default:
+            return false; // arithmetic on bool or nothing is a runtime error
+    }
+}
+
+#define FOLD_COMPARE(kind) \
+    switch(type) { \
+        case EQUALITY_TOKEN: *result = BOOL_VALUE(AS_##kind(op1) == AS_##kind(op2)); return true; \
+        case NEQ_TOKEN: *result = BOOL_VALUE(AS_##kind(op1) != AS_##kind(op2)); return true; \
+        case LT_TOKEN:  *result = BOOL_VALUE(AS_##kind(op1) < AS_##kind(op2)); return true; \
+        case GT_TOKEN:  *result = BOOL_VALUE(AS_##kind(op1) > AS_##kind(op2)); return true; \
+        case LTE_TOKEN: *result = BOOL_VALUE(AS_##kind(op1) <= AS_##kind(op2)); return true; \
+        case GTE_TOKEN: *result = BOOL_VALUE(AS_##kind(op1) >= AS_##kind(op2)); return true; \
+        default: return false; \
+    }
+
+/**
+    @brief Fold a comparison of two literals. As with arithmetic, only
+    operands of the same type are folded. Float equality is left for the VM so
+    that it still warns about it.
+
+    @param type
+    @param op1
+    @param op2
+    @param result
+    @return bool
+**/
+static bool fold_compare(TokenType type, Value* op1, Value* op2, Value* result) {
+
+    if(VALUE_TYPE(op1) != VALUE_TYPE(op2))
+        return false;
+
+    switch(VALUE_TYPE(op1)) {
+        case VAL_INUM: FOLD_COMPARE(INUM)
+        case VAL_UNUM: FOLD_COMPARE(UNUM)
+        case VAL_BOOL: FOLD_COMPARE(BOOL)
+        case VAL_FNUM:
+            if(type == EQUALITY_TOKEN || type == NEQ_TOKEN)
+                return false;
+            FOLD_COMPARE(FNUM)
+        case VAL_OBJ:
+            // strings only support equality
+            if(type == EQUALITY_TOKEN && value_is_string(op1) && value_is_string(op2)) {
+                *result = BOOL_VALUE(compare_objects(op1, op2, OP_EQUALITY));
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
 }
 
-static void unary() {
+static void unary(Parser* parser) {
 
-    TokenType otype = parser.prev->type;
+    TokenType otype = parser->prev->type;
+    size_t start = parser->exprStart;
+    size_t consts = parser->constStart;
+
+    // -9223372036854775808 is INT64_MIN, although its magnitude is too large
+    // for a signed number by itself.
+    if(otype == SUB_TOKEN && parser->crnt->type == INUM_TOKEN && parser->crnt->num.inum == INT64_MIN) {
+        advance(parser);
+        emit_inum_value(parser->block, INT64_MIN);
+        parser->exprType = VAL_INUM;
+        return;
+    }
+
+    get_precedence(parser, PREC_UNARY);
+
+    Value op, result;
+    parser->exprStart = start;
+    parser->constStart = consts;
+    if(literal_value(parser, start, code_offset(parser->block), &op) && fold_unary(otype, &op, &result)) {
+        emit_folded(parser, start, consts, &result, 1);
+        return;
+    }
 
-    get_precedence(PREC_UNARY);
     switch(otype) {
-        case SUB_TOKEN: emit_opcode(OP_NEG);    break;
-        case NOT_TOKEN: emit_opcode(OP_NOT);    break;
+        case SUB_TOKEN:
+            emit_opcode(parser->block, OP_NEG);
+            // negation keeps the type of a number or a bool
+            switch(parser->exprType) {
+                case VAL_INUM:
+                case VAL_UNUM:
+                case VAL_FNUM:
+                case VAL_BOOL: break;
+                default: parser->exprType = VAL_INVALID;
+            }
+            break;
+        case NOT_TOKEN:
+            emit_opcode(parser->block, OP_NOT);
+            parser->exprType = VAL_BOOL;
+            break;
         default:
             fatal_error("unknown operator type in unary()");
     }
 }
 
-static void abinary() {
-
-    TokenType type = parser.prev->type;
+/**
+    @brief Return the type-specialized arithmetic opcode for the operator, or
+    the generic one if the type has no specialized version.
 
-    ParseRule* rule = &rules[type];
-    get_precedence((Precedence)(rule->prec + 1));
+    @param type
+    @param vt
+    @return OpCode
+**/
+static OpCode arithmetic_opcode(TokenType type, ValueType vt) {
 
     switch(type) {
-        case ADD_TOKEN:     emit_opcode(OP_ADD); break;
-        case SUB_TOKEN:     emit_opcode(OP_SUB); break;
-        case MUL_TOKEN:     emit_opcode(OP_MUL); break;
-        case SLASH_TOKEN:   emit_opcode(OP_DIV); break;
-        case MOD_TOKEN:     emit_opcode(OP_MOD); break;
+        case ADD_TOKEN:
+            switch(vt) {
+                case VAL_INUM: return OP_ADD_I64;
+                case VAL_UNUM: return OP_ADD_U64;
+                case VAL_FNUM: return OP_ADD_F64;
+                default:       return OP_ADD;
+            }
+        case SUB_TOKEN:
+            switch(vt) {
+                case VAL_INUM: return OP_SUB_I64;
+                case VAL_UNUM: return OP_SUB_U64;
+                case VAL_FNUM: return OP_SUB_F64;
+                default:       return OP_SUB;
+            }
+        case MUL_TOKEN:
+            switch(vt) {
+                case VAL_INUM: return OP_MUL_I64;
+                case VAL_UNUM: return OP_MUL_U64;
+                case VAL_FNUM: return OP_MUL_F64;
+                default:       return OP_MUL;
+            }
+        case SLASH_TOKEN:
+            switch(vt) {
+                case VAL_INUM: return OP_DIV_I64;
+                case VAL_UNUM: return OP_DIV_U64;
+                case VAL_FNUM: return OP_DIV_F64;
+                default:       return OP_DIV;
+            }
+        case MOD_TOKEN:
+            switch(vt) {
+                case VAL_INUM: return OP_MOD_I64;
+                case VAL_UNUM: return OP_MOD_U64;
+                case VAL_FNUM: return OP_MOD_F64;
+                default:       return OP_MOD;
+            }
         default:
             fatal_error("unknown type in abinary()");
     }
+    return OP_COUNT; // unreachable
 }
 
-static void cbinary() {
-
-    TokenType type = parser.prev->type;
+/**
+    @brief Return the type-specialized comparison opcode for the operator, or
+    the generic one if the type has no specialized version. Floats are not
+    specialized for equality so that the VM can still warn about it.
 
-    ParseRule* rule = &rules[type];
-    get_precedence((Precedence)(rule->prec + 1));
+    @param type
+    @param vt
+    @return OpCode
+**/
+static OpCode compare_opcode(TokenType type, ValueType vt) {
 
     switch(type) {
-        case EQUALITY_TOKEN: emit_opcode(OP_EQUALITY); break;
-        case NEQ_TOKEN: emit_opcode(OP_NEQ); break;
-        case LT_TOKEN:  emit_opcode(OP_LT); break;
-        case GT_TOKEN:  emit_opcode(OP_GT); break;
-        case LTE_TOKEN: emit_opcode(OP_LTE); break;
-        case GTE_TOKEN: emit_opcode(OP_GTE); break;
+        case EQUALITY_TOKEN:
+            switch(vt) {
+                case VAL_INUM: return OP_EQ_I64;
+                case VAL_UNUM: return OP_EQ_U64;
+                default:       return OP_EQUALITY;
+            }
+        case NEQ_TOKEN:
+            switch(vt) {
+                case VAL_INUM: return OP_NEQ_I64;
+                case VAL_UNUM: return OP_NEQ_U64;
+                default:       return OP_NEQ;
+            }
+        case LT_TOKEN:
+            switch(vt) {
+                case VAL_INUM: return OP_LT_I64;
+                case VAL_UNUM: return OP_LT_U64;
+                case VAL_FNUM: return OP_LT_F64;
+                default:       return OP_LT;
+            }
+        case GT_TOKEN:
+            switch(vt) {
+                case VAL_INUM: return OP_GT_I64;
+                case VAL_UNUM: return OP_GT_U64;
+                case VAL_FNUM: return OP_GT_F64;
+                default:       return OP_GT;
+            }
+        case LTE_TOKEN:
+            switch(vt) {
+                case VAL_INUM: return OP_LTE_I64;
+                case VAL_UNUM: return OP_LTE_U64;
+                case VAL_FNUM: return OP_LTE_F64;
+                default:       return OP_LTE;
+            }
+        case GTE_TOKEN:
+            switch(vt) {
+                case VAL_INUM: return OP_GTE_I64;
+                case VAL_UNUM: return OP_GTE_U64;
+                case VAL_FNUM: return OP_GTE_F64;
+                default:       return OP_GTE;
+            }
         default:
             fatal_error("unknown type in cbinary()");
     }
+    return OP_COUNT; // unreachable
+}
+
+/**
+    @brief When both operands are known to be the same kind of number, return
+    that type. Otherwise return VAL_INVALID and the generic opcode is used.
+
+    @param left
+    @param right
+    @return ValueType
+**/
+static ValueType operand_type(ValueType left, ValueType right) {
+
+    if(left == right && (left == VAL_INUM || left == VAL_UNUM || left == VAL_FNUM))
+        return left;
+    return VAL_INVALID;
+}
+
+static void abinary(Parser* parser) {
+
+    TokenType type = parser->prev->type;
+    ValueType left = parser->exprType;
+    size_t start = parser->exprStart;
+    size_t consts = parser->constStart;
+
+    ParseRule* rule = &rules[type];
+    get_precedence(parser, (Precedence)(rule->prec + 1));
+
+    Value op1, op2, result;
+    size_t middle = parser->exprStart;
+    parser->exprStart = start;
+    parser->constStart = consts;
+    if(literal_value(parser, start, middle, &op1) && literal_value(parser, middle, code_offset(parser->block), &op2) &&
+                fold_arithmetic(type, &op1, &op2, &result)) {
+        emit_folded(parser, start, consts, &result, 2);
+        return;
+    }
+
+    ValueType vt = operand_type(left, parser->exprType);
+    emit_opcode(parser->block, arithmetic_opcode(type, vt));
+    parser->exprType = vt;
 }
 
-static void literal() {
+static void cbinary(Parser* parser) {
+
+    TokenType type = parser->prev->type;
+    ValueType left = parser->exprType;
+    size_t start = parser->exprStart;
+    size_t consts = parser->constStart;
+
+    ParseRule* rule = &rules[type];
+    get_precedence(parser, (Precedence)(rule->prec + 1));
+
+    Value op1, op2, result;
+    size_t middle = parser->exprStart;
+    parser->exprStart = start;
+    parser->constStart = consts;
+    if(literal_value(parser, start, middle, &op1) && literal_value(parser, middle, code_offset(parser->block), &op2) &&
+                fold_compare(type, &op1, &op2, &result)) {
+        emit_folded(parser, start, consts, &result, 2);
+        return;
+    }
+
+    ValueType vt = operand_type(left, parser->exprType);
+    emit_opcode(parser->block, compare_opcode(type, vt));
+    parser->exprType = VAL_BOOL;
+}
 
-    switch(parser.prev->type) {
-        case FALSE_TOKEN:   emit_opcode(OP_FALSE);  break;
-        case TRUE_TOKEN:    emit_opcode(OP_TRUE);   break;
-        case NOTHING_TOKEN:    emit_opcode(OP_NOTHING);   break;
+static void literal(Parser* parser) {
+
+    switch(parser->prev->type) {
+        case FALSE_TOKEN:
+            emit_opcode(parser->block, OP_FALSE);
+            parser->exprType = VAL_BOOL;
+            break;
+        case TRUE_TOKEN:
+            emit_opcode(parser->block, OP_TRUE);
+            parser->exprType = VAL_BOOL;
+            break;
+        case NOTHING_TOKEN:
+            emit_opcode(parser->block, OP_NOTHING);
+            parser->exprType = VAL_NOTHING;
+            break;
         default: return; /* unreachable */
     }
 }
 
-static void string() {
+static void string(Parser* parser) {
 
-    Obj* val = create_string_object(parser.prev->str);
-    emit_obj_value(val);
+    Obj* val = create_string_object(parser->prev->str, parser->prev->len);
+    emit_obj_value(parser->block, val);
+    parser->exprType = VAL_OBJ;
 }
 
-void expression() {
+void expression(Parser* parser) {
 
-    get_precedence(PREC_ASSIGNMENT);
+    get_precedence(parser, PREC_ASSIGNMENT);
 }
 
 
-void get_precedence(Precedence prec) {
+void get_precedence(Parser* parser, Precedence prec) {
 
-    advance();
-    ParseFunc prefix = rules[parser.prev->type].prefix;
+    advance(parser);
+    parser->exprStart = code_offset(parser->block);
+    parser->constStart = value_list_size(parser->block);
+    ParseFunc prefix = rules[parser->prev->type].prefix;
     if(prefix == NULL) {
-        parser.hadError = true;
-        printf("tok value = %d\n", parser.prev->type);
-        syntax("expected an expression but got %s", token_to_str(parser.prev->type));
+        parser->hadError = true;
+        parser->exprType = VAL_INVALID;
+        printf("tok value = %d\n", parser->prev->type);
+        syntax("expected an expression but got %s", token_to_str(parser->prev->type));
         return;
     }
-    prefix();
+    prefix(parser);
 
-    while(prec <= rules[parser.crnt->type].prec) {
-        advance();
-        ParseFunc infix = rules[parser.prev->type].infix;
-        infix();
+    while(prec <= rules[parser->crnt->type].prec) {
+        advance(parser);
+        ParseFunc infix = rules[parser->prev->type].infix;
+        infix(parser);
     }
 }
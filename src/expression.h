@@ -23,7 +23,7 @@ typedef enum {
     PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFunc)();
+typedef void (*ParseFunc)(Parser*);
 
 typedef struct {
     ParseFunc prefix;
@@ -31,7 +31,7 @@ typedef struct {
     Precedence prec;
 } ParseRule;
 
-void get_precedence(Precedence prec);
-void expression();
+void get_precedence(Parser*, Precedence prec);
+void expression(Parser*);
 
 #endif
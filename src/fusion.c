@@ -0,0 +1,176 @@
+/**
+    @file fusion.c
+
+    @brief The superinstruction pass. See fusion.h.
+
+    A superinstruction does the work of an OP_CONSTANT and the generic binary
+    operation after it, or of two OP_CONSTANTs and the operation, in one
+    dispatch. The constant indexes become the operands of the fused opcode.
+    The pass runs on straight line code only. When the compiler emits jumps
+    it will have to leave their targets alone.
+
+**/
+#include "common.h"
+#include "fusion.h"
+
+#define FUSED_COUNT (OP_GTE_CONST_CONST - OP_ADD_CONST + 1)
+#define FUSED_BIT(op) ((uint32_t)1 << ((op) - OP_ADD_CONST))
+
+// Percent of the counted pairs that a superinstruction has to cover before
+// it is used.
+#define FUSE_THRESHOLD 1
+
+/*
+ * The generic operation for each fused opcode, in the order of the _CONST
+ * opcodes. The _CONST_CONST opcodes are in the same order.
+ *
+ * The typed opcodes, such as OP_ADD_I64, have no fused forms. The compiler
+ * only emits one when it knows that both operands are numbers of the same
+ * type, and the folder folds every such operation on literals except the
+ * ones that fail in the VM: division by zero and INT64_MIN / -1. So a typed
+ * opcode after an OP_CONSTANT is either one of those, or its other operand
+ * comes from one, and a fused form of it could never finish a run.
+ */
+static const uint16_t base_ops[] = {
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD,
+    OP_EQUALITY, OP_NEQ, OP_LT, OP_GT, OP_LTE, OP_GTE,
+};
+#define BASE_COUNT ((int)(sizeof(base_ops) / sizeof(base_ops[0])))
+
+// fused_const[op] is the _CONST form of the generic op, or 0 if it has none.
+static uint16_t fused_const[OP_COUNT];
+static uint16_t fused_const_const[OP_COUNT];
+static uint32_t enabled = 0;
+
+/*
+ * Read a pair count file and enable the superinstructions that would replace
+ * enough of the pairs. A triple is scored by the smaller of its two pairs.
+ */
+static uint32_t read_profile(const char* fname) {
+
+    FILE* fp = fopen(fname, "r");
+    if(fp == NULL)
+        fatal_error("cannot open pair count file \"%s\": %s", fname, strerror(errno));
+
+    uint64_t (*counts)[OP_COUNT] = MALLOC(sizeof(uint64_t) * OP_COUNT * OP_COUNT);
+    memset(counts, 0, sizeof(uint64_t) * OP_COUNT * OP_COUNT);
+    uint64_t total = 0;
+
+    char line[256], first[64], second[64];
+    unsigned long long count;
+    while(fgets(line, sizeof(line), fp) != NULL) {
+        if(line[0] == '#')
+            continue;
+        if(sscanf(line, "%llu %63s %63s", &count, first, second) != 3)
+            continue;
+        int op1 = opcode_by_name(first);
+        int op2 = opcode_by_name(second);
+        if(op1 < 0 || op2 < 0) {
+            log_debug("unknown opcode pair %s %s in %s", first, second, fname);
+            continue;
+        }
+        counts[op1][op2] += count;
+        total += count;
+    }
+    fclose(fp);
+
+    uint32_t mask = 0;
+    for(int i = 0; i < BASE_COUNT; i++) {
+        uint16_t op = base_ops[i];
+        uint64_t pair = counts[OP_CONSTANT][op];
+        uint64_t triple = MIN(pair, counts[OP_CONSTANT][OP_CONSTANT]);
+        if(pair > 0 && pair * 100 >= total * FUSE_THRESHOLD)
+            mask |= FUSED_BIT(fused_const[op]);
+        if(triple > 0 && triple * 100 >= total * FUSE_THRESHOLD)
+            mask |= FUSED_BIT(fused_const_const[op]);
+    }
+
+    FREE(counts);
+    return mask;
+}
+
+/**
+    @brief Choose the superinstructions. The spec is "all", "none", or the
+    name of a file that --pairs wrote.
+
+    @param spec
+**/
+void init_fusion(const char* spec) {
+
+    for(int i = 0; i < BASE_COUNT; i++) {
+        fused_const[base_ops[i]] = OP_ADD_CONST + i;
+        fused_const_const[base_ops[i]] = OP_ADD_CONST_CONST + i;
+    }
+
+    if(spec == NULL || !strcmp(spec, "all"))
+        enabled = ((uint64_t)1 << FUSED_COUNT) - 1;
+    else if(!strcmp(spec, "none"))
+        enabled = 0;
+    else
+        enabled = read_profile(spec);
+
+    log_debug("fusion mask: 0x%08x", enabled);
+}
+
+/**
+    @brief Return the set of superinstructions that are in use, one bit for
+    each, so the cache can tell code made with another set.
+
+    @return uint32_t
+**/
+uint32_t fusion_mask() {
+
+    return enabled;
+}
+
+static inline bool __attribute__((always_inline)) is_enabled(uint16_t fused) {
+
+    return fused != 0 && (enabled & FUSED_BIT(fused)) != 0;
+}
+
+/**
+    @brief Fuse the code from the offset to the end of the block. The code is
+    rewritten in place and the block is truncated to what is left.
+
+    @param block
+    @param start
+    @return int -- the number of instructions that were removed
+**/
+int fuse_code(codeBlock* block, size_t start) {
+
+    if(enabled == 0)
+        return 0;
+
+    uint16_t* code = raw_code_list(block);
+    size_t end = code_offset(block);
+    size_t in = start, out = start;
+    int removed = 0;
+
+    while(in < end) {
+        uint16_t op = code[in];
+        if(op == OP_CONSTANT && in + 4 < end && code[in + 2] == OP_CONSTANT &&
+                is_enabled(fused_const_const[code[in + 4]])) {
+            uint16_t k1 = code[in + 1], k2 = code[in + 3];
+            code[out++] = fused_const_const[code[in + 4]];
+            code[out++] = k1;
+            code[out++] = k2;
+            in += 5;
+            removed += 2;
+        }
+        else if(op == OP_CONSTANT && in + 2 < end && is_enabled(fused_const[code[in + 2]])) {
+            uint16_t k = code[in + 1];
+            code[out++] = fused_const[code[in + 2]];
+            code[out++] = k;
+            in += 3;
+            removed++;
+        }
+        else {
+            size_t size = 1 + opcode_operands(op);
+            for(size_t i = 0; i < size && in < end; i++)
+                code[out++] = code[in++];
+        }
+    }
+
+    truncate_code(block, out);
+    return removed;
+}
@@ -0,0 +1,18 @@
+/**
+    @file fusion.h
+
+    @brief Replace common runs of instructions with superinstructions after
+    an input is compiled. The set of superinstructions that is used can come
+    from a pair count file that --pairs wrote.
+
+**/
+#ifndef __FUSION_H__
+#define __FUSION_H__
+
+#include "common.h"
+
+void init_fusion(const char* spec);
+uint32_t fusion_mask();
+int fuse_code(codeBlock* block, size_t start);
+
+#endif
@@ -25,37 +25,50 @@ static inline size_t _min(size_t v1, size_t v2)
     return (v1 < v2) ? v1 : v2;
 }
 
-/*
- * This is a “FNV-1a” hash function. Do not mess with the constants.
+/**
+ * @brief This is a “FNV-1a” hash function. Do not mess with the constants.
+ * Callers that keep the hash, such as the string intern table, use this with
+ * the *_hashed() functions so that the key is only hashed once.
+ *
+ * @param key -- The bytes to hash.
+ * @param len -- The number of bytes.
+ * @return uint32_t -- The hash.
  */
-static uint32_t make_hash(const char* key)
+uint32_t hash_key(const char* key, size_t len)
 {
     uint32_t hash = 2166136261u;
 
-    for(int i = 0; i < (int)strlen(key); i++)
+    for(size_t i = 0; i < len; i++)
     {
-        hash ^= key[i];
+        hash ^= (uint8_t)key[i];
         hash *= 16777619;
     }
 
     return (hash);
 }
 
+static inline uint32_t make_hash(const char* key)
+{
+    return hash_key(key, strlen(key));
+}
+
 /*
  * If the entry is found, return the slot, if the entry is not found, then the
  * slot returned is where to put the entry. Check the slot's key to tell the
- * difference.
+ * difference. The stored hash is checked before the key so that most of the
+ * misses do not need a compare. The key does not need to be terminated.
  */
-static _table_entry_t* find_slot(_table_entry_t * ent, size_t cap, const char* key)
+static _table_entry_t* find_slot(_table_entry_t * ent, size_t cap, const char* key, size_t len, uint32_t hash)
 {
-    uint32_t index = make_hash(key) & (cap - 1);
+    uint32_t index = hash & (cap - 1);
 
     while(1)
     {
         _table_entry_t* entry = &ent[index];
 
         // depends on left evaluate before right
-        if((entry->key == NULL) || (!strcmp(key, entry->key)))
+        if((entry->key == NULL) ||
+                (entry->hash == hash && !strncmp(entry->key, key, len) && entry->key[len] == 0))
         {
             return (entry);
         }
@@ -86,17 +99,19 @@ static void grow_table(hashtable_t * tab)
             {
                 if(tab->entries[i].key != NULL)
                 {
-                    _table_entry_t* ent = find_slot(entries, capacity, tab->entries[i].key);
+                    _table_entry_t* ent = find_slot(entries, capacity, tab->entries[i].key,
+                                                    strlen(tab->entries[i].key), tab->entries[i].hash);
 
                     // if the key is the same, (i.e. not NULL) the replace the data. There
                     // can be no duplicate entries. No need to check it.
                     ent->key = tab->entries[i].key;
+                    ent->hash = tab->entries[i].hash;
                     ent->size = tab->entries[i].size;
                     ent->data = tab->entries[i].data;
                 }
             }
             // free the old table
-            free(tab->entries);
+            FREE(tab->entries);
         }
 
         tab->entries = entries;
@@ -113,7 +128,7 @@ hashtable_t* create_hash_table(void)
 {
     hashtable_t* tab;
 
-    tab = malloc(sizeof(hashtable_t));
+    tab = ALLOC_DS(hashtable_t);
 
     tab->capacity = 0x01 << 3;
     tab->entries = (_table_entry_t *) CALLOC(tab->capacity, sizeof(_table_entry_t));
@@ -155,15 +170,37 @@ void destroy_hash_table(hashtable_t * tab)
  * @return int -- Indicate whether the data was stored or not.
  */
 hash_retv_t insert_hash(hashtable_t * tab, const char* key, void* data, size_t size)
+{
+    return insert_hashed(tab, key, strlen(key), make_hash(key), data, size);
+}
+
+/**
+ * @brief Insert an entry using a hash that the caller already has. The hash
+ * must have come from hash_key() on the same key. The key does not need to
+ * be terminated. The table keeps a terminated copy of it.
+ *
+ * @param tab -- Hash table to place the entry into.
+ * @param key -- String that will be used to place the hash.
+ * @param len -- Length of the key.
+ * @param hash -- The hash of the key.
+ * @param data -- Pointer to the data to store in the table.
+ * @param size -- Size of the data to store in the table.
+ * @return int -- Indicate whether the data was stored or not.
+ */
+hash_retv_t insert_hashed(hashtable_t * tab, const char* key, size_t len, uint32_t hash, void* data, size_t size)
 {
     grow_table(tab);
 
-    _table_entry_t* entry = find_slot(tab->entries, tab->capacity, key);
+    _table_entry_t* entry = find_slot(tab->entries, tab->capacity, key, len, hash);
     int retv = (entry->key == NULL) ? HASH_NO_ERROR : HASH_EXIST;
 
     if(retv == HASH_NO_ERROR)
     {
-        entry->key = STRDUP(key);
+        char* copy = MALLOC(len + 1);
+        memcpy(copy, key, len);
+        copy[len] = 0;
+        entry->key = copy;
+        entry->hash = hash;
         entry->data = MALLOC(size);
         memcpy(entry->data, data, size);
         entry->size = size;
@@ -179,7 +216,7 @@ hash_retv_t insert_hash(hashtable_t * tab, const char* key, void* data, size_t s
  */
 hash_retv_t replace_hash_data(hashtable_t * tab, const char* key, void* data, size_t size) {
 
-    _table_entry_t* entry = find_slot(tab->entries, tab->capacity, key);
+    _table_entry_t* entry = find_slot(tab->entries, tab->capacity, key, strlen(key), make_hash(key));
     int retv = HASH_NO_ERROR;
 
     if(entry->key != NULL) {
@@ -195,6 +232,43 @@ hash_retv_t replace_hash_data(hashtable_t * tab, const char* key, void* data, si
     return (retv);
 }
 
+/**
+ * @brief Remove an entry from the hash table. The entries after it in its run
+ * are moved back over the hole, so that a search never stops at it early.
+ *
+ * @param tab -- Hash table to remove the entry from.
+ * @param key -- String that the entry was stored with.
+ * @return int -- Indicate whether the entry was there or not.
+ */
+hash_retv_t remove_hash(hashtable_t * tab, const char* key)
+{
+    size_t mask = tab->capacity - 1;
+    _table_entry_t* entry = find_slot(tab->entries, tab->capacity, key, strlen(key), make_hash(key));
+
+    if(entry->key == NULL)
+        return (HASH_NOT_FOUND);
+
+    FREE((void *)entry->key);
+    if(entry->data != NULL)
+        FREE(entry->data);
+
+    size_t hole = entry - tab->entries;
+    for(size_t index = (hole + 1) & mask; tab->entries[index].key != NULL; index = (index + 1) & mask)
+    {
+        // the entry can move back if the hole is between its home slot and it
+        size_t home = tab->entries[index].hash & mask;
+        if(((index - home) & mask) >= ((index - hole) & mask))
+        {
+            tab->entries[hole] = tab->entries[index];
+            hole = index;
+        }
+    }
+
+    memset(&tab->entries[hole], 0, sizeof(_table_entry_t));
+    tab->count--;
+    return (HASH_NO_ERROR);
+}
+
 /**
  * @brief Find the has table entry. If the entry does not exist, then an error
  * is returned and the value that the data parameter points to is undefined. If
@@ -209,7 +283,24 @@ hash_retv_t replace_hash_data(hashtable_t * tab, const char* key, void* data, si
  */
 hash_retv_t find_hash(hashtable_t * tab, const char* key, void* data, size_t size)
 {
-    _table_entry_t* entry = find_slot(tab->entries, tab->capacity, key);
+    return find_hashed(tab, key, strlen(key), make_hash(key), data, size);
+}
+
+/**
+ * @brief Find the hash table entry using a hash that the caller already has.
+ * Works like find_hash(), but the key does not need to be terminated.
+ *
+ * @param tab -- The table to search.
+ * @param key -- The string to search for.
+ * @param len -- Length of the key.
+ * @param hash -- The hash of the key.
+ * @param data -- Pointer to where the data is to be copied to.
+ * @param size -- Number of bytes to copy for the data.
+ * @return int -- Indicate whether there was an error or not.
+ */
+hash_retv_t find_hashed(hashtable_t * tab, const char* key, size_t len, uint32_t hash, void* data, size_t size)
+{
+    _table_entry_t* entry = find_slot(tab->entries, tab->capacity, key, len, hash);
     int retv = HASH_NO_ERROR;
 
     if(entry->key != NULL)
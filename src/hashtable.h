@@ -24,6 +24,7 @@ typedef enum {
 
 typedef struct {
     const char* key;
+    uint32_t hash;
     size_t size;
     void* data;
 } _table_entry_t;
@@ -36,9 +37,13 @@ typedef struct {
 
 hashtable_t* create_hash_table(void);
 void destroy_hash_table(hashtable_t*);
+uint32_t hash_key(const char*, size_t);
 hash_retv_t insert_hash(hashtable_t*, const char*, void*, size_t);
 hash_retv_t find_hash(hashtable_t*, const char*, void*, size_t);
+hash_retv_t insert_hashed(hashtable_t*, const char*, size_t, uint32_t, void*, size_t);
+hash_retv_t find_hashed(hashtable_t*, const char*, size_t, uint32_t, void*, size_t);
 hash_retv_t replace_hash_data(hashtable_t*, const char*, void*, size_t);
+hash_retv_t remove_hash(hashtable_t*, const char*);
 const char* iterate_hash_table(hashtable_t*, int);
 
 #endif
@@ -37,6 +37,8 @@ static struct {
   log_LockFn lock;
   int level;
   bool quiet;
+  int ncallbacks;
+  int cb_level;   // lowest level of the callbacks
   Callback callbacks[MAX_CALLBACKS];
 } L;
 
@@ -118,6 +120,7 @@ int log_add_callback(log_LogFn fn, void *udata, int level) {
   for (int i = 0; i < MAX_CALLBACKS; i++) {
     if (!L.callbacks[i].fn) {
       L.callbacks[i] = (Callback) { fn, udata, level };
+      if (L.ncallbacks++ == 0 || level < L.cb_level) { L.cb_level = level; }
       return 0;
     }
   }
@@ -148,6 +151,11 @@ void log_log(int level, const char *file, int line, const char* func, const char
     .level = level,
   };
 
+  // nothing takes the message, so do not lock or read the time
+  if ((L.quiet || level < L.level) && (L.ncallbacks == 0 || level < L.cb_level)) {
+    return;
+  }
+
   lock();
 
   if (!L.quiet && level >= L.level) {
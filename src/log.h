@@ -35,13 +35,6 @@ typedef void (*log_LockFn)(bool lock, void *udata);
 
 enum { LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_FATAL };
 
-#define log_trace(...) log_log(LOG_TRACE, __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define log_debug(...) log_log(LOG_DEBUG, __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define log_info(...)  log_log(LOG_INFO,  __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define log_warn(...)  log_log(LOG_WARN,  __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define log_error(...) log_log(LOG_ERROR, __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define log_fatal(...) log_log(LOG_FATAL, __FILE__, __LINE__, __func__, __VA_ARGS__)
-
 const char* log_level_string(int level);
 void log_set_lock(log_LockFn fn, void *udata);
 void log_set_level(int level);
@@ -51,14 +44,54 @@ int log_add_fp(FILE *fp, int level);
 
 void log_log(int level, const char *file, int line, const char* func, const char *fmt, ...);
 
-#else
+#endif /* _USE_LOGGING */
 
-#define log_trace(...)
-#define log_debug(...)
-#define log_info(...)
-#define log_warn(...)
-#define log_error(...)
-#define log_fatal(...)
+/*
+ * Calls below LOG_MIN_LEVEL are compiled out, so they cost nothing and their
+ * arguments are not evaluated. The build sets it from LOG_LEVEL in
+ * CMakeLists.txt. Without _USE_LOGGING every call is compiled out. The calls
+ * still go through log_none() so that their arguments are checked and the
+ * variables that are only logged do not look unused.
+ */
+#ifndef _USE_LOGGING
+#   undef LOG_MIN_LEVEL
+#   define LOG_MIN_LEVEL 6
+#elif !defined(LOG_MIN_LEVEL)
+#   define LOG_MIN_LEVEL 0
+#endif
+
+static inline void log_none(const char* fmt, ...) { (void)fmt; }
+#define LOG_NONE(...) do { if(0) log_none(__VA_ARGS__); } while(0)
+
+#if LOG_MIN_LEVEL <= 0
+#   define log_trace(...) log_log(LOG_TRACE, __FILE__, __LINE__, __func__, __VA_ARGS__)
+#else
+#   define log_trace(...) LOG_NONE(__VA_ARGS__)
+#endif
+#if LOG_MIN_LEVEL <= 1
+#   define log_debug(...) log_log(LOG_DEBUG, __FILE__, __LINE__, __func__, __VA_ARGS__)
+#else
+#   define log_debug(...) LOG_NONE(__VA_ARGS__)
+#endif
+#if LOG_MIN_LEVEL <= 2
+#   define log_info(...)  log_log(LOG_INFO,  __FILE__, __LINE__, __func__, __VA_ARGS__)
+#else
+#   define log_info(...)  LOG_NONE(__VA_ARGS__)
+#endif
+#if LOG_MIN_LEVEL <= 3
+#   define log_warn(...)  log_log(LOG_WARN,  __FILE__, __LINE__, __func__, __VA_ARGS__)
+#else
+#   define log_warn(...)  LOG_NONE(__VA_ARGS__)
+#endif
+#if LOG_MIN_LEVEL <= 4
+#   define log_error(...) log_log(LOG_ERROR, __FILE__, __LINE__, __func__, __VA_ARGS__)
+#else
+#   define log_error(...) LOG_NONE(__VA_ARGS__)
+#endif
+#if LOG_MIN_LEVEL <= 5
+#   define log_fatal(...) log_log(LOG_FATAL, __FILE__, __LINE__, __func__, __VA_ARGS__)
+#else
+#   define log_fatal(...) LOG_NONE(__VA_ARGS__)
+#endif
 
-#endif /* _USE_LOGGING */
 #endif /* __LOG_H__ */
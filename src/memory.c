@@ -24,12 +24,125 @@
     https://github.com/mkirchner/gc
 
 */
+#include <pthread.h>
+
 #include "common.h"
 
 static uint64_t mem_segment;
 #define SEG_MASK 0xFFFF00000000
 #define GET_SEG(p) (((uint64_t)p)&SEG_MASK)
 
+/*
+ * Threads other than the main one get memory from their own libc heaps, which
+ * are in other segments. Those segments are added here the first time that
+ * a thread allocates from them, so memory_free() accepts them too.
+ */
+#define MAX_SEGMENTS 64
+static uint64_t segments[MAX_SEGMENTS];
+static int num_segments = 0;
+static __thread uint64_t thread_segment;
+static pthread_mutex_t segment_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_segment(uint64_t seg) {
+
+    pthread_mutex_lock(&segment_lock);
+    int i;
+    for(i = 0; i < num_segments; i++)
+        if(segments[i] == seg)
+            break;
+    if(i == num_segments && num_segments < MAX_SEGMENTS) {
+        segments[num_segments] = seg;
+        __atomic_store_n(&num_segments, num_segments + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&segment_lock);
+}
+
+static inline void note_segment(void* ptr) {
+
+    uint64_t seg = GET_SEG(ptr);
+    if(seg != thread_segment && seg != mem_segment) {
+        add_segment(seg);
+        thread_segment = seg;
+    }
+}
+
+static bool known_segment(void* ptr) {
+
+    uint64_t seg = GET_SEG(ptr);
+    if(seg == mem_segment)
+        return true;
+
+    int num = __atomic_load_n(&num_segments, __ATOMIC_ACQUIRE);
+    for(int i = 0; i < num; i++)
+        if(segments[i] == seg)
+            return true;
+    return false;
+}
+
+#define ARENA_CHUNK_SIZE (64*1024)
+#define ARENA_ALIGN 16
+
+/*
+ * Arena memory comes in chunks that are kept on a list. Resetting an arena
+ * only moves the cursor back to the first chunk. The chunks are reused by
+ * the next allocations and only given back to libc when the thread releases
+ * its memory.
+ */
+typedef struct _arena_chunk_t {
+    struct _arena_chunk_t* next;
+    size_t size;
+    size_t used;
+    char data[];
+} _arena_chunk_t;
+
+typedef struct {
+    _arena_chunk_t* first;
+    _arena_chunk_t* crnt;
+} _arena_t;
+
+// each thread that compiles with -j has its own, so they take no lock
+static __thread _arena_t arenas[ARENA_COUNT];
+
+#define POOL_GRAIN 16
+#define POOL_CLASSES 8  // 16 to 128 bytes
+#define POOL_SLAB_SIZE (64*1024)
+
+/*
+ * Pool memory is carved out of slabs. Each size class has its own free list
+ * and its own slab to carve from, and both are thread local so that the fast
+ * path takes no lock. The slabs themselves are kept on one global list so
+ * that destroy_memory() can give them back.
+ */
+typedef struct _pool_item_t {
+    struct _pool_item_t* next;
+} _pool_item_t;
+
+typedef struct _pool_slab_t {
+    struct _pool_slab_t* next;
+    char data[];
+} _pool_slab_t;
+
+typedef struct {
+    size_t allocs;  // calls to pool_alloc()
+    size_t hits;    // allocs served from the free list
+    size_t frees;   // calls to pool_free()
+    size_t slabs;   // slabs allocated
+} _pool_stats_t;
+
+static __thread _pool_item_t* free_lists[POOL_CLASSES];
+static __thread char* slab_ptr[POOL_CLASSES];
+static __thread size_t slab_left[POOL_CLASSES];
+static __thread _pool_stats_t pool_stats[POOL_CLASSES];
+static _pool_slab_t* slabs = NULL;
+
+// the counters of the threads that have released their memory
+static _pool_stats_t pool_totals[POOL_CLASSES];
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// number of times that libc was asked for memory or to free it
+static size_t libc_calls = 0;
+#define COUNT_LIBC_CALL() __atomic_fetch_add(&libc_calls, 1, __ATOMIC_RELAXED)
+
 void init_memory() {
 
     // int stackvar;
@@ -39,27 +152,83 @@ void init_memory() {
     free(ptr);
 }
 
-void destroy_memory() {}
+/**
+    @brief Give back the arenas of the calling thread, and add its pool
+    counters to the totals. The free lists of the thread are dropped. Their
+    blocks are in the shared slabs, which destroy_memory() gives back. Each
+    thread other than the main one calls this before it exits.
+
+**/
+void release_thread_memory() {
+
+    for(int i = 0; i < ARENA_COUNT; i++) {
+        _arena_chunk_t* next;
+        for(_arena_chunk_t* chunk = arenas[i].first; chunk != NULL; chunk = next) {
+            next = chunk->next;
+            free(chunk);
+        }
+        arenas[i].first = arenas[i].crnt = NULL;
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    for(int i = 0; i < POOL_CLASSES; i++) {
+        pool_totals[i].allocs += pool_stats[i].allocs;
+        pool_totals[i].hits += pool_stats[i].hits;
+        pool_totals[i].frees += pool_stats[i].frees;
+        pool_totals[i].slabs += pool_stats[i].slabs;
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    memset(pool_stats, 0, sizeof(pool_stats));
+    for(int i = 0; i < POOL_CLASSES; i++) {
+        free_lists[i] = NULL;
+        slab_ptr[i] = NULL;
+        slab_left[i] = 0;
+    }
+}
+
+/**
+    @brief Give back all of the memory of the arenas and the pools. This must
+    be called by the main thread after the others have exited.
+
+**/
+void destroy_memory() {
+
+    release_thread_memory();
+
+    _pool_slab_t* next;
+    for(_pool_slab_t* slab = slabs; slab != NULL; slab = next) {
+        next = slab->next;
+        free(slab);
+    }
+    slabs = NULL;
+}
 
 void *memory_calloc(const char* file, const char* func, int line, size_t num, size_t size) {
 
+    COUNT_LIBC_CALL();
     void* ptr = calloc(num, size);
     LOC_ASSERT(file, func, line, ptr != NULL, "cannot calloc %lu bytes\n", num*size);
+    note_segment(ptr);
     return ptr;
 }
 
 void *memory_malloc(const char* file, const char* func, int line, size_t size) {
 
+    COUNT_LIBC_CALL();
     void* ptr = malloc(size);
     LOC_ASSERT(file, func, line, ptr != NULL, "cannot malloc %lu bytes\n", size);
+    note_segment(ptr);
 
     return ptr;
 }
 
 void *memory_realloc(const char* file, const char* func, int line, void* ptr, size_t size) {
 
+    COUNT_LIBC_CALL();
     void* nptr = realloc(ptr, size);
     LOC_ASSERT(file, func, line, nptr != NULL, "cannot reallocate %lu bytes\n", size);
+    note_segment(nptr);
 
     return nptr;
 }
@@ -67,10 +236,12 @@ void *memory_realloc(const char* file, const char* func, int line, void* ptr, si
 void memory_free(const char* file, const char* func, int line, void* ptr) {
 
     log_debug("enter %s:%d: = %p", func, line, ptr);
-    if(mem_segment != GET_SEG(ptr))
+    if(!known_segment(ptr))
         fatal_error("%s: %s:%d assert failed: Attempt to free a pointer that was not allocated: %p\n", file, func, line, ptr);
-    else
+    else {
+        COUNT_LIBC_CALL();
         free(ptr);
+    }
     log_debug("leave");
 }
 
@@ -79,8 +250,201 @@ void memory_free(const char* file, const char* func, int line, void* ptr) {
 extern char* strdup(const char*);
 char* memory_strdup(const char* file, const char* func, int line, const char* str) {
 
+    COUNT_LIBC_CALL();
     char* nptr = strdup(str);
     LOC_ASSERT(file, func, line, nptr != NULL, "cannot strdup %lu bytes\n", strlen(str));
+    note_segment(nptr);
+
+    return nptr;
+}
+
+/**
+    @brief Allocate zeroed memory from an arena. The memory cannot be freed
+    on its own. It is released when the arena is reset.
+
+    @param file
+    @param func
+    @param line
+    @param id
+    @param size
+    @return void*
+**/
+void *arena_alloc(const char* file, const char* func, int line, ArenaId id, size_t size) {
+
+    _arena_t* arena = &arenas[id];
+    size = (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+
+    // find a chunk with room, reusing the chunks left over from a reset
+    while(arena->crnt != NULL && arena->crnt->used + size > arena->crnt->size) {
+        if(arena->crnt->next == NULL)
+            break;
+        arena->crnt = arena->crnt->next;
+        arena->crnt->used = 0;
+    }
+
+    if(arena->crnt == NULL || arena->crnt->used + size > arena->crnt->size) {
+        size_t csize = MAX(size, (size_t)ARENA_CHUNK_SIZE);
+        COUNT_LIBC_CALL();
+        _arena_chunk_t* chunk = malloc(sizeof(_arena_chunk_t) + csize);
+        LOC_ASSERT(file, func, line, chunk != NULL, "cannot allocate arena chunk of %lu bytes\n", csize);
+        chunk->next = NULL;
+        chunk->size = csize;
+        chunk->used = 0;
+
+        if(arena->crnt == NULL)
+            arena->first = chunk;
+        else
+            arena->crnt->next = chunk;
+        arena->crnt = chunk;
+    }
+
+    void* ptr = &arena->crnt->data[arena->crnt->used];
+    arena->crnt->used += size;
+
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+char* arena_strdup(const char* file, const char* func, int line, ArenaId id, const char* str) {
+
+    size_t len = strlen(str) + 1;
+    char* nptr = arena_alloc(file, func, line, id, len);
+    memcpy(nptr, str, len);
 
     return nptr;
 }
+
+/**
+    @brief Release everything that the calling thread allocated from the
+    arena. This does not depend on how much was allocated.
+
+    @param id
+**/
+void reset_arena(ArenaId id) {
+
+    log_debug("reset arena %d", (int)id);
+    arenas[id].crnt = arenas[id].first;
+    if(arenas[id].crnt != NULL)
+        arenas[id].crnt->used = 0;
+}
+
+/**
+    @brief Allocate a zeroed block from the pool for its size class. Sizes
+    that are larger than the largest class go to libc.
+
+    @param file
+    @param func
+    @param line
+    @param size
+    @return void*
+**/
+void *pool_alloc(const char* file, const char* func, int line, size_t size) {
+
+    if(size > POOL_GRAIN * POOL_CLASSES)
+        return memory_calloc(file, func, line, 1, size);
+
+    int cls = (int)((size + POOL_GRAIN - 1) / POOL_GRAIN) - 1;
+    size_t csize = (size_t)(cls + 1) * POOL_GRAIN;
+    void* ptr;
+
+    pool_stats[cls].allocs++;
+    if(free_lists[cls] != NULL) {
+        pool_stats[cls].hits++;
+        ptr = free_lists[cls];
+        free_lists[cls] = free_lists[cls]->next;
+    }
+    else {
+        if(slab_left[cls] < csize) {
+            COUNT_LIBC_CALL();
+            _pool_slab_t* slab = malloc(sizeof(_pool_slab_t) + POOL_SLAB_SIZE);
+            LOC_ASSERT(file, func, line, slab != NULL, "cannot allocate pool slab of %d bytes\n", POOL_SLAB_SIZE);
+
+            // the slab list is shared by all threads
+            slab->next = __atomic_load_n(&slabs, __ATOMIC_RELAXED);
+            while(!__atomic_compare_exchange_n(&slabs, &slab->next, slab, false,
+                                                __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                ;
+
+            pool_stats[cls].slabs++;
+            slab_ptr[cls] = slab->data;
+            slab_left[cls] = POOL_SLAB_SIZE;
+        }
+        ptr = slab_ptr[cls];
+        slab_ptr[cls] += csize;
+        slab_left[cls] -= csize;
+    }
+
+    memset(ptr, 0, csize);
+    return ptr;
+}
+
+/**
+    @brief Put a block back on the free list of the calling thread. The size
+    must be the same as the one it was allocated with.
+
+    @param ptr
+    @param size
+**/
+void pool_free(void* ptr, size_t size) {
+
+    if(ptr == NULL)
+        return;
+
+    if(size > POOL_GRAIN * POOL_CLASSES) {
+        COUNT_LIBC_CALL();
+        free(ptr);
+        return;
+    }
+
+    int cls = (int)((size + POOL_GRAIN - 1) / POOL_GRAIN) - 1;
+    _pool_item_t* item = (_pool_item_t*)ptr;
+
+    pool_stats[cls].frees++;
+    item->next = free_lists[cls];
+    free_lists[cls] = item;
+}
+
+/**
+    @brief Return the number of times that libc has been asked for memory or
+    to free it.
+
+    @return size_t
+**/
+size_t count_libc_calls() {
+
+    return __atomic_load_n(&libc_calls, __ATOMIC_RELAXED);
+}
+
+/**
+    @brief Print the pool statistics and the number of calls to libc. The
+    pool counters are those of the calling thread plus the ones of the
+    threads that have released their memory.
+
+    @param fp
+    @param inputs -- number of REPL lines or files compiled, or 0 if not known
+**/
+void print_memory_stats(FILE* fp, int inputs) {
+
+    size_t calls = count_libc_calls();
+
+    fprintf(fp, "\n    pool   allocs     hits   frees  slabs  hit rate\n");
+    pthread_mutex_lock(&stats_lock);
+    for(int i = 0; i < POOL_CLASSES; i++) {
+        _pool_stats_t st = pool_totals[i];
+        st.allocs += pool_stats[i].allocs;
+        st.hits += pool_stats[i].hits;
+        st.frees += pool_stats[i].frees;
+        st.slabs += pool_stats[i].slabs;
+        if(st.allocs == 0)
+            continue;
+        fprintf(fp, "    %4d %8lu %8lu %7lu %6lu %8.1f%%\n", (i + 1) * POOL_GRAIN,
+                st.allocs, st.hits, st.frees, st.slabs,
+                100.0 * (double)st.hits / (double)st.allocs);
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    fprintf(fp, "    libc allocator calls: %lu", calls);
+    if(inputs > 0)
+        fprintf(fp, " (%0.1f per input)", (double)calls / (double)inputs);
+    fprintf(fp, "\n");
+}
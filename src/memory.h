@@ -10,12 +10,58 @@
 #define ALLOC_DS(t)     (t*)memory_calloc(__FILENAME__, __func__, __LINE__, 1, sizeof(t))
 #define FREE(p)         memory_free(__FILENAME__, __func__, __LINE__, (void*)p)
 
+/*
+ * Arenas hand out memory with a bump pointer and release all of it at once.
+ * They hold what is only needed while one input is compiled, and each thread
+ * has its own. The ARENA_* macros use them when the build defines _USE_ARENA.
+ * Otherwise they fall back to the libc path above, so that tools like
+ * valgrind can still see every allocation.
+ */
+typedef enum {
+    ARENA_LINE,     // tokens and lexemes, released by compile() for each input
+    ARENA_COUNT,
+} ArenaId;
+
+#ifdef _USE_ARENA
+#define ARENA_ALLOC(a, s)   arena_alloc(__FILENAME__, __func__, __LINE__, a, s)
+#define ARENA_DS(a, t)      (t*)arena_alloc(__FILENAME__, __func__, __LINE__, a, sizeof(t))
+#define ARENA_STRDUP(a, s)  arena_strdup(__FILENAME__, __func__, __LINE__, a, s)
+#define ARENA_FREE(p)       ((void)(p))
+#else
+#define ARENA_ALLOC(a, s)   CALLOC(1, s)
+#define ARENA_DS(a, t)      ALLOC_DS(t)
+#define ARENA_STRDUP(a, s)  STRDUP(s)
+#define ARENA_FREE(p)       FREE(p)
+#endif
+
+/*
+ * Pools keep thread local free lists of small fixed size structs that outlive
+ * the input they were made for and are freed one at a time, such as Value,
+ * ObjString and codeBlock, so that they are recycled rather than given back
+ * to libc. The build defines _USE_POOL to enable them.
+ */
+#ifdef _USE_POOL
+#define POOL_DS(t)      (t*)pool_alloc(__FILENAME__, __func__, __LINE__, sizeof(t))
+#define POOL_FREE(p, t) pool_free((void*)(p), sizeof(t))
+#else
+#define POOL_DS(t)      ALLOC_DS(t)
+#define POOL_FREE(p, t) FREE(p)
+#endif
+
 void init_memory();
 void destroy_memory();
+void release_thread_memory();
 void *memory_calloc(const char*, const char*, int, size_t, size_t);
 void *memory_malloc(const char*, const char*, int, size_t);
 void *memory_realloc(const char*, const char*, int, void*, size_t);
 void memory_free(const char*, const char*, int, void*);
 char* memory_strdup(const char*, const char*, int, const char*);
+void *arena_alloc(const char*, const char*, int, ArenaId, size_t);
+char* arena_strdup(const char*, const char*, int, ArenaId, const char*);
+void reset_arena(ArenaId);
+void *pool_alloc(const char*, const char*, int, size_t);
+void pool_free(void*, size_t);
+void print_memory_stats(FILE*, int);
+size_t count_libc_calls();
 
 #endif
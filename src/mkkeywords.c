@@ -0,0 +1,154 @@
+/**
+    @file mkkeywords.c
+
+    @brief Build time generator for the scanner's keyword table.
+
+    Reads tests/keywordlist.txt, where each line looks like
+
+        {"and", AND_TOKEN},
+
+    and writes a header with a perfect hash table for the keywords. The seed
+    for the hash is searched for until no two keywords land in the same slot,
+    so the scanner can look up a word with one hash and one compare.
+
+    Usage: mkkeywords keywordlist.txt keywords.h
+
+**/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MAX_KEYWORDS 128
+#define KEYWORD_SLOTS 256   // must be a power of 2
+
+typedef struct {
+    char word[64];
+    char token[64];
+    size_t len;
+} keyword_t;
+
+static keyword_t keywords[MAX_KEYWORDS];
+static int num_keywords = 0;
+
+/*
+ * This must match the keyword_hash() that is written into the header.
+ */
+static const char* hash_source =
+    "static inline uint32_t keyword_hash(const char* str, size_t len) {\n"
+    "\n"
+    "    uint32_t hash = 2166136261u ^ KEYWORD_SEED;\n"
+    "    for(size_t i = 0; i < len; i++) {\n"
+    "        hash ^= (uint8_t)str[i];\n"
+    "        hash *= 16777619;\n"
+    "    }\n"
+    "    return hash ^ (hash >> 15);\n"
+    "}\n";
+
+static uint32_t keyword_hash(uint32_t seed, const char* str, size_t len) {
+
+    uint32_t hash = 2166136261u ^ seed;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619;
+    }
+    return hash ^ (hash >> 15);
+}
+
+static void read_keywords(const char* fname) {
+
+    FILE* fp = fopen(fname, "r");
+    if(fp == NULL) {
+        fprintf(stderr, "mkkeywords: cannot open %s\n", fname);
+        exit(1);
+    }
+
+    char line[256];
+    while(fgets(line, sizeof(line), fp) != NULL) {
+        keyword_t* kw = &keywords[num_keywords];
+        if(sscanf(line, " {\"%63[^\"]\", %63[A-Z_]}", kw->word, kw->token) != 2)
+            continue;   // blank line or comment
+
+        kw->len = strlen(kw->word);
+        for(int i = 0; i < num_keywords; i++) {
+            if(!strcmp(keywords[i].word, kw->word)) {
+                fprintf(stderr, "mkkeywords: duplicate keyword \"%s\"\n", kw->word);
+                exit(1);
+            }
+        }
+
+        if(++num_keywords >= MAX_KEYWORDS) {
+            fprintf(stderr, "mkkeywords: too many keywords\n");
+            exit(1);
+        }
+    }
+    fclose(fp);
+}
+
+static uint32_t find_seed(int* slots) {
+
+    for(uint32_t seed = 0; seed < 1000000; seed++) {
+        int i;
+        for(i = 0; i < KEYWORD_SLOTS; i++)
+            slots[i] = -1;
+
+        for(i = 0; i < num_keywords; i++) {
+            uint32_t slot = keyword_hash(seed, keywords[i].word, keywords[i].len) & (KEYWORD_SLOTS - 1);
+            if(slots[slot] >= 0)
+                break;
+            slots[slot] = i;
+        }
+
+        if(i == num_keywords)
+            return seed;
+    }
+
+    fprintf(stderr, "mkkeywords: cannot find a perfect hash\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+
+    if(argc != 3) {
+        fprintf(stderr, "usage: mkkeywords keywordlist.txt keywords.h\n");
+        return 1;
+    }
+
+    read_keywords(argv[1]);
+
+    int slots[KEYWORD_SLOTS];
+    uint32_t seed = find_seed(slots);
+
+    size_t min_len = (size_t)-1, max_len = 0;
+    for(int i = 0; i < num_keywords; i++) {
+        if(keywords[i].len < min_len)
+            min_len = keywords[i].len;
+        if(keywords[i].len > max_len)
+            max_len = keywords[i].len;
+    }
+
+    FILE* fp = fopen(argv[2], "w");
+    if(fp == NULL) {
+        fprintf(stderr, "mkkeywords: cannot open %s\n", argv[2]);
+        return 1;
+    }
+
+    fprintf(fp, "/*\n * Generated by mkkeywords from keywordlist.txt. Do not edit.\n */\n");
+    fprintf(fp, "#ifndef __KEYWORDS_H__\n#define __KEYWORDS_H__\n\n");
+    fprintf(fp, "#define KEYWORD_SEED %uu\n", seed);
+    fprintf(fp, "#define KEYWORD_SLOTS %d\n", KEYWORD_SLOTS);
+    fprintf(fp, "#define KEYWORD_MIN_LEN %lu\n", (unsigned long)min_len);
+    fprintf(fp, "#define KEYWORD_MAX_LEN %lu\n\n", (unsigned long)max_len);
+    fprintf(fp, "%s\n", hash_source);
+    fprintf(fp, "static const token_map_t keyword_table[KEYWORD_SLOTS] = {\n");
+    for(int i = 0; i < KEYWORD_SLOTS; i++) {
+        if(slots[i] >= 0) {
+            keyword_t* kw = &keywords[slots[i]];
+            fprintf(fp, "    [%d] = {\"%s\", %lu, %s},\n", i, kw->word, (unsigned long)kw->len, kw->token);
+        }
+    }
+    fprintf(fp, "};\n\n#endif\n");
+    fclose(fp);
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+/**
+    @file mkpowers.c
+
+    @brief Build time generator for the table of powers of five that
+    numbers.c uses to convert decimal floats.
+
+    Each entry is 5^q as a 128 bit number with its top bit set, for q from
+    POW5_MIN_EXP to POW5_MAX_EXP. For q >= 0 the power is truncated to 128
+    bits. For q < 0 the entry is 2^b / 5^-q + 1 for a b that gives at least
+    128 bits, truncated the same way. This is the table from the Eisel-Lemire
+    paper, "Number Parsing at a Gigabyte per Second".
+
+    Usage: mkpowers pow5.h
+
+**/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define POW5_MIN_EXP (-342)
+#define POW5_MAX_EXP 308
+
+#define MAX_WORDS 96    // 3072 bits is more than 2^(2 * 795 + 128) needs
+
+typedef struct {
+    uint32_t word[MAX_WORDS];   // least significant first
+} bignum_t;
+
+static void big_set(bignum_t* num, uint32_t val) {
+
+    memset(num, 0, sizeof(bignum_t));
+    num->word[0] = val;
+}
+
+static void big_mul_small(bignum_t* num, uint32_t val) {
+
+    uint64_t carry = 0;
+    for(int i = 0; i < MAX_WORDS; i++) {
+        uint64_t prod = (uint64_t)num->word[i] * val + carry;
+        num->word[i] = (uint32_t)prod;
+        carry = prod >> 32;
+    }
+}
+
+static int big_bits(const bignum_t* num) {
+
+    for(int i = MAX_WORDS - 1; i >= 0; i--)
+        if(num->word[i] != 0)
+            return i * 32 + 32 - __builtin_clz(num->word[i]);
+    return 0;
+}
+
+static void big_shl(bignum_t* num, int count) {
+
+    for(; count > 0; count--) {
+        uint32_t carry = 0;
+        for(int i = 0; i < MAX_WORDS; i++) {
+            uint32_t next = num->word[i] >> 31;
+            num->word[i] = (num->word[i] << 1) | carry;
+            carry = next;
+        }
+    }
+}
+
+static void big_shr(bignum_t* num, int count) {
+
+    for(; count > 0; count--) {
+        for(int i = 0; i < MAX_WORDS; i++) {
+            uint32_t next = (i + 1 < MAX_WORDS)? num->word[i + 1] & 1: 0;
+            num->word[i] = (num->word[i] >> 1) | (next << 31);
+        }
+    }
+}
+
+static int big_cmp(const bignum_t* a, const bignum_t* b) {
+
+    for(int i = MAX_WORDS - 1; i >= 0; i--)
+        if(a->word[i] != b->word[i])
+            return (a->word[i] > b->word[i])? 1: -1;
+    return 0;
+}
+
+static void big_sub(bignum_t* a, const bignum_t* b) {
+
+    int64_t borrow = 0;
+    for(int i = 0; i < MAX_WORDS; i++) {
+        int64_t diff = (int64_t)a->word[i] - b->word[i] - borrow;
+        borrow = (diff < 0);
+        a->word[i] = (uint32_t)(diff + (borrow? ((int64_t)1 << 32): 0));
+    }
+}
+
+static void big_add_one(bignum_t* num) {
+
+    for(int i = 0; i < MAX_WORDS && ++num->word[i] == 0; i++)
+        ;
+}
+
+/*
+ * quot = 2^power / div, by long division one bit at a time.
+ */
+static void big_div_pow2(bignum_t* quot, int power, const bignum_t* div) {
+
+    bignum_t rem;
+    big_set(&rem, 0);
+    big_set(quot, 0);
+
+    for(int bit = power; bit >= 0; bit--) {
+        big_shl(&rem, 1);
+        if(bit == power)
+            rem.word[0] |= 1;
+        if(big_cmp(&rem, div) >= 0) {
+            big_sub(&rem, div);
+            quot->word[bit / 32] |= (uint32_t)1 << (bit % 32);
+        }
+    }
+}
+
+/*
+ * Shift the number so that its top bit is bit 127, dropping the bits below.
+ */
+static void big_normalize(bignum_t* num) {
+
+    int bits = big_bits(num);
+    if(bits < 128)
+        big_shl(num, 128 - bits);
+    else
+        big_shr(num, bits - 128);
+}
+
+int main(int argc, char** argv) {
+
+    if(argc != 2) {
+        fprintf(stderr, "usage: mkpowers pow5.h\n");
+        return 1;
+    }
+
+    FILE* fp = fopen(argv[1], "w");
+    if(fp == NULL) {
+        fprintf(stderr, "mkpowers: cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(fp, "/*\n * Generated by mkpowers. Do not edit.\n */\n");
+    fprintf(fp, "#ifndef __POW5_H__\n#define __POW5_H__\n\n");
+    fprintf(fp, "#define POW5_MIN_EXP (%d)\n", POW5_MIN_EXP);
+    fprintf(fp, "#define POW5_MAX_EXP %d\n\n", POW5_MAX_EXP);
+    fprintf(fp, "static const uint64_t pow5_table[][2] = {\n");
+
+    bignum_t power, entry;
+    for(int q = POW5_MIN_EXP; q <= POW5_MAX_EXP; q++) {
+        big_set(&power, 1);
+        for(int i = 0; i < abs(q); i++)
+            big_mul_small(&power, 5);
+
+        if(q >= 0)
+            entry = power;
+        else {
+            int bits = big_bits(&power);
+            int shift = (q >= -27)? bits + 127: 2 * bits + 128;
+            big_div_pow2(&entry, shift, &power);
+            big_add_one(&entry);
+        }
+        big_normalize(&entry);
+
+        uint64_t hi = ((uint64_t)entry.word[3] << 32) | entry.word[2];
+        uint64_t lo = ((uint64_t)entry.word[1] << 32) | entry.word[0];
+        fprintf(fp, "    {0x%016llxull, 0x%016llxull},   // 5^%d\n",
+                (unsigned long long)hi, (unsigned long long)lo, q);
+    }
+
+    fprintf(fp, "};\n\n#endif\n");
+    fclose(fp);
+
+    return 0;
+}
@@ -0,0 +1,407 @@
+/**
+    @file numbers.c
+
+    @brief Convert the text of numbers to binary.
+
+    Each function checks the syntax and builds the value in the same pass, and
+    returns false if the text is not a number of the kind or if it does not
+    fit. The text does not have to be terminated.
+
+    Integers are read eight digits at a time where that is possible. Floats
+    take the first of these that applies:
+
+    - When the digits fit in 53 bits and the power of ten is at most 22,
+      one exact multiply or divide gives the correctly rounded result.
+    - Otherwise the Eisel-Lemire algorithm multiplies the digits by a 128 bit
+      power of five from pow5.h, which is made by mkpowers at build time.
+    - When there are more than 19 digits and the first 19 do not settle the
+      result, the text goes to strtod().
+
+**/
+#include "common.h"
+#include "numbers.h"
+#include "pow5.h"
+
+static inline bool __attribute__((always_inline)) is_digit(char ch) {
+    return (unsigned)(ch - '0') < 10;
+}
+
+/*
+ * SWAR: eight ASCII digits are checked and converted as one 64 bit word.
+ * The word is loaded little endian, so the first digit is the low byte.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#   define USE_SWAR_DIGITS
+#endif
+
+#ifdef USE_SWAR_DIGITS
+static inline uint64_t __attribute__((always_inline)) load_eight(const char* ptr) {
+
+    uint64_t val;
+    memcpy(&val, ptr, sizeof(val));
+    return val;
+}
+
+static inline bool __attribute__((always_inline)) is_eight_digits(uint64_t val) {
+
+    return !(((val + 0x4646464646464646ull) | (val - 0x3030303030303030ull)) & 0x8080808080808080ull);
+}
+
+static inline uint32_t __attribute__((always_inline)) eight_digits_value(uint64_t val) {
+
+    const uint64_t mask = 0x000000FF000000FFull;
+    const uint64_t mul1 = 0x000F424000000064ull;   // 100 + (1000000 << 32)
+    const uint64_t mul2 = 0x0000271000000001ull;   // 1 + (10000 << 32)
+
+    val -= 0x3030303030303030ull;
+    val = (val * 10) + (val >> 8);  // pairs of digits
+    val = (((val & mask) * mul1) + (((val >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t)val;
+}
+#endif
+
+/**
+    @brief Add the run of digits at ptr to the number and return the end of
+    the run. The number wraps if it gets too big.
+
+    @param ptr
+    @param end
+    @param num
+    @return const char*
+**/
+static inline const char* add_digits(const char* ptr, const char* end, uint64_t* num) {
+
+    uint64_t val = *num;
+#ifdef USE_SWAR_DIGITS
+    while(end - ptr >= 8 && is_eight_digits(load_eight(ptr))) {
+        val = val * 100000000 + eight_digits_value(load_eight(ptr));
+        ptr += 8;
+    }
+#endif
+    for(; ptr < end && is_digit(*ptr); ptr++)
+        val = val * 10 + (*ptr - '0');
+
+    *num = val;
+    return ptr;
+}
+
+/**
+    @brief Parse a string of decimal digits.
+
+    @param str
+    @param len
+    @param out
+    @return bool -- false if there are no digits, something else, or the
+    number does not fit
+**/
+bool parse_decimal_digits(const char* str, size_t len, uint64_t* out) {
+
+    // 19 digits always fit
+    size_t safe = MIN(len, 19);
+    uint64_t num = 0;
+    if(len == 0 || add_digits(str, str + safe, &num) != str + safe)
+        return false;
+
+    for(size_t i = safe; i < len; i++) {
+        unsigned digit = str[i] - '0';
+        if(digit > 9 || num > (UINT64_MAX - digit) / 10)
+            return false;
+        num = num * 10 + digit;
+    }
+
+    *out = num;
+    return true;
+}
+
+/**
+    @brief Parse a string of hex digits, without the 0x.
+
+    @param str
+    @param len
+    @param out
+    @return bool
+**/
+bool parse_hex_digits(const char* str, size_t len, uint64_t* out) {
+
+    if(len == 0)
+        return false;
+
+    uint64_t num = 0;
+    for(size_t i = 0; i < len; i++) {
+        int digit;
+        if(is_digit(str[i]))
+            digit = str[i] - '0';
+        else if((unsigned)((str[i] | 0x20) - 'a') < 6)
+            digit = (str[i] | 0x20) - 'a' + 10;
+        else
+            return false;
+
+        if(num >> 60)
+            return false;   // too big
+        num = (num << 4) | digit;
+    }
+
+    *out = num;
+    return true;
+}
+
+/**
+    @brief Parse a signed decimal number. It can have a sign and cannot have
+    a leading zero.
+
+    @param str
+    @param len
+    @param out
+    @return bool
+**/
+bool parse_signed_number(const char* str, size_t len, int64_t* out) {
+
+    bool neg = false;
+    if(len > 0 && (str[0] == '+' || str[0] == '-')) {
+        neg = (str[0] == '-');
+        str++;
+        len--;
+    }
+
+    uint64_t num;
+    if(len > 1 && str[0] == '0')
+        return false;
+    if(!parse_decimal_digits(str, len, &num))
+        return false;
+    if(num > (uint64_t)INT64_MAX + neg)
+        return false;
+
+    *out = neg? (int64_t)(0 - num): (int64_t)num;
+    return true;
+}
+
+/**
+    @brief Parse an unsigned number, which is always written in hex with a
+    leading 0x.
+
+    @param str
+    @param len
+    @param out
+    @return bool
+**/
+bool parse_unsigned_number(const char* str, size_t len, uint64_t* out) {
+
+    if(len < 2 || str[0] != '0' || (str[1] | 0x20) != 'x')
+        return false;
+    return parse_hex_digits(str + 2, len - 2, out);
+}
+
+/*
+ * The 128 bit product of two 64 bit numbers.
+ */
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} u128_t;
+
+static inline u128_t __attribute__((always_inline)) mul_64(uint64_t a, uint64_t b) {
+
+    u128_t res;
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 prod = (unsigned __int128)a * b;
+    res.lo = (uint64_t)prod;
+    res.hi = (uint64_t)(prod >> 64);
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    res.lo = (cross << 32) | (uint32_t)lo_lo;
+    res.hi = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+#endif
+    return res;
+}
+
+/**
+    @brief Return the bits of the double that is nearest to mant * 10^exp10,
+    with the Eisel-Lemire algorithm. mant cannot be zero.
+
+    @param mant
+    @param exp10
+    @return uint64_t
+**/
+static uint64_t eisel_lemire(uint64_t mant, int64_t exp10) {
+
+    const int mant_bits = 52;
+    const uint64_t inf_bits = UINT64_C(0x7FF) << mant_bits;
+
+    if(exp10 < POW5_MIN_EXP)
+        return 0;
+    if(exp10 > POW5_MAX_EXP)
+        return inf_bits;
+
+    int lz = __builtin_clzll(mant);
+    mant <<= lz;
+
+    // enough of the product to find 55 bits, with the low word only when
+    // the bits below them might carry
+    const uint64_t* pow5 = pow5_table[exp10 - POW5_MIN_EXP];
+    const uint64_t precision_mask = UINT64_MAX >> (mant_bits + 3);
+    u128_t prod = mul_64(mant, pow5[0]);
+    if((prod.hi & precision_mask) == precision_mask) {
+        u128_t low = mul_64(mant, pow5[1]);
+        prod.lo += low.hi;
+        if(low.hi > prod.lo)
+            prod.hi++;
+    }
+
+    int upper = (int)(prod.hi >> 63);
+    int shift = upper + 64 - mant_bits - 3;
+    uint64_t bits = prod.hi >> shift;
+    // floor(log2(10^exp10)) + 63, and 1023 is the exponent bias
+    int64_t power2 = ((((152170 + 65536) * exp10) >> 16) + 63) + upper - lz + 1023;
+
+    if(power2 <= 0) {
+        // subnormal, or too small for even that
+        if(-power2 + 1 >= 64)
+            return 0;
+        bits >>= -power2 + 1;
+        bits += (bits & 1);
+        bits >>= 1;
+        power2 = (bits < (UINT64_C(1) << mant_bits))? 0: 1;
+        return bits | ((uint64_t)power2 << mant_bits);
+    }
+
+    // exactly half way, so round to even
+    if(prod.lo <= 1 && exp10 >= -4 && exp10 <= 23 && (bits & 3) == 1 &&
+            (bits << shift) == prod.hi)
+        bits &= ~UINT64_C(1);
+
+    bits += (bits & 1);
+    bits >>= 1;
+    if(bits >= (UINT64_C(2) << mant_bits)) {
+        bits = UINT64_C(1) << mant_bits;
+        power2++;
+    }
+    bits &= ~(UINT64_C(1) << mant_bits);
+
+    if(power2 >= 0x7FF)
+        return inf_bits;
+    return bits | ((uint64_t)power2 << mant_bits);
+}
+
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    1e21, 1e22,
+};
+
+/**
+    @brief Convert text that is known to be a float with strtod(), which
+    needs it to be terminated.
+
+    @param str
+    @param len
+    @return double
+**/
+static double slow_float(const char* str, size_t len) {
+
+    char buf[128];
+    char* text = (len < sizeof(buf))? buf: MALLOC(len + 1);
+    memcpy(text, str, len);
+    text[len] = '\0';
+
+    double num = strtod(text, NULL);
+    if(text != buf)
+        FREE(text);
+    return num;
+}
+
+/**
+    @brief Parse a floating point number, which looks like [+-]digits,
+    [+-]digits.[digits] or [+-][digits].digits, and any of them can be
+    followed by e[+-]digits.
+
+    @param str
+    @param len
+    @param out
+    @return bool
+**/
+bool parse_float_number(const char* str, size_t len, double* out) {
+
+    const char* ptr = str;
+    const char* end = str + len;
+    bool neg = false;
+    if(ptr < end && (*ptr == '+' || *ptr == '-'))
+        neg = (*ptr++ == '-');
+
+    // all of the digits, which can wrap, and the power of ten
+    uint64_t mant = 0;
+    const char* digits = ptr;
+    ptr = add_digits(ptr, end, &mant);
+    int64_t ndigits = ptr - digits;
+    int64_t exp10 = 0;
+
+    if(ptr < end && *ptr == '.') {
+        const char* frac = ++ptr;
+        ptr = add_digits(ptr, end, &mant);
+        exp10 = -(ptr - frac);
+        ndigits += ptr - frac;
+    }
+
+    if(ndigits == 0)
+        return false;
+
+    if(ptr < end && (*ptr | 0x20) == 'e') {
+        ptr++;
+        bool eneg = false;
+        if(ptr < end && (*ptr == '+' || *ptr == '-'))
+            eneg = (*ptr++ == '-');
+        if(ptr >= end || !is_digit(*ptr))
+            return false;
+        int64_t eval = 0;
+        for(; ptr < end && is_digit(*ptr); ptr++)
+            if(eval < 0x10000000)
+                eval = eval * 10 + (*ptr - '0');
+        exp10 += eneg? -eval: eval;
+    }
+
+    if(ptr != end)
+        return false;
+
+    // More than 19 digits may not fit. Leading zeros do not count, and when
+    // there are still too many, the first 19 are used and the rest become
+    // the power of ten.
+    bool truncated = false;
+    if(ndigits > 19) {
+        const char* dig = digits;
+        for(; dig < end && (*dig == '0' || *dig == '.'); dig++)
+            ndigits -= (*dig == '0');
+
+        if(ndigits > 19) {
+            truncated = true;
+            mant = 0;
+            int taken = 0;
+            for(; taken < 19; dig++)
+                if(*dig != '.') {
+                    mant = mant * 10 + (*dig - '0');
+                    taken++;
+                }
+            exp10 += ndigits - 19;
+        }
+    }
+
+    double num;
+    if(mant == 0)
+        num = 0.0;
+    else if(!truncated && mant <= (UINT64_C(1) << 53) && exp10 >= -22 && exp10 <= 22)
+        num = (exp10 < 0)? (double)mant / exact_powers[-exp10]: (double)mant * exact_powers[exp10];
+    else {
+        uint64_t bits = eisel_lemire(mant, exp10);
+        // the digits that were dropped could round it either way
+        if(truncated && bits != eisel_lemire(mant + 1, exp10)) {
+            *out = slow_float(str, len);
+            return true;
+        }
+        memcpy(&num, &bits, sizeof(num));
+    }
+
+    *out = neg? -num: num;
+    return true;
+}
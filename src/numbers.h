@@ -0,0 +1,20 @@
+/**
+    @file numbers.h
+
+    @brief Convert the text of a number to its value. The scanner uses these
+    for number literals and the VM uses them to convert strings, so a number
+    has the same value in both places.
+
+**/
+#ifndef __NUMBERS_H__
+#define __NUMBERS_H__
+
+#include "common.h"
+
+bool parse_decimal_digits(const char* str, size_t len, uint64_t* out);
+bool parse_hex_digits(const char* str, size_t len, uint64_t* out);
+bool parse_signed_number(const char* str, size_t len, int64_t* out);
+bool parse_unsigned_number(const char* str, size_t len, uint64_t* out);
+bool parse_float_number(const char* str, size_t len, double* out);
+
+#endif
@@ -4,24 +4,252 @@
     @brief
 
 **/
-#include <regex.h>
+#include <pthread.h>
 #include "common.h"
 
+// The intern table. The key is the string and the data is the ObjString*.
+// The compiler threads share it, so it is only touched under the lock. Only
+// the compiler interns: literals, and the strings that it folds into the
+// constant pool. Strings built by the VM at run time never go in, so the
+// table does not grow while a program runs and the VM never takes the lock.
+static hashtable_t* strings = NULL;
+static pthread_mutex_t strings_lock = PTHREAD_MUTEX_INITIALIZER;
 
-Obj* create_string_object(const char* str) {
+/**
+    @brief Allocate a string object that takes ownership of the chars. The
+    object is not interned.
+
+    @param chars
+    @param len
+    @return ObjString*
+**/
+static ObjString* take_string(char* chars, size_t len) {
 
-    ObjString* sobj = ALLOC_DS(ObjString);
+    ObjString* sobj = POOL_DS(ObjString);
     sobj->obj.type = OBJ_STRING;
-    sobj->str = create_char_buffer();
-    add_char_buffer_str(sobj->str, str);
-    sobj->len = strlen(str);
+    sobj->chars = chars;
+    sobj->len = (int)len;
+    sobj->hash = hash_key(chars, len);
+    sobj->interned = false;
+
+    return sobj;
+}
+
+/**
+    @brief Look up a string in the intern table.
+
+    @param chars -- does not need to be terminated
+    @param len
+    @param hash
+    @return ObjString* -- the interned string or NULL
+**/
+static ObjString* find_string(const char* chars, size_t len, uint32_t hash) {
+
+    ObjString* sobj = NULL;
+
+    if(strings == NULL)
+        strings = create_hash_table();
+
+    if(HASH_NO_ERROR != find_hashed(strings, chars, len, hash, &sobj, sizeof(sobj)))
+        return NULL;
+    return sobj;
+}
+
+/**
+    @brief Intern the string with the lock held.
+
+    @param sobj
+    @return ObjString*
+**/
+static ObjString* intern_locked(ObjString* sobj) {
+
+    ObjString* found = find_string(sobj->chars, sobj->len, sobj->hash);
+    if(found != NULL)
+        return found;
+
+    insert_hashed(strings, sobj->chars, sobj->len, sobj->hash, &sobj, sizeof(sobj));
+    sobj->interned = true;
+    return sobj;
+}
+
+/**
+    @brief Return the interned string that is equal to this one. If there is
+    none, then this string becomes the interned one and the intern table takes
+    ownership of it. This is for the compiler, which uses it to put strings in
+    the constant pool. The VM does not call it.
+
+    @param sobj
+    @return ObjString*
+**/
+ObjString* intern_string(ObjString* sobj) {
+
+    if(sobj->interned)
+        return sobj;
+
+    pthread_mutex_lock(&strings_lock);
+    ObjString* found = intern_locked(sobj);
+    pthread_mutex_unlock(&strings_lock);
+    return found;
+}
+
+/**
+    @brief Return the interned string object for the string. A new object is
+    created only when the string has not been seen before. The string does not
+    need to be terminated, so it can be a token that points into the source.
+
+    @param str
+    @param len
+    @return Obj*
+**/
+Obj* create_string_object(const char* str, size_t len) {
+
+    uint32_t hash = hash_key(str, len);
+
+    pthread_mutex_lock(&strings_lock);
+    ObjString* sobj = find_string(str, len, hash);
+    if(sobj == NULL) {
+        char* chars = MALLOC(len + 1);
+        memcpy(chars, str, len);
+        chars[len] = 0;
+        sobj = take_string(chars, len);
+        intern_locked(sobj);
+    }
+    pthread_mutex_unlock(&strings_lock);
 
     return (Obj*)sobj;
 }
 
+/**
+    @brief Free all of the interned strings and the intern table.
+
+**/
+void destroy_strings() {
+
+    if(strings == NULL)
+        return;
+
+    for(const char* key = iterate_hash_table(strings, 1); key != NULL;
+                key = iterate_hash_table(strings, 0)) {
+        ObjString* sobj;
+        find_hash(strings, key, &sobj, sizeof(sobj));
+        FREE(sobj->chars);
+        POOL_FREE(sobj, ObjString);
+    }
+
+    destroy_hash_table(strings);
+    strings = NULL;
+}
+
+#ifdef NAN_BOXING
+// The ints and uints that are too wide for a NaN box. The boxes that the
+// compiler and the loader make are interned the same way as strings, so the
+// key is the type and bits of the number. A machine that is running puts the
+// boxes that it makes on its own list instead, which takes no lock.
+static hashtable_t* wide_numbers = NULL;
+static pthread_mutex_t wide_numbers_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread ptr_list_t* run_boxes = NULL;
+
+/**
+    @brief Return a box for a number that does not fit in a NaN boxed Value.
+    While a machine runs on this thread, the box is new and goes on the
+    machine's list. Otherwise it is interned, so it is only created the first
+    time the number is seen, and it lives until destroy_wide_numbers().
+
+    @param type -- VAL_INUM or VAL_UNUM
+    @param bits
+    @return const wideNumber*
+**/
+const wideNumber* box_wide_number(ValueType type, uint64_t bits) {
+
+    wideNumber* box = NULL;
+
+    if(run_boxes != NULL) {
+        box = POOL_DS(wideNumber);
+        box->type = type;
+        box->as.unum = bits;
+        append_ptr_list(run_boxes, box);
+        return box;
+    }
+
+    char key[32];
+    int len = snprintf(key, sizeof(key), "%d:%016lx", (int)type, (unsigned long)bits);
+    uint32_t hash = hash_key(key, len);
+
+    pthread_mutex_lock(&wide_numbers_lock);
+    if(wide_numbers == NULL)
+        wide_numbers = create_hash_table();
+
+    if(HASH_NO_ERROR != find_hashed(wide_numbers, key, len, hash, &box, sizeof(box))) {
+        box = ALLOC_DS(wideNumber);
+        box->type = type;
+        box->as.unum = bits;
+        insert_hashed(wide_numbers, key, len, hash, &box, sizeof(box));
+    }
+    pthread_mutex_unlock(&wide_numbers_lock);
+
+    return box;
+}
+#endif
+
+/**
+    @brief Put the boxes for wide numbers that are made on this thread on the
+    list, until it is called again with NULL. run_vmachine() does this with
+    the list of its machine. This does nothing when Values are not NaN boxed.
+
+    @param list
+**/
+void box_wide_numbers_in(ptr_list_t* list) {
+
+#ifdef NAN_BOXING
+    run_boxes = list;
+#else
+    (void)list;
+#endif
+}
+
+/**
+    @brief Free the boxes on a list that was given to box_wide_numbers_in(),
+    and empty it.
+
+    @param list
+**/
+void free_wide_numbers(ptr_list_t* list) {
+
+#ifdef NAN_BOXING
+    wideNumber** boxes = (wideNumber**)list->buffer;
+    for(int i = 0; i < list->nitems; i++)
+        POOL_FREE(boxes[i], wideNumber);
+#endif
+    list->nitems = 0;
+}
+
+/**
+    @brief Free the interned boxes of the numbers that were too wide for a NaN
+    boxed Value. This does nothing when Values are not NaN boxed.
+
+**/
+void destroy_wide_numbers() {
+
+#ifdef NAN_BOXING
+    if(wide_numbers == NULL)
+        return;
+
+    for(const char* key = iterate_hash_table(wide_numbers, 1); key != NULL;
+                key = iterate_hash_table(wide_numbers, 0)) {
+        wideNumber* box;
+        find_hash(wide_numbers, key, &box, sizeof(box));
+        FREE(box);
+    }
+
+    destroy_hash_table(wide_numbers);
+    wide_numbers = NULL;
+#endif
+}
+
 /**
     @brief Free an object that was allocated in objects.c This method is not to
-    be called for values that are not objects.
+    be called for values that are not objects. Interned strings belong to the
+    intern table and are left alone.
 
     @param obj
 **/
@@ -29,14 +257,36 @@ void free_object(Obj* obj) {
 
     switch(obj->type) {
         case OBJ_STRING:
-            destroy_char_buffer(((ObjString*)obj)->str);
-            FREE(obj);
+            if(!((ObjString*)obj)->interned) {
+                FREE(((ObjString*)obj)->chars);
+                POOL_FREE(obj, ObjString);
+            }
             break;
         default:
             fatal_error("unknown object type in free_object()");
     }
 }
 
+/**
+    @brief Return true if two strings hold the same characters. Two interned
+    strings are equal only when they are the same object. A string that was
+    built at run time is not interned, so it is compared by length, hash and
+    then the characters.
+
+    @param str1
+    @param str2
+    @return bool
+**/
+static bool strings_equal(ObjString* str1, ObjString* str2) {
+
+    if(str1 == str2)
+        return true;
+    if(str1->interned && str2->interned)
+        return false;
+    return str1->len == str2->len && str1->hash == str2->hash &&
+                memcmp(str1->chars, str2->chars, str1->len) == 0;
+}
+
 /**
     @brief Compare two objects. This will only be called for values of type
     VAL_OBJ. Other value types will likely cause a segfault.
@@ -49,23 +299,16 @@ void free_object(Obj* obj) {
 **/
 bool compare_objects(Value* op1, Value* op2, OpCode op) {
 
-    if(op1->type != op2->type)
+    if(VALUE_TYPE(op1) != VALUE_TYPE(op2))
         return false;
 
     // both objects are the same type
     switch(op) {
         case OP_EQUALITY:
-            switch(op1->as.obj->type) {
-                case OBJ_STRING: {
-                    size_t len1 = ((ObjString*)(op1->as.obj))->len;
-                    size_t len2 = ((ObjString*)(op2->as.obj))->len;
-                    if(len1 != len2)
-                        return false;
-                    const char* str1 = get_char_buffer(((ObjString*)(op1->as.obj))->str);
-                    const char* str2 = get_char_buffer(((ObjString*)(op2->as.obj))->str);
-                    return memcmp(str1, str2, MIN(len1, len2)) == 0;
-                }
-                               break;
+            switch(AS_OBJ(op1)->type) {
+                case OBJ_STRING:
+                    return strings_equal((ObjString*)AS_OBJ(op1),
+                                (ObjString*)AS_OBJ(op2));
                 default:
                     fatal_error("unknown object type in compare_object()");
             }
@@ -122,8 +365,8 @@ static Obj* arith_op_for_class(Value* op1, Value* op2, OpCode op) {
 Obj* arithmetic_objects(Value* op1, Value* op2, OpCode op) {
 
     Obj* nobj = NULL;
-    ObjectType otype1 = op1->as.obj->type;
-    ObjectType otype2 = op2->as.obj->type;
+    ObjectType otype1 = AS_OBJ(op1)->type;
+    ObjectType otype2 = AS_OBJ(op2)->type;
 
     switch(op) {
         case OP_ADD:
@@ -131,10 +374,14 @@ Obj* arithmetic_objects(Value* op1, Value* op2, OpCode op) {
                 case OBJ_STRING:
                     switch(otype2) {
                         case OBJ_STRING: {
-                                const char* str1 = value_as_cstring(op1);
-                                const char* str2 = value_as_cstring(op2);
-                                nobj = create_string_object(str1);
-                                add_char_buffer_str(((ObjString*)nobj)->str, str2);
+                                // the result is not interned
+                                ObjString* str1 = value_as_string(op1);
+                                ObjString* str2 = value_as_string(op2);
+                                size_t len = str1->len + str2->len;
+                                char* chars = MALLOC(len + 1);
+                                memcpy(chars, str1->chars, str1->len);
+                                memcpy(chars + str1->len, str2->chars, str2->len + 1);
+                                nobj = (Obj*)take_string(chars, len);
                             }
                             break;
                         default:
@@ -159,87 +406,40 @@ Obj* arithmetic_objects(Value* op1, Value* op2, OpCode op) {
 }
 
 
-static bool re_match(const char* regex, const char* str) {
-
-    regex_t re;
-
-    if(regcomp(&re, regex, REG_EXTENDED | REG_ICASE | REG_NOSUB) != 0)
-        fatal_error("failed to compile regex in validate_float()");
-
-    int status = regexec(&re, str, 0, NULL, 0);
-    regfree(&re);
-
-    return status == 0;
-}
-
-/**
-    @brief Validate that the string can represent a floating point number.
-
-    @param str
-    @return true
-    @return false
-**/
-static bool validate_float(const char* str) {
-
-    const char* regex = "^[+-]?([0-9]*\\.)?[0-9]+(e[-+]?[0-9]+)?$";
-    return re_match(regex, str);
-}
-
-/**
-    @brief Validate an unsigend number, which is always represented as hex.
-
-    @param str
-    @return true
-    @return false
-**/
-static bool validate_unsigned(const char* str) {
-
-    const char* regex = "^0x[0-9a-f]+$";
-    return re_match(regex, str);
-}
-
-/**
-    @brief Validate a signed number, which cannot have a leading zero.
-
-    @param str
-    @return true
-    @return false
-**/
-static bool validate_signed(const char* str) {
-
-    const char* regex = "^[^0][0-9]+$";
-    return re_match(regex, str);
-}
-
 /**
-    @brief Validate a boolean value which can have the values of "true" or "false".
-    This does not evaluate as case-sensitive.
+    @brief Return true if the string is the word, ignoring the case. The
+    word must be lower case letters.
 
     @param str
-    @return true
-    @return false
+    @param word
+    @return bool
 **/
-static bool validate_bool(const char* str) {
+static bool same_word(const char* str, const char* word) {
 
-    const char* regex = "^true|false$";
-    return re_match(regex, str);
+    while(*word != '\0')
+        if((*str++ | 0x20) != *word++)
+            return false;
+    return *str == '\0';
 }
 
-#if 0
 /**
-    @brief Validate a "nothing" keyword. This is overkill for a single word, but I do
-    it anyway. This is evaluated as not case-sensitive.
+    @brief Parse a boolean value which can have the values of "true" or
+    "false". This is not case-sensitive.
 
     @param str
-    @return true
-    @return false
+    @param out
+    @return bool
 **/
-static bool validate_nothing(const char* str) {
+static bool parse_bool(const char* str, bool* out) {
 
-    const char* regex = "^nothing$";
-    return re_match(regex, str);
+    if(same_word(str, "true"))
+        *out = true;
+    else if(same_word(str, "false"))
+        *out = false;
+    else
+        return false;
+    return true;
 }
-#endif
 
 /**
     @brief Convert the object value to another type. This will be used mainly
@@ -247,11 +447,12 @@ static bool validate_nothing(const char* str) {
 
     The value is converted in place, and the type of the value is returned. If
     the object could not be converted then VAL_INVALID is returned, so the
-    caller should always check that. When the conversion is successful, the
-    object is free()d.
+    caller should always check that. The object is not free()d when the
+    conversion is successful, because it belongs to the constant pool or to
+    the VM that created it.
 
-    The validate routines are necessary to ensure a correct conversion or else
-    correctly failing if appropriate.
+    The parse routines check the string and convert it in one pass, so that a
+    string that is not a number of the type correctly fails.
 
     @param val
     @param type
@@ -259,80 +460,71 @@ static bool validate_nothing(const char* str) {
 **/
 ValueType conv_obj_to_val(Value* val, ValueType type) {
 
-    const char* buf;
+    ObjString* str;
 
-    if(val->type != VAL_OBJ)
+    if(!IS_OBJ(val))
         return VAL_INVALID; // not an object
 
     switch(type) {
         case VAL_INUM:
-            val->type = VAL_INUM;
-            switch(val->as.obj->type) {
-                case OBJ_STRING:
-                    buf = get_char_buffer(((ObjString*)val->as.obj)->str);
-                    if(validate_signed(buf)) {
-                        val->as.inum = (int64_t)strtol(buf, NULL, 10);
-                        free_object(val->as.obj);
+            switch(AS_OBJ(val)->type) {
+                case OBJ_STRING: {
+                        int64_t num;
+                        str = (ObjString*)AS_OBJ(val);
+                        if(!parse_signed_number(str->chars, str->len, &num))
+                            return VAL_INVALID;
+                        *val = INUM_VALUE(num);
                     }
-                    else
-                        return VAL_INVALID;
                     break;
                 default:
                     fatal_error("connot convert object to value");
             }
             break;
         case VAL_UNUM:
-            val->type = VAL_UNUM;
-            switch(val->as.obj->type) {
-                case OBJ_STRING:
-                    // UNUMs are always hex.
-                    buf = get_char_buffer(((ObjString*)val->as.obj)->str);
-                    if(validate_unsigned(buf)) {
-                        val->as.unum = (uint64_t)strtol(buf, NULL, 16);
-                        free_object(val->as.obj);
+            switch(AS_OBJ(val)->type) {
+                case OBJ_STRING: {
+                        // UNUMs are always hex.
+                        uint64_t num;
+                        str = (ObjString*)AS_OBJ(val);
+                        if(!parse_unsigned_number(str->chars, str->len, &num))
+                            return VAL_INVALID;
+                        *val = UNUM_VALUE(num);
                     }
-                    else
-                        return VAL_INVALID;
                     break;
                 default:
                     fatal_error("connot convert object to value");
             }
             break;
         case VAL_FNUM:
-            val->type = VAL_FNUM;
-            switch(val->as.obj->type) {
-                case OBJ_STRING:
-                    buf = get_char_buffer(((ObjString*)val->as.obj)->str);
-                    if(validate_float(buf)) {
-                        val->as.fnum = (int64_t)strtod(buf, NULL);
-                        free_object(val->as.obj);
+            switch(AS_OBJ(val)->type) {
+                case OBJ_STRING: {
+                        double num;
+                        str = (ObjString*)AS_OBJ(val);
+                        if(!parse_float_number(str->chars, str->len, &num))
+                            return VAL_INVALID;
+                        *val = FNUM_VALUE(num);
                     }
-                    else
-                        return VAL_INVALID;
                     break;
                 default:
                     fatal_error("connot convert object to value");
             }
             break;
         case VAL_BOOL:
-            val->type = VAL_BOOL;
-            switch(val->as.obj->type) {
-                case OBJ_STRING:
-                    buf = get_char_buffer(((ObjString*)val->as.obj)->str);
-                    if(validate_bool(buf)) {
-                        val->as.bval = (strcmp(buf, "true") == 0);
-                        free_object(val->as.obj);
+            switch(AS_OBJ(val)->type) {
+                case OBJ_STRING: {
+                        bool bval;
+                        str = (ObjString*)AS_OBJ(val);
+                        if(!parse_bool(str->chars, &bval))
+                            return VAL_INVALID;
+                        *val = BOOL_VALUE(bval);
                     }
-                    else
-                        return VAL_INVALID;
                     break;
                 default:
                     fatal_error("connot convert object to value");
             }
             break;
         case VAL_NOTHING:
-            val->type = VAL_NOTHING;
-            free_object(val->as.obj);
+            *val = NOTHING_VALUE;
             break;
         case VAL_OBJ:
             fatal_error("connot convert object to another value type in conv_obj_to_val()");
@@ -341,7 +533,7 @@ ValueType conv_obj_to_val(Value* val, ValueType type) {
             fatal_error("unknown value type in conv_obj_to_val()");
     }
 
-    return val->type;
+    return VALUE_TYPE(val);
 }
 
 /**
@@ -364,11 +556,11 @@ ValueType conv_val_to_obj(Value* val, ObjectType type) {
 
     switch(type) {
         case OBJ_STRING:
-            switch(val->type) {
-                case VAL_INUM: snprintf(buf, sizeof(buf), "%ld", val->as.inum); break;
-                case VAL_UNUM: snprintf(buf, sizeof(buf), "0x%lX", val->as.unum); break;
-                case VAL_FNUM: snprintf(buf, sizeof(buf), "%0.f", val->as.fnum); break;
-                case VAL_BOOL: strcpy(buf, (val->as.bval)? "true": "false"); break;
+            switch(VALUE_TYPE(val)) {
+                case VAL_INUM: snprintf(buf, sizeof(buf), "%ld", AS_INUM(val)); break;
+                case VAL_UNUM: snprintf(buf, sizeof(buf), "0x%lX", AS_UNUM(val)); break;
+                case VAL_FNUM: snprintf(buf, sizeof(buf), "%0.f", AS_FNUM(val)); break;
+                case VAL_BOOL: strcpy(buf, AS_BOOL(val)? "true": "false"); break;
                 case VAL_NOTHING: strcpy(buf, "nothing"); break;
                 case VAL_OBJ:
                     // fatal error does not return
@@ -377,11 +569,10 @@ ValueType conv_val_to_obj(Value* val, ObjectType type) {
                 default:
                     fatal_error("unknown value type in conv_val_to_obj()");
             }
-            val->type = VAL_OBJ;
-            val->as.obj = create_string_object(buf);
+            *val = OBJ_VALUE(take_string(STRDUP(buf), strlen(buf)));
             break;
         default:
             fatal_error("unknown object type in conv_val_to_obj()");
     }
-    return val->type;
+    return VALUE_TYPE(val);
 }
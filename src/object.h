@@ -17,39 +17,44 @@ struct Obj {
     ObjectType type;
 };
 
-typedef char_buffer_t String;
-
 struct ObjString {
     Obj obj;
     int len;
-    String str;
+    uint32_t hash;  // cached hash_key() of chars
+    bool interned;  // owned by the intern table
+    char* chars;
 };
 
 static inline bool __attribute__((always_inline)) value_is_string(Value* val) {
-    if(value_is_object(val)) {
-        if(val->as.obj->type == OBJ_STRING)
+    if(IS_OBJ(val)) {
+        if(AS_OBJ(val)->type == OBJ_STRING)
             return true;
     }
     return false;
 }
 
 static inline ObjString* __attribute__((always_inline)) value_as_string(Value* val) {
-    if(value_is_object(val)) {
-        if(val->as.obj->type == OBJ_STRING)
-            return (ObjString*)val->as.obj;
+    if(IS_OBJ(val)) {
+        if(AS_OBJ(val)->type == OBJ_STRING)
+            return (ObjString*)AS_OBJ(val);
     }
     return NULL;
 }
 
 static inline char* __attribute__((always_inline)) value_as_cstring(Value* val) {
-    if(value_is_object(val)) {
-        if(val->as.obj->type == OBJ_STRING)
-            return (char*)get_char_buffer(((ObjString*)val->as.obj)->str);
+    if(IS_OBJ(val)) {
+        if(AS_OBJ(val)->type == OBJ_STRING)
+            return ((ObjString*)AS_OBJ(val))->chars;
     }
     return NULL;
 }
 
-Obj* create_string_object(const char* str);
+Obj* create_string_object(const char* str, size_t len);
+ObjString* intern_string(ObjString*);
+void destroy_strings();
+void box_wide_numbers_in(ptr_list_t*);
+void free_wide_numbers(ptr_list_t*);
+void destroy_wide_numbers();
 void free_object(Obj*);
 bool compare_objects(Value* op1, Value* op2, OpCode op);
 Obj* arithmetic_objects(Value* op1, Value* op2, OpCode op);
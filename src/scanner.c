@@ -4,94 +4,97 @@
     @brief The complete scanner. See scanner.h for interface functions.
 
 **/
+// mmap() and friends are POSIX, and --std=c99 hides them.
+#define _POSIX_C_SOURCE 200809L
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "common.h"
+#include "charspan.h"
 
-// This is supposed to be prototyped in stdio.h, but it does not seem to be.
-extern FILE* fmemopen(void*, size_t, const char*);
+/*
+ * Every input is scanned from memory with a plain pointer. Files are mmap()ed
+ * when that is possible and read into a buffer when it is not, such as for a
+ * pipe. Strings are scanned in place.
+ */
+typedef enum {
+    INPUT_STRING,   // buffer belongs to the caller
+    INPUT_MAPPED,   // buffer is an mmap()ed file
+    INPUT_READ,     // buffer was allocated and read in
+} input_kind_t;
 
 typedef struct __file_stack {
     char* fname;
-    bool is_file;
-    union {
-        FILE* fp;
-        const char* str;
-    } input;
+    input_kind_t kind;
+    const char* buffer; // start of the input
+    const char* end;    // one past the end of the input
+    const char* crnt;   // next character to read
     int line_no;
     int col_no;
     struct __file_stack* next;
 } file_stack_t;
 
-static file_stack_t* top = NULL;
-
 typedef struct {
     const char* str;
+    size_t len;
     TokenType tok;
 } token_map_t;
 
-static int nest_depth = 0;
-static char_buffer_t scanner_buffer;
-static int file_flag = 0;
-static int last_col;
+/*
+ * The keyword table is a perfect hash that is generated at build time by
+ * mkkeywords. To add a keyword, add it with its token to the file
+ * keywordlist.txt in ./tests. The order does not matter.
+ */
+#include "keywords.h"
+
+/*
+ * Everything that the scanner knows about the input that it is reading. A
+ * thread that compiles has its own, and the scanner functions work on the
+ * one that was given to set_scanner() in that thread.
+ */
+struct _scanner_t {
+    file_stack_t* top;
+    int nest_depth;
+    char_buffer_t buffer;
+    int file_flag;
+    int last_col;
+    bool str_escaped;           // the string that was just read had escapes
+    token_num_t number;         // the value of the number that was just read
+    // where the parser is when it reads from a token buffer
+    const char* batch_fname;
+    int batch_line;
+    int batch_col;
+    token_buffer_t* batch_tokens;   // being filled by scan_tokens()
+};
+
+static __thread scanner_t* scn = NULL;
 
 /**
-    @brief This is the data structure that converts keywords to tokens.
+    @brief Free a file stack entry and the text that it was reading.
 
-    This data structure must be in sorted order.
-    To update, see the file keywordlist.txt in ./tests
-    1. Add the keywords with the token.
-    2. cat keywordlist.txt | sort
-    3. copy/paste the result here.
+    @param fsp
 **/
-static token_map_t token_map[] = {
-    {"and", AND_TOKEN},
-    {"as", AS_TOKEN},
-    {"bool", BOOL_TOKEN},
-    {"break", BREAK_TOKEN},
-    {"case", CASE_TOKEN},
-    {"class", CLASS_TOKEN},
-    {"constructor", CONSTRUCTOR_TOKEN},
-    {"continue", CONTINUE_TOKEN},
-    {"default", DEFAULT_TOKEN},
-    {"destructor", DESTRUCTOR_TOKEN},
-    {"dict", DICT_TOKEN},
-    {"do", DO_TOKEN},
-    {"else", ELSE_TOKEN},
-    {"entry", ENTRY_TOKEN},
-    {"equ", EQUALITY_TOKEN},
-    {"except", EXCEPT_TOKEN},
-    {"false", FALSE_TOKEN},
-    {"float", FLOAT_TOKEN},
-    {"for", FOR_TOKEN},
-    {"gte", GTE_TOKEN},
-    {"gt", GT_TOKEN},
-    {"if", IF_TOKEN},
-    {"import", IMPORT_TOKEN},
-    {"inline", INLINE_TOKEN},
-    {"int", INT_TOKEN},
-    {"list", LIST_TOKEN},
-    {"lte", LTE_TOKEN},
-    {"lt", LT_TOKEN},
-    {"map", MAP_TOKEN},
-    {"neq", NEQ_TOKEN},
-    {"not", NOT_TOKEN},
-    {"nothing", NOTHING_TOKEN},
-    {"or", OR_TOKEN},
-    {"private", PRIVATE_TOKEN},
-    {"protected", PROTECTED_TOKEN},
-    {"public", PUBLIC_TOKEN},
-    {"raise", RAISE_TOKEN},
-    {"return", RETURN_TOKEN},
-    {"string", STRING_TOKEN},
-    {"super", SUPER_TOKEN},
-    {"switch", SWITCH_TOKEN},
-    {"true", TRUE_TOKEN},
-    {"try", TRY_TOKEN},
-    {"uint", UINT_TOKEN},
-    {"nothing", NOTHING_TOKEN},
-    {"while", WHILE_TOKEN},
-};
+static void release_input(file_stack_t* fsp) {
+
+    if(fsp->fname != NULL)
+        FREE(fsp->fname);
+
+    switch(fsp->kind) {
+        case INPUT_MAPPED:
+            munmap((void*)fsp->buffer, fsp->end - fsp->buffer);
+            break;
+        case INPUT_READ:
+            FREE(fsp->buffer);
+            break;
+        case INPUT_STRING:
+            // if the stream is a string, then it's free()d by caller.
+            break;
+    }
 
-static const size_t token_map_size = (sizeof(token_map) / sizeof(token_map_t));
+    FREE(fsp);
+}
 
 /**
     @brief Close the currently open file and update the file stack.
@@ -100,20 +103,37 @@ static const size_t token_map_size = (sizeof(token_map) / sizeof(token_map_t));
 **/
 void close_input_file() {
 
-    log_debug("enter top = %p", top);
-    if(top != NULL) {
-        file_stack_t* fsp = top;
-        top = top->next; // could make top NULL
-        if(fsp->fname != NULL)
-            FREE(fsp->fname);
+    log_debug("enter top = %p", scn->top);
+    if(scn->top != NULL) {
+        file_stack_t* fsp = scn->top;
+        scn->top = scn->top->next; // could make top NULL
+        if(fsp->kind != INPUT_STRING)
+            scn->nest_depth--;
+
+        // the tokens in a token buffer are views into the text
+        if(scn->batch_tokens != NULL)
+            append_ptr_list(scn->batch_tokens->closed, fsp);
+        else
+            release_input(fsp);
+    }
+    log_debug("leave top = %p", scn->top);
+}
+
+/**
+    @brief Return a pointer to the next character that get_char() will read,
+    or NULL if there is no input. A file that has ended is closed first, the
+    same way that get_char() does it.
 
-        if(fsp->is_file)
-            fclose(fsp->input.fp);
-        // if the stream is a string, then it's free()d by caller.
+    @return const char*
+**/
+static const char* input_cursor() {
 
-        FREE(fsp);
+    if(scn->file_flag) {
+        scn->file_flag = 0;
+        close_input_file();
     }
-    log_debug("leave top = %p", top);
+
+    return (scn->top != NULL)? scn->top->crnt: NULL;
 }
 
 /**
@@ -127,25 +147,26 @@ static int get_char() {
     int ch;
 
     // defer closing the file until after the END_OF_FILE token has been read.
-    if(file_flag) {
-        file_flag = 0;
+    if(scn->file_flag) {
+        scn->file_flag = 0;
         close_input_file();
     }
 
-    if(top != NULL) {
-        ch = fgetc(top->input.fp);
-        log_debug("char: %c", ch);
-        if(ch == EOF) {
+    if(scn->top != NULL) {
+        if(scn->top->crnt >= scn->top->end) {
             log_debug("end of file");
-            ch = END_FILE;
+            return END_FILE;
         }
-        else if(ch == '\n') {
-            top->line_no++;
-            last_col = top->col_no;
-            top->col_no = 1;
+
+        ch = (unsigned char)*scn->top->crnt++;
+        log_debug("char: %c", ch);
+        if(ch == '\n') {
+            scn->top->line_no++;
+            scn->last_col = scn->top->col_no;
+            scn->top->col_no = 1;
         }
         else {
-            top->col_no++;
+            scn->top->col_no++;
             //last_col = top->col_no;
         }
     }
@@ -158,47 +179,75 @@ static int get_char() {
 
 
 /**
-    @brief Stuff the character back into the input stream.
+    @brief Stuff the character back into the input stream. The character must
+    be the last one that get_char() returned. The end of the file is not a
+    character in the buffer, so it stays where it is and get_char() returns
+    it again.
 
     @param ch
 **/
 static void unget_char(int ch) {
 
-    if(top != NULL) {
-        ungetc(ch, top->input.fp);
+    if(scn->top != NULL) {
+        if(ch == END_FILE || ch == END_INPUT || scn->top->crnt <= scn->top->buffer)
+            return;
+
+        scn->top->crnt--;
         if(ch == '\n') {
-            top->line_no--;
-            top->col_no = last_col;
+            scn->top->line_no--;
+            scn->top->col_no = scn->last_col;
         }
         else {
-            if(top->col_no > 1)
-                top->col_no--;
+            if(scn->top->col_no > 1)
+                scn->top->col_no--;
             else
-                top->col_no = 1;
+                scn->top->col_no = 1;
         }
     }
 }
 
 /**
-    @brief Skip white space.
+    @brief Move the cursor forward to the given point in the current input,
+    updating the line and column the same way that calling get_char() for
+    each character would.
 
+    @param to
 **/
-static void skip_ws() {
+static void move_cursor(const char* to) {
 
-    int ch, finished = 0;
+    const char* p = scn->top->crnt;
+    const char* nl = NULL;
+    const char* prev = NULL;
+    int lines = 0;
 
-    while(!finished) {
-        ch = get_char();
-        if(!isspace(ch)) {
-            unget_char(ch);
-            finished++;
-        }
-        else if(ch == END_INPUT)
-            finished++;
+    while((p = memchr(p, '\n', to - p)) != NULL) {
+        prev = nl;
+        nl = p++;
+        lines++;
     }
-    // next char in input stream is not blank.
+
+    if(nl != NULL) {
+        // the column before the last newline, for unget_char()
+        scn->last_col = (prev != NULL)? (int)(nl - prev): scn->top->col_no + (int)(nl - scn->top->crnt);
+        scn->top->line_no += lines;
+        scn->top->col_no = (int)(to - nl);
+    }
+    else
+        scn->top->col_no += (int)(to - scn->top->crnt);
+
+    scn->top->crnt = to;
 }
 
+/**
+    @brief Skip white space.
+
+**/
+static void skip_ws() {
+
+    if(input_cursor() != NULL)
+        move_cursor(span_space(scn->top->crnt, scn->top->end));
+    // next char in input stream is not blank.
+}
 
 /**
     @brief Eat characters until white space is encountered.
@@ -208,8 +257,8 @@ static void skip_ws() {
 static void eat_until_ws() {
 
     int ch;
-    while(!isspace(ch = get_char()))
-        add_char_buffer(scanner_buffer, ch);
+    while(!CHAR_IS(ch = get_char(), CC_SPACE) && ch != END_FILE && ch != END_INPUT)
+        add_char_buffer(scn->buffer, ch);
     unget_char(ch);
 }
 
@@ -219,16 +268,9 @@ static void eat_until_ws() {
 **/
 static void eat_single_line() {
 
-    int ch, finished = 0;
-
-    while(!finished) {
-        ch = get_char();
-        if(ch == '\n' || ch == END_FILE) {
-            //return NONE_TOKEN;
-            unget_char(ch);
-            break;
-        }
-    }
+    // the newline is left for skip_ws()
+    const char* nl = memchr(scn->top->crnt, '\n', scn->top->end - scn->top->crnt);
+    move_cursor((nl != NULL)? nl: scn->top->end);
 }
 
 /**
@@ -237,192 +279,173 @@ static void eat_single_line() {
 **/
 static void eat_multi_line() {
 
-    int ch, state = 0;
+    const char* p = scn->top->crnt;
 
-    while(ch != END_OF_INPUT) {
-        ch = get_char();
-        switch(state) {
-            case 0:
-                if(ch == '*')
-                    state = 1;
-                //fprintf(stderr, "0");
-                break;
-            case 1:
-                if(ch == '/')
-                    state = 2;
-                else if(ch != '*')
-                    state = 0;
-                //fprintf(stderr, "1");
-                break;
-            case 2:
-                unget_char(ch);
-                return;
+    while((p = memchr(p, '*', scn->top->end - p)) != NULL) {
+        if(p + 1 < scn->top->end && p[1] == '/') {
+            move_cursor(p + 2);
+            return;
         }
+        p++;
     }
+
+    move_cursor(scn->top->end);
+    syntax("unterminated comment");
+}
+
+/**
+    @brief Return a pointer to the first character at or after p that is not
+    in the character class, or end if there is none. Numbers are short, so
+    this does not bother with the vector spans.
+
+    @param p
+    @param end
+    @param cls
+    @return const char*
+**/
+static inline const char* __attribute__((always_inline)) span_class(const char* p, const char* end, uint8_t cls) {
+
+    while(p < end && CHAR_IS(*p, cls))
+        p++;
+    return p;
 }
 
 /**
-    @brief Finish reading a hex number from the input stream.
-    When this is called, the "0x" has already been scanned and is a part
-    of the scanned token.
+    @brief Finish reading a hex number. The "0x" has been seen and the digits
+    run from start + 2 to the first character that is not a hex digit. The
+    value is left in scn->number.
 
-    A hex number has the format of 0xnnnnnnnn, with a maimum of 16 characters.
+    A hex number has the format of 0xnnnnnnnn, with a maximum of 16 digits.
 
+    @param start
     @return TokenType
 **/
-static TokenType read_hex_number() {
+static TokenType read_hex_number(const char* start) {
 
-    int ch;
-    while(isxdigit(ch = get_char()))
-        add_char_buffer(scanner_buffer, ch);
+    const char* ptr = span_class(start + 2, scn->top->end, CC_HEX);
+    move_cursor(ptr);
+
+    if(ptr == start + 2) {
+        syntax("malformed hex number: %.*s", (int)(ptr - start), start);
+        return ERROR_TOKEN;
+    }
+    else if(!parse_hex_digits(start + 2, ptr - start - 2, &scn->number.unum)) {
+        // the number is still a number, so the parser does not report it
+        // again as a missing expression
+        syntax("hex number is too large: %.*s", (int)(ptr - start), start);
+        scn->number.unum = 0;
+    }
 
     return UNUM_TOKEN;
 }
 
 /**
-    @brief Finish reading an octal number.
-    An octal number starts with a '0' and all digits are less than '7'.
+    @brief Finish reading an octal number. The leading '0' and the digit after
+    it have been seen. An octal number starts with a '0' and all digits are
+    less than '8'. Nothing in the parser takes an octal number yet, so the
+    value is not converted.
 
+    @param start
     @return TokenType
 **/
-static TokenType read_octal_number() {
+static TokenType read_octal_number(const char* start) {
 
-    int ch;
-    while(isdigit(ch = get_char())) {
-        if(ch <= '7')
-            add_char_buffer(scanner_buffer, ch);
-        else {
-            // eat the rest of the number and publish an error
-            while(isdigit(ch = get_char()))
-                add_char_buffer(scanner_buffer, ch);
-            unget_char(ch);
-            syntax("malformed octal number: %s", get_char_buffer(scanner_buffer));
+    const char* ptr = span_class(start + 1, scn->top->end, CC_DIGIT);
+    move_cursor(ptr);
+
+    for(const char* dig = start + 1; dig < ptr; dig++) {
+        if(*dig > '7') {
+            syntax("malformed octal number: %.*s", (int)(ptr - start), start);
             return ERROR_TOKEN;
         }
     }
+
     return ONUM_TOKEN;
 }
 
-// we can only enter here <after> we have seen a '.'
 /**
     @brief Scan a floating point number.
-    When this is called the first part of the number, up to the '.' has been
-    seen. The number may have a normal exponent.
+    When this is called the first part of the number, up to and including the
+    '.', has been seen and ptr is just past it. The number may have a normal
+    exponent. The value is left in scn->number.
 
+    @param start
+    @param ptr
     @return TokenType
 **/
-static TokenType read_float_number() {
+static TokenType read_float_number(const char* start, const char* ptr) {
 
-    int ch;
-    while(isdigit(ch = get_char())) {
-        add_char_buffer(scanner_buffer, ch);
-    }
+    const char* end = scn->top->end;
 
-    // see if we are reading a mantisa
-    if(ch == 'e' || ch == 'E') {
-        add_char_buffer(scanner_buffer, ch);
-        ch = get_char();
-        if(ch == '+' || ch == '-') {
-            add_char_buffer(scanner_buffer, ch);
-            ch = get_char();
-            if(isdigit(ch)) {
-                add_char_buffer(scanner_buffer, ch);
-            }
-            else {
-                unget_char(ch);
-                syntax("malformed float number: %s", get_char_buffer(scanner_buffer));
-                return ERROR_TOKEN;
-            }
-            while(isdigit(ch = get_char())) {
-                add_char_buffer(scanner_buffer, ch);
-            }
-            unget_char(ch);
-        }
-        else if(isdigit(ch)) {
-            add_char_buffer(scanner_buffer, ch);
-            while(isdigit(ch = get_char())) {
-                add_char_buffer(scanner_buffer, ch);
-            }
-        }
-        else {
-            // eat the rest of the number and publish an error
-            while(isdigit(ch = get_char()))
-                add_char_buffer(scanner_buffer, ch);
-            unget_char(ch);
-            syntax("malformed float number: %s", get_char_buffer(scanner_buffer));
+    ptr = span_class(ptr, end, CC_DIGIT);
+
+    // see if we are reading an exponent
+    if(ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+        ptr++;
+        if(ptr < end && (*ptr == '+' || *ptr == '-'))
+            ptr++;
+        if(ptr >= end || !CHAR_IS(*ptr, CC_DIGIT)) {
+            move_cursor(ptr);
+            syntax("malformed float number: %.*s", (int)(ptr - start), start);
             return ERROR_TOKEN;
         }
+        ptr = span_class(ptr, end, CC_DIGIT);
     }
-    else
-        unget_char(ch);
+    move_cursor(ptr);
 
+    // the text was checked above, so this always converts
+    parse_float_number(start, ptr - start, &scn->number.fnum);
     return FNUM_TOKEN;
 }
 
 /**
     @brief A digit has been seen.
     This is the entry to find out what kind of number is being read and then
-    return the associated token. The token string is in the string buffer when
-    this finishes. Supported types of numbers are integer, hex, float and
-    octal.
+    return the associated token. The number is read straight from the input
+    buffer and converted as it is scanned, so the value of decimal, hex and
+    float numbers is in scn->number when this finishes. Supported types of
+    numbers are integer, hex, float and octal.
 
     @return TokenType
 **/
 static TokenType read_number_top() {
 
-    int ch = get_char();
-
-    // first char is always a digit
-    if(ch == '0') { // could be hex, octal, decimal, or float
-        add_char_buffer(scanner_buffer, ch);
-        ch = get_char();
-        if(ch == 'x' || ch == 'X') {
-            add_char_buffer(scanner_buffer, ch);
-            return read_hex_number();
-        }
-        else if(ch == '.') {
-            add_char_buffer(scanner_buffer, ch);
-            return read_float_number();
-        }
-        else if(isdigit(ch)) { // is an octal number
-            if(ch <= '7') {
-                add_char_buffer(scanner_buffer, ch);
-                return read_octal_number();
-            }
-            else {
-                // it's a malformed number. eat the rest of it and post an error
-                while(isdigit(ch = get_char()))
-                    add_char_buffer(scanner_buffer, ch);
-                unget_char(ch);
-                syntax("malformed octal number: %s", get_char_buffer(scanner_buffer));
-                return ERROR_TOKEN;
-            }
-        }
-        else { // it's just a zero
-            unget_char(ch);
-            return INUM_TOKEN;
-        }
+    const char* start = scn->top->crnt;
+    const char* end = scn->top->end;
+    const char* ptr = start + 1;    // first char is always a digit
+
+    if(*start == '0') { // could be hex, octal, decimal, or float
+        if(ptr < end && (*ptr == 'x' || *ptr == 'X'))
+            return read_hex_number(start);
+        else if(ptr < end && *ptr == '.')
+            return read_float_number(start, ptr + 1);
+        else if(ptr < end && CHAR_IS(*ptr, CC_DIGIT))
+            return read_octal_number(start);
+
+        // it's just a zero
+        move_cursor(ptr);
+        scn->number.inum = 0;
+        return INUM_TOKEN;
     }
-    else { // It's either a dec or a float.
-        int finished = 0;
-        add_char_buffer(scanner_buffer, ch);
-        while(!finished) {
-            ch = get_char();
-            if(isdigit(ch))
-                add_char_buffer(scanner_buffer, ch);
-            else if(ch == '.') {
-                add_char_buffer(scanner_buffer, ch);
-                return read_float_number();
-            }
-            else {
-                finished++;
-                unget_char(ch);
-                return INUM_TOKEN;
-            }
-        }
+
+    // It's either a dec or a float.
+    ptr = span_class(ptr, end, CC_DIGIT);
+    if(ptr < end && *ptr == '.')
+        return read_float_number(start, ptr + 1);
+
+    move_cursor(ptr);
+    uint64_t num;
+    if(!parse_decimal_digits(start, ptr - start, &num) || num > (uint64_t)INT64_MAX + 1) {
+        // as for a hex number, the error is posted here and the token is
+        // still a number
+        syntax("signed number is too large: %.*s", (int)(ptr - start), start);
+        num = 0;
     }
-    // If we reach here, then some syntax that is not covered has been submitted
-    return ERROR_TOKEN;
+
+    // 2^63 only fits after a minus sign. It reads as INT64_MIN, which no
+    // other literal can be, and the parser decides whether it is allowed.
+    scn->number.unum = num;
+    return INUM_TOKEN;
 }
 
 /**
@@ -441,7 +464,7 @@ static void get_hex_escape() {
     memset(tbuf, 0, sizeof(tbuf));
     for(idx = 0; idx < (int)sizeof(tbuf); idx++) {
         ch = get_char();
-        if(isxdigit(ch))
+        if(CHAR_IS(ch, CC_HEX))
             tbuf[idx] = ch;
         else
             break;
@@ -453,7 +476,7 @@ static void get_hex_escape() {
     }
     else {
         int val = (int)strtol(tbuf, NULL, 16);
-        add_char_buffer_int(scanner_buffer, val);
+        add_char_buffer_int(scn->buffer, val);
     }
 }
 
@@ -483,7 +506,7 @@ static void get_octal_escape() {
     }
     else {
         int val = (int)strtol(tbuf, NULL, 8);
-        add_char_buffer(scanner_buffer, val);
+        add_char_buffer(scn->buffer, val);
     }
 }
 
@@ -507,7 +530,7 @@ static void get_decimal_escape() {
 
     for(; idx < (int)sizeof(tbuf); idx++) {
         ch = get_char();
-        if(isdigit(ch))
+        if(CHAR_IS(ch, CC_DIGIT))
             tbuf[idx] = ch;
         else
             break;
@@ -519,7 +542,7 @@ static void get_decimal_escape() {
     }
     else {
         int val = (int)strtol(tbuf, NULL, 10);
-        add_char_buffer_int(scanner_buffer, val);
+        add_char_buffer_int(scn->buffer, val);
     }
 }
 
@@ -532,22 +555,23 @@ static void get_decimal_escape() {
 static void get_string_esc() {
 
     int ch = get_char();
+    scn->str_escaped = true;
     switch(ch) {
         case 'x':
         case 'X': get_hex_escape(); break;
         case 'd':
         case 'D': get_decimal_escape(); break;
         case '0': get_octal_escape(); break;
-        case 'n': add_char_buffer(scanner_buffer, '\n'); break;
-        case 'r': add_char_buffer(scanner_buffer, '\r'); break;
-        case 't': add_char_buffer(scanner_buffer, '\t'); break;
-        case 'b': add_char_buffer(scanner_buffer, '\b'); break;
-        case 'f': add_char_buffer(scanner_buffer, '\f'); break;
-        case 'v': add_char_buffer(scanner_buffer, '\v'); break;
-        case '\\': add_char_buffer(scanner_buffer, '\\'); break;
-        case '\"': add_char_buffer(scanner_buffer, '\"'); break;
-        case '\'': add_char_buffer(scanner_buffer, '\''); break;
-        default: add_char_buffer(scanner_buffer, ch); break;
+        case 'n': add_char_buffer(scn->buffer, '\n'); break;
+        case 'r': add_char_buffer(scn->buffer, '\r'); break;
+        case 't': add_char_buffer(scn->buffer, '\t'); break;
+        case 'b': add_char_buffer(scn->buffer, '\b'); break;
+        case 'f': add_char_buffer(scn->buffer, '\f'); break;
+        case 'v': add_char_buffer(scn->buffer, '\v'); break;
+        case '\\': add_char_buffer(scn->buffer, '\\'); break;
+        case '\"': add_char_buffer(scn->buffer, '\"'); break;
+        case '\'': add_char_buffer(scn->buffer, '\''); break;
+        default: add_char_buffer(scn->buffer, ch); break;
     }
 }
 
@@ -582,7 +606,7 @@ static TokenType read_dquote() {
                 return ERROR_TOKEN;
                 break;
             default:
-                add_char_buffer(scanner_buffer, ch);
+                add_char_buffer(scn->buffer, ch);
                 break;
         }
     }
@@ -617,7 +641,7 @@ static TokenType read_squote() {
                 return ERROR_TOKEN;
                 break;
             default:
-                add_char_buffer(scanner_buffer, ch);
+                add_char_buffer(scn->buffer, ch);
                 break;
         }
     }
@@ -629,162 +653,138 @@ static TokenType read_squote() {
     @brief Convert the given keyword string to a token.
     If it is not a keyword, then SYMBOL_TOKEN is returned. Note that this does
     not convert non-keywords to a token. Non-keywords cause SYMBOL_TOKEN to be
-    returned as well.
+    returned as well. A word that is not a keyword is rejected after one hash.
 
     @param str
+    @param len
     @return TokenType
 **/
-static TokenType str_to_token(const char* str) {
-
-    // simple binary search
-    TokenType retv = SYMBOL_TOKEN;
-    int start = 0, end = token_map_size - 1;
-    int mid = (start + end) / 2;
-
-    while(start <= end) {
-        int spot = strcmp(str, token_map[mid].str);
-        if(spot > 0)
-            start = mid + 1;
-        else if(spot < 0)
-            end = mid - 1;
-        else {
-            retv = token_map[mid].tok;
-            break;
-        }
+static TokenType str_to_token(const char* str, size_t len) {
 
-        mid = (start + end) / 2;
-    }
+    if(len < KEYWORD_MIN_LEN || len > KEYWORD_MAX_LEN)
+        return SYMBOL_TOKEN;
 
-    return retv;
+    const token_map_t* kw = &keyword_table[keyword_hash(str, len) & (KEYWORD_SLOTS - 1)];
+    if(kw->len == len && !memcmp(str, kw->str, len))
+        return kw->tok;
+
+    return SYMBOL_TOKEN;
 }
 
 /**
-    @brief Read a word from the input and then find out if it's a keyword.
+    @brief Read a word from the input. If it can be a keyword, then find out
+    if it is one.
 
+    @param keyword -- false if the word cannot be a keyword
     @return TokenType
 **/
-static TokenType read_word() {
+static TokenType read_word(bool keyword) {
 
-    int c;
-    int finished = 0;
-
-    while(!finished) {
-        c = get_char();
-        if(isalnum(c) || c == '_')
-            add_char_buffer(scanner_buffer, c);
-        else {
-            finished++;
-        }
-    }
-    unget_char(c);
-    const char* find = get_char_buffer(scanner_buffer);
+    // the word is the token's view of the source, so it is not copied
+    const char* start = scn->top->crnt;
+    move_cursor(span_ident(start, scn->top->end));
+    if(!keyword)
+        return SYMBOL_TOKEN;
 
-    return str_to_token(find);
+    return str_to_token(start, scn->top->crnt - start);
 }
 
 /**
     @brief Read a punctuation character from input stream.
-    When this is entered, a punctuation character has been read. If it's a (_)
-    then we have a symbol, otherwise, it's an operator.
+    When this is entered, a character with the CC_OPSTART class has been
+    read.
 
     @param ch
     @return TokenType
 **/
 static TokenType read_punct(int ch) {
 
-    if(ch == '_') {
-        unget_char('_');
-        // wasteful binary search for something that is certinly a symbol
-        return read_word();
-    }
-    else {
-        switch(ch) {
-            // single character operators
-            case '*': return MUL_TOKEN; break;
-            case '%': return MOD_TOKEN; break;
-            case ',': return COMMA_TOKEN; break;
-            case ';': return SEMIC_TOKEN; break;
-            case ':': return COLON_TOKEN; break;
-            case '[': return OSQU_TOKEN; break;
-            case ']': return CSQU_TOKEN; break;
-            case '{': return OCUR_TOKEN; break;
-            case '}': return CCUR_TOKEN; break;
-            case '(': return OPAR_TOKEN; break;
-            case ')': return CPAR_TOKEN; break;
-            case '.': return DOT_TOKEN; break;
-            case '|': return OR_TOKEN; break; // comparison
-            case '&': return AND_TOKEN; break; // comparison
-
-            // could be single or double
-            case '=': {
-                int c = get_char();
-                if(c == '=')
-                    return EQUALITY_TOKEN;
-                else {
-                    unget_char(c);
-                    return EQU_TOKEN;
-                }
-            }
-                    break;
-            case '<': {
-                int c = get_char();
-                if(c == '=')
-                    return LTE_TOKEN;
-                else if(c == '>')
-                    return NEQ_TOKEN;
-                else {
-                    unget_char(c);
-                    return LT_TOKEN;
-                }
+    switch(ch) {
+        // single character operators
+        case '*': return MUL_TOKEN; break;
+        case '%': return MOD_TOKEN; break;
+        case ',': return COMMA_TOKEN; break;
+        case ';': return SEMIC_TOKEN; break;
+        case ':': return COLON_TOKEN; break;
+        case '[': return OSQU_TOKEN; break;
+        case ']': return CSQU_TOKEN; break;
+        case '{': return OCUR_TOKEN; break;
+        case '}': return CCUR_TOKEN; break;
+        case '(': return OPAR_TOKEN; break;
+        case ')': return CPAR_TOKEN; break;
+        case '.': return DOT_TOKEN; break;
+        case '|': return OR_TOKEN; break; // comparison
+        case '&': return AND_TOKEN; break; // comparison
+
+        // could be single or double
+        case '=': {
+            int c = get_char();
+            if(c == '=')
+                return EQUALITY_TOKEN;
+            else {
+                unget_char(c);
+                return EQU_TOKEN;
             }
-                    break;
-            case '>': {
-                int c = get_char();
-                if(c == '=')
-                    return GTE_TOKEN;
-                else {
-                    unget_char(c);
-                    return GT_TOKEN;
-                }
+        }
+                break;
+        case '<': {
+            int c = get_char();
+            if(c == '=')
+                return LTE_TOKEN;
+            else if(c == '>')
+                return NEQ_TOKEN;
+            else {
+                unget_char(c);
+                return LT_TOKEN;
             }
-                    break;
-            case '-': {
-                int c = get_char();
-                if(c == '-')
-                    return DEC_TOKEN;
-                else {
-                    unget_char(c);
-                    return SUB_TOKEN;
-                }
+        }
+                break;
+        case '>': {
+            int c = get_char();
+            if(c == '=')
+                return GTE_TOKEN;
+            else {
+                unget_char(c);
+                return GT_TOKEN;
             }
-                    break;
-            case '+': {
-                int c = get_char();
-                if(c == '+')
-                    return INC_TOKEN;
-                else {
-                    unget_char(c);
-                    return ADD_TOKEN;
-                }
+        }
+                break;
+        case '-': {
+            int c = get_char();
+            if(c == '-')
+                return DEC_TOKEN;
+            else {
+                unget_char(c);
+                return SUB_TOKEN;
             }
-                    break;
-            case '!': {
-                int c = get_char();
-                if(c == '=')
-                    return NEQ_TOKEN;
-                else {
-                    unget_char(c);
-                    return NOT_TOKEN;
-                }
+        }
+                break;
+        case '+': {
+            int c = get_char();
+            if(c == '+')
+                return INC_TOKEN;
+            else {
+                unget_char(c);
+                return ADD_TOKEN;
             }
-                    break;
-
-                    // these are not recognized
-            default:
-                warning("unrecognized character in input: '%c' (0x%02X). Ignored.", ch, ch);
-                return NONE_TOKEN;
+        }
                 break;
+        case '!': {
+            int c = get_char();
+            if(c == '=')
+                return NEQ_TOKEN;
+            else {
+                unget_char(c);
+                return NOT_TOKEN;
+            }
         }
+                break;
+
+                // these are not recognized
+        default:
+            warning("unrecognized character in input: '%c' (0x%02X). Ignored.", ch, ch);
+            return NONE_TOKEN;
+            break;
     }
     return ERROR_TOKEN; // should never happen
 }
@@ -822,11 +822,8 @@ static TokenType comment_or_operator() {
 // Called by atexit()
 void destroy_scanner() {
 
-    log_trace("enter top = %p", top);
-    destroy_char_buffer(scanner_buffer);
-    while(top != NULL)
-        close_input_file();
-    log_trace("leave top = %p", top);
+    free_scanner(scn);
+    scn = NULL;
 }
 
 /**************************************
@@ -838,11 +835,14 @@ void destroy_scanner() {
 
     @return Token*
 **/
-Token* create_token(TokenType type, const char* str) {
+Token* create_token(TokenType type, const char* str, size_t len) {
 
-    Token* tok = ALLOC_DS(Token);
+    Token* tok = ARENA_DS(ARENA_LINE, Token);
     tok->type = type;
-    tok->str = STRDUP(str);
+    tok->str = str;
+    tok->len = len;
+    tok->num.unum = 0;
+    tok->owned = false;
     tok->line_no = get_line_no();
     tok->column_no = get_column_no();
 
@@ -856,8 +856,9 @@ Token* create_token(TokenType type, const char* str) {
 void free_token(Token* tok) {
 
     if(tok != NULL) {
-        FREE(tok->str);
-        FREE(tok);
+        if(tok->owned)
+            ARENA_FREE(tok->str);
+        ARENA_FREE(tok);
     }
 }
 
@@ -874,34 +875,85 @@ const char* token_to_str(TokenType tok) {
 }
 
 /**
-    @brief Create the scanner.
+    @brief Create a scanner context with no input open.
+
+    @return scanner_t*
+**/
+scanner_t* create_scanner() {
+
+    scanner_t* ctx = ALLOC_DS(scanner_t);
+    ctx->buffer = create_char_buffer();
+    ctx->batch_line = ctx->batch_col = -1;
+    return ctx;
+}
+
+/**
+    @brief Close any input that is still open in the scanner context and free
+    it.
+
+    @param ctx
+**/
+void free_scanner(scanner_t* ctx) {
+
+    if(ctx != NULL) {
+        scanner_t* save = set_scanner(ctx);
+        log_trace("enter top = %p", scn->top);
+        while(scn->top != NULL)
+            close_input_file();
+        log_trace("leave top = %p", scn->top);
+        destroy_char_buffer(ctx->buffer);
+        set_scanner((save != ctx)? save: NULL);
+        FREE(ctx);
+    }
+}
+
+/**
+    @brief Make the context the one that the scanner functions in this thread
+    work on.
+
+    @param ctx
+    @return scanner_t* -- the context that was in use before
+**/
+scanner_t* set_scanner(scanner_t* ctx) {
+
+    scanner_t* prev = scn;
+    scn = ctx;
+    return prev;
+}
+
+/**
+    @brief Create the scanner for the main thread.
     This must be called before any other scanner function.
 
 **/
 void init_scanner() {
 
-    scanner_buffer = create_char_buffer();
+    set_scanner(create_scanner());
     //atexit(destroy_scanner);
 }
 
 /**
-    @brief Read text from the input stream and return a token.
+    @brief Read text from the input stream into the token.
 
-    @return TokenType
+    @param token
 **/
-Token* get_tok() {
+static void scan_token(Token* token) {
 
     int ch, finished = 0;
     TokenType tok = NONE_TOKEN;
+    const char* start = NULL;
 
     skip_ws();
-    init_char_buffer(scanner_buffer);
+    init_char_buffer(scn->buffer);
+    scn->str_escaped = false;
+    scn->number.unum = 0;
 
     while(!finished) {
+        start = input_cursor();
         ch = get_char();
         switch(ch) {
             case END_FILE:
-                file_flag++;
+                scn->file_flag++;
                 tok = END_OF_FILE;
                 finished++;
                 break;
@@ -927,19 +979,20 @@ Token* get_tok() {
             default:
                 if(ch == END_FILE)
                     unget_char(ch);
-                else if(isdigit(ch)) { // beginning of a number. Could be hex, dec, or float
+                else if(CHAR_IS(ch, CC_DIGIT)) { // beginning of a number. Could be hex, dec, or float
                     unget_char(ch);
                     tok = read_number_top();
                     if(tok != NONE_TOKEN)
                         finished++;
                 }
-                else if(isalpha(ch)) { // could be a symbol or a keyword
+                else if(CHAR_IS(ch, CC_IDSTART)) { // could be a symbol or a keyword
                     unget_char(ch);
-                    tok = read_word();
+                    // no keyword starts with a '_'
+                    tok = read_word(ch != '_');
                     if(tok != NONE_TOKEN)
                         finished++;
                 }
-                else if(ispunct(ch)) { // some kind of operator (but not a '/' or a quote)
+                else if(CHAR_IS(ch, CC_OPSTART)) { // some kind of operator (but not a '/' or a quote)
                     tok = read_punct(ch);
                     if(tok != NONE_TOKEN)
                         finished++;
@@ -949,7 +1002,150 @@ Token* get_tok() {
                 }
         }
     }
-    return create_token(tok, get_char_buffer(scanner_buffer));
+    // tokens never span files, so the cursor is still in the same buffer
+    size_t len = (start != NULL && scn->top != NULL)? (size_t)(scn->top->crnt - start): 0;
+
+    token->type = tok;
+    token->str = start;
+    token->len = len;
+    token->num = scn->number;
+    token->owned = false;
+    token->line_no = get_line_no();
+    token->column_no = get_column_no();
+
+    if(tok == QSTRG_TOKEN) {
+        if(!scn->str_escaped) {
+            // the view leaves out the quotes
+            token->str = start + 1;
+            token->len = len - 2;
+        }
+        else {
+            // strings with escapes are the only tokens that need their own copy
+            token->str = ARENA_STRDUP(ARENA_LINE, get_char_buffer(scn->buffer));
+            token->len = strlen(token->str);
+            token->owned = true;
+        }
+    }
+}
+
+/**
+    @brief Read text from the input stream and return a token.
+
+    @return Token*
+**/
+Token* get_tok() {
+
+    Token* token = ARENA_DS(ARENA_LINE, Token);
+    scan_token(token);
+    return token;
+}
+
+/**
+    @brief Scan everything that is left in the input, up to and including the
+    END_OF_INPUT token, into a token buffer. The buffer keeps each field of the
+    tokens in its own array, so the parser walks them with an index.
+
+    @return token_buffer_t*
+**/
+token_buffer_t* scan_tokens() {
+
+    token_buffer_t* buf = ALLOC_DS(token_buffer_t);
+    buf->owned = create_ptr_list();
+    buf->closed = create_ptr_list();
+    scn->batch_tokens = buf;
+    Token token;
+
+    do {
+        scan_token(&token);
+
+        if(buf->count == buf->capacity) {
+            buf->capacity = (buf->capacity == 0)? 0x01 << 8: buf->capacity << 1;
+            buf->types = REALLOC(buf->types, buf->capacity * sizeof(TokenType));
+            buf->strs = REALLOC(buf->strs, buf->capacity * sizeof(const char*));
+            buf->lens = REALLOC(buf->lens, buf->capacity * sizeof(size_t));
+            buf->nums = REALLOC(buf->nums, buf->capacity * sizeof(token_num_t));
+            buf->fnames = REALLOC(buf->fnames, buf->capacity * sizeof(const char*));
+            buf->lines = REALLOC(buf->lines, buf->capacity * sizeof(int));
+            buf->columns = REALLOC(buf->columns, buf->capacity * sizeof(int));
+        }
+
+        // names are copied because the file is closed before parsing
+        const char* fname = get_file_name();
+        if(buf->count == 0 || strcmp(buf->fnames[buf->count - 1], fname)) {
+            fname = ARENA_STRDUP(ARENA_LINE, fname);
+            append_ptr_list(buf->owned, (void*)fname);
+        }
+        else
+            fname = buf->fnames[buf->count - 1];
+
+        buf->types[buf->count] = token.type;
+        buf->fnames[buf->count] = fname;
+        buf->strs[buf->count] = token.str;
+        buf->lens[buf->count] = token.len;
+        buf->nums[buf->count] = token.num;
+        buf->lines[buf->count] = token.line_no;
+        buf->columns[buf->count] = token.column_no;
+        buf->count++;
+
+        if(token.owned)
+            append_ptr_list(buf->owned, (void*)token.str);
+    } while(token.type != END_OF_INPUT);
+
+    scn->batch_tokens = NULL;
+    return buf;
+}
+
+/**
+    @brief Copy the token at the index into the Token. The last token in the
+    buffer is END_OF_INPUT, and it is returned for any index past the end.
+    The input is closed by then, so the location of the token becomes what
+    get_file_name(), get_line_no() and get_column_no() report.
+
+    @param buf
+    @param index
+    @param token
+**/
+void load_token(token_buffer_t* buf, size_t index, Token* token) {
+
+    if(index >= buf->count)
+        index = buf->count - 1;
+
+    token->type = buf->types[index];
+    token->str = buf->strs[index];
+    token->len = buf->lens[index];
+    token->num = buf->nums[index];
+    token->owned = false;   // the buffer owns it
+    token->line_no = buf->lines[index];
+    token->column_no = buf->columns[index];
+
+    scn->batch_fname = buf->fnames[index];
+    scn->batch_line = token->line_no;
+    scn->batch_col = token->column_no;
+}
+
+void free_token_buffer(token_buffer_t* buf) {
+
+    if(buf != NULL) {
+        for(int i = 0; i < buf->owned->nitems; i++)
+            ARENA_FREE(buf->owned->buffer[i]);
+        destroy_ptr_list(buf->owned);
+
+        for(int i = 0; i < buf->closed->nitems; i++)
+            release_input(buf->closed->buffer[i]);
+        destroy_ptr_list(buf->closed);
+
+        FREE(buf->types);
+        FREE(buf->strs);
+        FREE(buf->lens);
+        FREE(buf->nums);
+        FREE(buf->fnames);
+        FREE(buf->lines);
+        FREE(buf->columns);
+        FREE(buf);
+    }
+
+    scn->batch_fname = NULL;
+    scn->batch_line = scn->batch_col = -1;
 }
 
 /**
@@ -981,7 +1177,7 @@ Token* expect_tok_array(TokenType* arr) {
         fprintf(fp, " ");
     }
     fprintf(fp, "but got a %s.\n", token_to_str(token->type));
-    return create_token(ERROR_TOKEN, "error");
+    return create_token(ERROR_TOKEN, "error", 5);
 }
 
 /**
@@ -996,7 +1192,7 @@ Token* expect_tok(TokenType tok) {
     Token* token = get_tok();
     if(token->type != tok) {
         syntax("expected a %s but got a %s.", token_to_str(tok), token_to_str(token->type));
-        return create_token(ERROR_TOKEN, "error");
+        return create_token(ERROR_TOKEN, "error", 5);
     }
     else
         return token;
@@ -1016,44 +1212,74 @@ Token* expect_tok(TokenType tok) {
 **/
 void open_scanner_file(const char* fname) {
 
-    nest_depth++;
-    if(nest_depth > MAX_FILE_NESTING) {
+    scn->nest_depth++;
+    if(scn->nest_depth > MAX_FILE_NESTING) {
         fatal_error("Maximum file nesting depth exceeded.");
         exit(1);
     }
 
-    FILE* fp = fopen(fname, "r");
-    if(fp == NULL) {
+    int fd = open(fname, O_RDONLY);
+    if(fd < 0) {
         fatal_error("Cannot open input file: \"%s\": %s", fname, strerror(errno));
     }
 
     file_stack_t* fstk = ALLOC_DS(file_stack_t);
     fstk->fname = STRDUP(fname);
-    fstk->input.fp = fp;
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if(map != MAP_FAILED) {
+        fstk->kind = INPUT_MAPPED;
+        fstk->buffer = map;
+        fstk->end = fstk->buffer + st.st_size;
+    }
+    else {
+        // not a regular file, or it is empty. Read what there is.
+        size_t size = 0, cap = 0x01 << 12;
+        char* buf = MALLOC(cap);
+        ssize_t len;
+        while((len = read(fd, buf + size, cap - size)) > 0) {
+            size += len;
+            if(size == cap) {
+                cap <<= 1;
+                buf = REALLOC(buf, cap);
+            }
+        }
+        if(len < 0)
+            fatal_error("Cannot read input file: \"%s\": %s", fname, strerror(errno));
+
+        fstk->kind = INPUT_READ;
+        fstk->buffer = buf;
+        fstk->end = buf + size;
+    }
+    close(fd);
+
+    fstk->crnt = fstk->buffer;
     fstk->line_no = 1;
     fstk->col_no = 1;
 
-    if(top != NULL)
-        fstk->next = top;
-    top = fstk;
+    if(scn->top != NULL)
+        fstk->next = scn->top;
+    scn->top = fstk;
 }
 
 void open_scanner_string(const char* str) {
 
-    FILE* fp = fmemopen((void*)str, strlen(str), "r");
-    if(fp == NULL) {
-        fatal_error("Cannot open input stream: \"%s\": %s", "REPL", strerror(errno));
-    }
-
     file_stack_t* fstk = ALLOC_DS(file_stack_t);
     fstk->fname = STRDUP("REPL");
-    fstk->input.fp = fp;
+    fstk->kind = INPUT_STRING;
+    fstk->buffer = str;
+    fstk->end = str + strlen(str);
+    fstk->crnt = str;
     fstk->line_no = 1;
     fstk->col_no = 1;
 
-    if(top != NULL)
-        fstk->next = top;
-    top = fstk;
+    if(scn->top != NULL)
+        fstk->next = scn->top;
+    scn->top = fstk;
 }
 
 /*
@@ -1069,8 +1295,10 @@ void open_scanner_string(const char* str) {
 **/
 const char* get_file_name() {
 
-    if(top != NULL)
-        return top->fname;
+    if(scn->top != NULL)
+        return scn->top->fname;
+    else if(scn->batch_fname != NULL)
+        return scn->batch_fname;
     else
         return "no open file";
 }
@@ -1083,10 +1311,10 @@ const char* get_file_name() {
 **/
 int get_line_no() {
 
-    if(top != NULL)
-        return top->line_no;
+    if(scn->top != NULL)
+        return scn->top->line_no;
     else
-        return -1;
+        return scn->batch_line;
 }
 
 /**
@@ -1097,10 +1325,10 @@ int get_line_no() {
 **/
 int get_column_no() {
 
-    if(top != NULL)
-        return top->col_no;
+    if(scn->top != NULL)
+        return scn->top->col_no;
     else
-        return -1;
+        return scn->batch_col;
 }
 
 #if 0
@@ -1110,6 +1338,6 @@ int get_column_no() {
     @return const char*
 **/
 const char* get_tok_str() {
-    return get_char_buffer(scanner_buffer);
+    return get_char_buffer(scn->buffer);
 }
 #endif
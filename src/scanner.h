@@ -164,21 +164,62 @@ typedef enum {
 
 //#include <stdint.h>
 
+/*
+ * The value of a number token. The scanner converts numbers as it reads
+ * them, so the parser does not have to convert the text again.
+ */
+typedef union {
+    int64_t inum;
+    uint64_t unum;
+    double fnum;
+} token_num_t;
+
 typedef struct {
     TokenType type;
-    const char* str;
+    const char* str;    // view into the source. Not terminated, see len.
+    size_t len;
+    token_num_t num;    // value of a UNUM, INUM or FNUM token
+    bool owned;         // str was materialized for this token
     int line_no;
     int column_no;
 } Token;
 
+/*
+ * A whole input that was scanned at once. Each field of the tokens is kept
+ * in its own array. The strs are views like Token.str, so the files that
+ * were closed while scanning are kept in closed until the buffer is freed.
+ * The strings that had to be materialized are kept in owned.
+ */
+typedef struct {
+    TokenType* types;
+    const char** strs;
+    size_t* lens;
+    token_num_t* nums;
+    const char** fnames;
+    int* lines;
+    int* columns;
+    size_t count;
+    size_t capacity;
+    ptr_list_t* owned;
+    ptr_list_t* closed;
+} token_buffer_t;
+
 #define MAX_FILE_NESTING    (15)
 
+typedef struct _scanner_t scanner_t;
+
 // interface prototypes
 void init_scanner();
 void destroy_scanner();
-Token* create_token(TokenType, const char*);
+Token* create_token(TokenType, const char*, size_t);
 void free_token(Token*);
+scanner_t* create_scanner();
+void free_scanner(scanner_t*);
+scanner_t* set_scanner(scanner_t*);
 Token* get_tok();
+token_buffer_t* scan_tokens();
+void load_token(token_buffer_t*, size_t, Token*);
+void free_token_buffer(token_buffer_t*);
 Token* expect_tok_array(TokenType*);
 Token* expect_tok(TokenType);
 void open_scanner_file(const char*);
@@ -82,3 +82,13 @@ uint16_t get_u16_list_by_index(u16_list_t* list, int index)
     return list->buffer[list->nitems-1];  // last item
 }
 
+/**
+ * Drop the items at the end of the list so that only the first size items
+ * remain. The capacity is not changed. If the list is already smaller, then
+ * nothing happens.
+ */
+void truncate_u16_list(u16_list_t* list, size_t size)
+{
+    if(size < list->nitems)
+        list->nitems = size;
+}
@@ -19,5 +19,6 @@ u16_list_t* create_u16_list(void);
 void destroy_u16_list(u16_list_t* array);
 void append_u16_list(u16_list_t* array, uint16_t item);
 uint16_t get_u16_list_by_index(u16_list_t* array, int index);
+void truncate_u16_list(u16_list_t* array, size_t size);
 
 #endif
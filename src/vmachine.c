@@ -4,41 +4,86 @@
     @brief
 
 **/
+// clock_gettime() is POSIX, and --std=c99 hides it.
+#define _POSIX_C_SOURCE 200809L
 #include <math.h>
+#include <time.h>
 
 #include "common.h"
 
-VMachine* vm;
+static inline void create_value_stack(VMachine* vm) {
+    vm->vstack.top = vm->vstack.items;
+}
+
+static inline void push_value_stack(VMachine* vm, Value val) {
+    if(vm->vstack.top >= &vm->vstack.items[VALUE_STACK_MAX])
+        runtime_error("value stack overflow");
+    *vm->vstack.top++ = val;
+}
+
+static inline Value pop_value_stack(VMachine* vm) {
+    if(vm->vstack.top <= vm->vstack.items)
+        runtime_error("value stack underflow");
+    return *(--vm->vstack.top);
+}
 
-static inline void create_value_stack() {
-    vm->vstack = (valueStack*)create_ptr_list();
+static inline Value* top_value_stack(VMachine* vm) {
+    if(vm->vstack.top <= vm->vstack.items)
+        runtime_error("value stack underflow");
+    return vm->vstack.top - 1;
 }
 
-static inline void free_value_stack() {
-    destroy_ptr_list(vm->vstack);
+static inline Value* raw_value_stack(VMachine* vm) {
+    return vm->vstack.items;
 }
 
-static inline void push_value_stack(Value* val) {
-    push_ptr_list(vm->vstack, val);
+static inline size_t value_stack_size(VMachine* vm) {
+    return (size_t)(vm->vstack.top - vm->vstack.items);
 }
 
-static inline Value* pop_value_stack() {
-    return (Value*)pop_ptr_list(vm->vstack);
+Value* peek_value_stack(VMachine* vm) {
+    if(vm->vstack.top > vm->vstack.items)
+        return vm->vstack.top - 1;
+    else
+        return NULL;
 }
 
-static inline Value** raw_value_stack() {
-    return (Value**)(vm->vstack->buffer);
+/**
+    @brief Objects that are created while the code runs, such as the result of
+    a string concatenation, are not owned by the constant pool. They are kept
+    here until the machine is reset.
+
+    @param vm
+    @param obj
+**/
+static inline void track_object(VMachine* vm, Obj* obj) {
+    if(obj != NULL)
+        append_ptr_list(vm->objects, obj);
 }
 
-static inline size_t value_stack_size() {
-    return (vm->vstack->nitems);
+static void free_objects(VMachine* vm) {
+
+    Obj** list = (Obj**)vm->objects->buffer;
+    for(int i = 0; i < vm->objects->nitems; i++)
+        free_object(list[i]);
+    vm->objects->nitems = 0;
+    free_wide_numbers(vm->boxes);
 }
 
-Value* peek_value_stack() {
-    return (Value*)peek_ptr_list(vm->vstack);
+/**
+    @brief When an operand was converted to an object for the operation, such
+    as a number that is added to a string, then the converted object belongs
+    to nobody once the operand has been used. Free it.
+
+    @param val
+    @param type
+**/
+static inline void release_operand(Value* val, ValueType type) {
+    if(type != VAL_OBJ && IS_OBJ(val))
+        free_object(AS_OBJ(val));
 }
 
-void destroy_vmachine() {
+void destroy_vmachine(VMachine* vm) {
 
     log_debug("enter");
     if(vm != NULL) {
@@ -47,46 +92,406 @@ void destroy_vmachine() {
             free_codeblock(vm->block);
         }
 
-        if(vm->vstack != NULL) {
-            log_debug("vstack items = %d", vm->vstack->nitems);
-            for(int i = 0; i < vm->vstack->nitems; i++)
-                FREE(vm->vstack->buffer[i]);
-            free_value_stack();
+        if(vm->objects != NULL) {
+            log_debug("objects = %d", vm->objects->nitems);
+            free_objects(vm);
+            destroy_ptr_list(vm->objects);
+            destroy_ptr_list(vm->boxes);
         }
 
+        trace_vmachine(vm, false);
+        count_vmachine_pairs(vm, false);
+        profile_vmachine(vm, 0);
         FREE(vm);
     }
     log_debug("leave");
 }
 
-void init_vmachine() {
+/**
+    @brief Create a machine with an empty code block. Machines share nothing
+    while they run, so each thread can run its own. Only the compiler uses the
+    intern tables for strings and wide numbers, which are locked.
+
+    @return VMachine*
+**/
+VMachine* create_vmachine() {
 
-    vm = ALLOC_DS(VMachine);
+    VMachine* vm = ALLOC_DS(VMachine);
     vm->block = create_codeblock();
+    vm->objects = create_ptr_list();
+    vm->boxes = create_ptr_list();
+    vm->trace = NULL;
+    vm->pairs = NULL;
+    vm->profile = NULL;
     vm->lastIp = 0;
-    create_value_stack();
+    create_value_stack(vm);
 
     //atexit(free_vmachine);
+    return vm;
+}
+
+/**
+    @brief Replace the code block in the machine with one that was compiled
+    separately. The machine owns the block after this, and runs it from the
+    start.
+
+    @param vm
+    @param block
+**/
+void load_vmachine(VMachine* vm, codeBlock* block) {
+
+    if(vm->block != NULL)
+        free_codeblock(vm->block);
+    vm->block = block;
+    vm->lastIp = 0;
+}
+
+/**
+    @brief Turn the instruction trace on or off. Turning it off discards what
+    has been recorded.
+
+    @param vm
+    @param on
+**/
+void trace_vmachine(VMachine* vm, bool on) {
+
+    if(on && vm->trace == NULL) {
+        vm->trace = ALLOC_DS(traceBuffer);
+        vm->trace->count = 0;
+    }
+    else if(!on && vm->trace != NULL) {
+        FREE(vm->trace);
+        vm->trace = NULL;
+    }
+}
+
+static const char* type_name(uint8_t type) {
+
+    switch(type) {
+        case VAL_INUM:      return "int";
+        case VAL_UNUM:      return "uint";
+        case VAL_FNUM:      return "float";
+        case VAL_BOOL:      return "bool";
+        case VAL_NOTHING:   return "nothing";
+        case VAL_OBJ:       return "object";
+        default:            return "-";
+    }
+}
+
+/**
+    @brief Print the recorded instructions, oldest first.
+
+    @param vm
+    @param fp
+**/
+void dump_vmachine_trace(VMachine* vm, FILE* fp) {
+
+    traceBuffer* trace = vm->trace;
+    if(trace == NULL)
+        return;
+
+    size_t first = (trace->count > TRACE_ENTRIES)? trace->count - TRACE_ENTRIES: 0;
+    fprintf(fp, "\ntrace: last %lu of %lu instructions\n", trace->count - first, trace->count);
+    fprintf(fp, "  ip    opcode            depth  top\n");
+    for(size_t i = first; i < trace->count; i++) {
+        traceEntry* ent = &trace->entries[i & (TRACE_ENTRIES - 1)];
+        const char* name = opcode_name(ent->opcode);
+        fprintf(fp, "  %04u  %-16s  %5u  %s\n", ent->ip, (name != NULL)? name: "unknown",
+                ent->depth, type_name(ent->type));
+    }
+}
+
+/**
+    @brief Record an instruction in the trace. Tracing must be on.
+
+    @param vm
+    @param ip
+    @param op
+**/
+static inline void __attribute__((always_inline)) record_trace(VMachine* vm, size_t ip, uint16_t op) {
+
+    traceBuffer* trace = vm->trace;
+    traceEntry* ent = &trace->entries[trace->count++ & (TRACE_ENTRIES - 1)];
+    ent->ip = (uint32_t)ip;
+    ent->opcode = op;
+    ent->depth = (uint16_t)value_stack_size(vm);
+    ent->type = (ent->depth > 0)? (uint8_t)VALUE_TYPE(&vm->vstack.top[-1]): VAL_INVALID;
+}
+
+/**
+    @brief Turn the counting of opcode pairs on or off. Turning it off
+    discards the counts.
+
+    @param vm
+    @param on
+**/
+void count_vmachine_pairs(VMachine* vm, bool on) {
+
+    if(on && vm->pairs == NULL) {
+        vm->pairs = ALLOC_DS(pairCounts);
+        vm->pairs->prev = OP_COUNT;
+    }
+    else if(!on && vm->pairs != NULL) {
+        FREE(vm->pairs);
+        vm->pairs = NULL;
+    }
+}
+
+typedef struct {
+    uint64_t count;
+    uint16_t first;
+    uint16_t second;
+} pairEntry;
+
+static int compare_pairs(const void* p1, const void* p2) {
+
+    const pairEntry* e1 = p1;
+    const pairEntry* e2 = p2;
+    return (e1->count < e2->count) - (e1->count > e2->count);
+}
+
+/*
+ * Make a list of the pairs that ran, most frequent first. The caller frees it.
+ */
+static size_t sorted_pairs(pairCounts* pairs, pairEntry** list) {
+
+    *list = MALLOC(sizeof(pairEntry) * OP_COUNT * OP_COUNT);
+    size_t count = 0;
+    for(int first = 0; first < OP_COUNT; first++)
+        for(int second = 0; second < OP_COUNT; second++)
+            if(pairs->count[first][second] > 0)
+                (*list)[count++] = (pairEntry){pairs->count[first][second], first, second};
+    qsort(*list, count, sizeof(pairEntry), compare_pairs);
+
+    return count;
+}
+
+/**
+    @brief Write the pair counts, most frequent first. This is the profile
+    that --fuse reads, one "count first second" line per pair, with the
+    opcodes by name.
+
+    @param vm
+    @param fp
+**/
+void write_vmachine_pairs(VMachine* vm, FILE* fp) {
+
+    if(vm->pairs == NULL)
+        return;
+
+    pairEntry* list;
+    size_t count = sorted_pairs(vm->pairs, &list);
+
+    fprintf(fp, "# opcode pairs counted with --pairs\n# count first second\n");
+    for(size_t i = 0; i < count; i++)
+        fprintf(fp, "%lu %s %s\n", list[i].count, opcode_name(list[i].first), opcode_name(list[i].second));
+
+    FREE(list);
+}
+
+/**
+    @brief Count the opcode with the one that ran before it. Counting must be
+    on.
+
+    @param vm
+    @param op
+**/
+static inline void __attribute__((always_inline)) record_pair(VMachine* vm, uint16_t op) {
+
+    pairCounts* pairs = vm->pairs;
+    if(pairs->prev < OP_COUNT && op < OP_COUNT)
+        pairs->count[pairs->prev][op]++;
+    pairs->prev = op;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#   define PROFILE_UNIT "cycles"
+#else
+#   define PROFILE_UNIT "ns"
+#endif
+
+#define PROFILE_TOP_PAIRS 10
+
+static inline uint64_t __attribute__((always_inline)) profile_clock() {
+
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/**
+    @brief Turn the profile on, timing one in rate instructions, or off if
+    the rate is 0. Turning it off discards the profile. The pairs are counted
+    along with it.
+
+    @param vm
+    @param rate
+**/
+void profile_vmachine(VMachine* vm, uint32_t rate) {
+
+    if(rate > 0 && vm->profile == NULL) {
+        vm->profile = ALLOC_DS(opProfile);
+        vm->profile->rate = rate;
+        vm->profile->countdown = rate;
+        vm->profile->timing = OP_COUNT;
+        count_vmachine_pairs(vm, true);
+    }
+    else if(rate == 0 && vm->profile != NULL) {
+        FREE(vm->profile);
+        vm->profile = NULL;
+    }
+}
+
+/*
+ * Finish the sample that is running, if there is one.
+ */
+static inline void __attribute__((always_inline)) end_profile_sample(opProfile* prof) {
+
+    if(prof->timing < OP_COUNT) {
+        uint64_t ticks = profile_clock() - prof->start;
+        int bucket = 63 - __builtin_clzll(ticks | 1);
+        prof->samples[prof->timing]++;
+        prof->ticks[prof->timing] += ticks;
+        prof->histogram[prof->timing][MIN(bucket, PROFILE_BUCKETS - 1)]++;
+        prof->timing = OP_COUNT;
+    }
+}
+
+/**
+    @brief Count the opcode and time it if it is its turn. Profiling must be
+    on.
+
+    @param vm
+    @param op
+**/
+static inline void __attribute__((always_inline)) record_profile(VMachine* vm, uint16_t op) {
+
+    opProfile* prof = vm->profile;
+    end_profile_sample(prof);
+    prof->count[op]++;
+    if(--prof->countdown == 0) {
+        prof->countdown = prof->rate;
+        prof->timing = op;
+        prof->start = profile_clock();
+    }
+}
+
+/*
+ * Make a list of the opcodes that ran, most frequent first, with OP_COUNT
+ * as the second of each pair. The caller frees it.
+ */
+static size_t sorted_opcodes(opProfile* prof, pairEntry** list) {
+
+    *list = MALLOC(sizeof(pairEntry) * OP_COUNT);
+    size_t count = 0;
+    for(int op = 0; op < OP_COUNT; op++)
+        if(prof->count[op] > 0)
+            (*list)[count++] = (pairEntry){prof->count[op], op, OP_COUNT};
+    qsort(*list, count, sizeof(pairEntry), compare_pairs);
+
+    return count;
+}
+
+/**
+    @brief Print the profile as a table of the opcodes, most frequent first,
+    and the most frequent pairs. The time for an opcode is estimated from
+    the mean of its samples.
+
+    @param vm
+    @param fp
+**/
+void report_vmachine_profile(VMachine* vm, FILE* fp) {
+
+    opProfile* prof = vm->profile;
+    if(prof == NULL)
+        return;
+
+    uint64_t total = 0;
+    for(int op = 0; op < OP_COUNT; op++)
+        total += prof->count[op];
+
+    fprintf(fp, "    profile: %lu instructions, 1 in %u timed in %s\n",
+            total, prof->rate, PROFILE_UNIT);
+    fprintf(fp, "    %-20s %12s %7s %9s %10s %14s\n",
+            "opcode", "count", "%", "samples", "mean", "est. total");
+
+    pairEntry* list;
+    size_t count = sorted_opcodes(prof, &list);
+    for(size_t i = 0; i < count; i++) {
+        uint16_t op = list[i].first;
+        double mean = (prof->samples[op] > 0)? (double)prof->ticks[op] / prof->samples[op]: 0.0;
+        fprintf(fp, "    %-20s %12lu %6.2f%% %9lu %10.1f %14.0f\n", opcode_name(op),
+                prof->count[op], 100.0 * prof->count[op] / total, prof->samples[op],
+                mean, mean * prof->count[op]);
+    }
+    FREE(list);
+
+    if(vm->pairs != NULL) {
+        count = sorted_pairs(vm->pairs, &list);
+        fprintf(fp, "    %-41s %12s\n", "pair", "count");
+        for(size_t i = 0; i < count && i < PROFILE_TOP_PAIRS; i++)
+            fprintf(fp, "    %-20s %-20s %12lu\n", opcode_name(list[i].first),
+                    opcode_name(list[i].second), list[i].count);
+        FREE(list);
+    }
+}
+
+/**
+    @brief Write the profile as JSON, with the histogram of the samples for
+    each opcode and all of the pairs. Bucket i of a histogram counts the
+    samples that took from 2^i to 2^(i+1) - 1 ticks.
+
+    @param vm
+    @param fp
+**/
+void write_vmachine_profile(VMachine* vm, FILE* fp) {
+
+    opProfile* prof = vm->profile;
+    if(prof == NULL)
+        return;
+
+    fprintf(fp, "{\n  \"unit\": \"%s\",\n  \"rate\": %u,\n  \"opcodes\": [", PROFILE_UNIT, prof->rate);
+
+    pairEntry* list;
+    size_t count = sorted_opcodes(prof, &list);
+    for(size_t i = 0; i < count; i++) {
+        uint16_t op = list[i].first;
+        fprintf(fp, "%s\n    {\"name\": \"%s\", \"count\": %lu, \"samples\": %lu, \"ticks\": %lu, \"histogram\": [",
+                (i > 0)? ",": "", opcode_name(op), prof->count[op], prof->samples[op], prof->ticks[op]);
+        int last = PROFILE_BUCKETS - 1;
+        while(last > 0 && prof->histogram[op][last] == 0)
+            last--;
+        for(int b = 0; b <= last; b++)
+            fprintf(fp, "%s%lu", (b > 0)? ", ": "", prof->histogram[op][b]);
+        fprintf(fp, "]}");
+    }
+    FREE(list);
+    fprintf(fp, "\n  ],\n  \"pairs\": [");
+
+    if(vm->pairs != NULL) {
+        count = sorted_pairs(vm->pairs, &list);
+        for(size_t i = 0; i < count; i++)
+            fprintf(fp, "%s\n    {\"first\": \"%s\", \"second\": \"%s\", \"count\": %lu}",
+                    (i > 0)? ",": "", opcode_name(list[i].first), opcode_name(list[i].second), list[i].count);
+        FREE(list);
+    }
+    fprintf(fp, "\n  ]\n}\n");
 }
 
 /**
     @brief Clear the value stack, but leave the rest of the machine intact.
 
+    @param vm
 **/
-void reset_vmachine() {
+void reset_vmachine(VMachine* vm) {
 
     log_debug("enter");
-    Value* val;
-    if(vm->vstack != NULL) {
-        while(true) {
-            val = pop_value_stack();
-            if(val == NULL)
-                return;
-            else {
-                free_value(val);
-            }
-        }
-    }
+    vm->vstack.top = vm->vstack.items;
+    free_objects(vm);
     log_debug("leave");
 }
 
@@ -95,15 +500,14 @@ static inline ValueType
             conv_value(Value* val, ValueType type) {
 
     ValueType result = VAL_INVALID;
-    ValueType from = val->type;
+    ValueType from = VALUE_TYPE(val);
 
     switch(type) {
         case VAL_INUM:
             result = VAL_INUM;
-            val->type = VAL_INUM;
             switch(from) {
-                case VAL_UNUM: val->as.inum = (int64_t)val->as.unum; break;
-                case VAL_FNUM: val->as.inum = (int64_t)val->as.fnum; break;
+                case VAL_UNUM: *val = INUM_VALUE((int64_t)AS_UNUM(val)); break;
+                case VAL_FNUM: *val = INUM_VALUE((int64_t)AS_FNUM(val)); break;
                 case VAL_OBJ:  conv_obj_to_val(val, VAL_INUM); break;
                 case VAL_BOOL:
                     runtime_error("cannot convert signed int to boolean");
@@ -118,10 +522,9 @@ static inline ValueType
             break;
         case VAL_UNUM:
             result = VAL_UNUM;
-            val->type = VAL_UNUM;
             switch(from) {
-                case VAL_INUM: val->as.unum = (uint64_t)val->as.inum; break;
-                case VAL_FNUM: val->as.unum = (uint64_t)val->as.fnum; break;
+                case VAL_INUM: *val = UNUM_VALUE((uint64_t)AS_INUM(val)); break;
+                case VAL_FNUM: *val = UNUM_VALUE((uint64_t)AS_FNUM(val)); break;
                 case VAL_OBJ:  conv_obj_to_val(val, VAL_UNUM); break;
                 case VAL_BOOL:
                     runtime_error("cannot convert unsigned int to boolean");
@@ -137,14 +540,14 @@ static inline ValueType
         case VAL_FNUM:
             result = VAL_FNUM;
             switch(from) {
-                case VAL_INUM: val->as.fnum = (double)val->as.inum; break;
-                case VAL_UNUM: val->as.fnum = (double)val->as.unum; break;
+                case VAL_INUM: *val = FNUM_VALUE((double)AS_INUM(val)); break;
+                case VAL_UNUM: *val = FNUM_VALUE((double)AS_UNUM(val)); break;
                 case VAL_OBJ:  conv_obj_to_val(val, VAL_FNUM); break;
                 case VAL_BOOL:
                     runtime_error("cannot convert float to boolean");
                     result = VAL_INVALID;
                     break;
-                case VAL_NOTHING:                    break;
+                case VAL_NOTHING:
                     runtime_error("cannot convert float to nothing");
                     result = VAL_INVALID;
                     break;
@@ -154,11 +557,11 @@ static inline ValueType
         case VAL_BOOL:
             result = VAL_BOOL;
             switch(from) {
-                case VAL_INUM: val->as.bval = (val->as.inum == 0); break;
-                case VAL_UNUM: val->as.bval = (val->as.unum == 0); break;
-                case VAL_FNUM: val->as.bval = (val->as.fnum == 0.0); break;
+                case VAL_INUM: *val = BOOL_VALUE(AS_INUM(val) == 0); break;
+                case VAL_UNUM: *val = BOOL_VALUE(AS_UNUM(val) == 0); break;
+                case VAL_FNUM: *val = BOOL_VALUE(AS_FNUM(val) == 0.0); break;
                 case VAL_OBJ:  conv_obj_to_val(val, VAL_BOOL); break;
-                case VAL_NOTHING: val->as.bval = true; break;
+                case VAL_NOTHING: *val = BOOL_VALUE(true); break;
                 default: {} /* do nothing */
             }
             break;
@@ -203,8 +606,8 @@ static ValueType normalize_operands(Value* op1, Value* op2) {
     //     (!value_is_number(op2) && !value_is_bool(op2) && !value_is_object(op2)))
     //     return VAL_INVALID;
 
-    ValueType type1 = op1->type;
-    ValueType type2 = op2->type;
+    ValueType type1 = VALUE_TYPE(op1);
+    ValueType type2 = VALUE_TYPE(op2);
     ValueType result;
 
     switch(type1) {
@@ -259,14 +662,14 @@ static ValueType normalize_operands(Value* op1, Value* op2) {
             break;
         case VAL_UNUM:
             switch(type2) {
-                case VAL_INUM:
                 case VAL_UNUM:
                 case VAL_NOTHING:
-                case VAL_BOOL:
-                    result = conv_value(op1, VAL_UNUM);
+                    result = conv_value(op2, VAL_UNUM);
                     break;
+                case VAL_INUM: result = conv_value(op1, VAL_INUM); break;
+                case VAL_BOOL: result = conv_value(op1, VAL_BOOL); break;
                 case VAL_FNUM:
-                    result = conv_value(op1, VAL_UNUM);
+                    result = conv_value(op1, VAL_FNUM);
                     runtime_warning("converting unsigned to float can produce unexpected results");
                     break;
                 case VAL_OBJ:
@@ -283,10 +686,10 @@ static ValueType normalize_operands(Value* op1, Value* op2) {
                 case VAL_UNUM:
                 case VAL_FNUM:
                 case VAL_NOTHING:
-                    result = conv_value(op1, VAL_FNUM);
+                    result = conv_value(op2, VAL_FNUM);
                     break;
                 case VAL_BOOL:
-                    result = conv_value(op1, VAL_FNUM);
+                    result = conv_value(op1, VAL_BOOL);
                     runtime_warning("converting float to bool can produce unexpected results");
                     break;
                 case VAL_OBJ:
@@ -314,31 +717,43 @@ static ValueType normalize_operands(Value* op1, Value* op2) {
             break;
 
         default:
+            result = VAL_INVALID;
             runtime_error("unknown value type: %d", type1);
     }
     return result;
 }
 
-static inline InterpretResult __attribute__((always_inline)) compare_op(uint16_t op, size_t ip) {
+/**
+    @brief Compare the operands and push the result. The operands have been
+    taken off the stack, or out of the constants for a superinstruction.
+
+    @param vm
+    @param op -- one of the generic comparison opcodes
+    @param op1
+    @param op2
+    @param ip
+    @return InterpretResult
+**/
+static InterpretResult compare_op(VMachine* vm, uint16_t op, Value op1, Value op2, size_t ip) {
 
     log_debug("binary comparison operation start");
 
     InterpretResult result = INTERPRET_OK;
-    Value* op2 = pop_value_stack();
-    Value* op1 = pop_value_stack();
-    ValueType vt = normalize_operands(op1, op2);
+    ValueType type1 = VALUE_TYPE(&op1);
+    ValueType type2 = VALUE_TYPE(&op2);
+    ValueType vt = normalize_operands(&op1, &op2);
     if(vt != VAL_INVALID) {
         log_debug("vt = %d", vt);
-        Value* val = create_value(VAL_BOOL);
+        bool res = false;
         switch(op) {
             case OP_EQUALITY: // strings
                 switch(vt) {
-                    case VAL_OBJ:  val->as.bval = compare_objects(op1, op2, op); break;
-                    case VAL_INUM: val->as.bval = op1->as.inum == op2->as.inum; break;
-                    case VAL_UNUM: val->as.bval = op1->as.unum == op2->as.unum; break;
-                    case VAL_BOOL: val->as.bval = op1->as.bval == op2->as.bval; break;
+                    case VAL_OBJ:  res = compare_objects(&op1, &op2, op); break;
+                    case VAL_INUM: res = AS_INUM(&op1) == AS_INUM(&op2); break;
+                    case VAL_UNUM: res = AS_UNUM(&op1) == AS_UNUM(&op2); break;
+                    case VAL_BOOL: res = AS_BOOL(&op1) == AS_BOOL(&op2); break;
                     case VAL_FNUM:
-                        val->as.bval = op1->as.fnum == op2->as.fnum;
+                        res = AS_FNUM(&op1) == AS_FNUM(&op2);
                         runtime_warning("comparing floats for equality can produce unexpected results");
                         break;
                     default:
@@ -348,12 +763,12 @@ static inline InterpretResult __attribute__((always_inline)) compare_op(uint16_t
                 break;
             case OP_NEQ:
                 switch(vt) {
-                    case VAL_OBJ:  val->as.bval = compare_objects(op1, op2, op); break;
-                    case VAL_INUM: val->as.bval = op1->as.inum != op2->as.inum; break;
-                    case VAL_UNUM: val->as.bval = op1->as.unum != op2->as.unum; break;
-                    case VAL_BOOL: val->as.bval = op1->as.bval != op2->as.bval; break;
+                    case VAL_OBJ:  res = compare_objects(&op1, &op2, op); break;
+                    case VAL_INUM: res = AS_INUM(&op1) != AS_INUM(&op2); break;
+                    case VAL_UNUM: res = AS_UNUM(&op1) != AS_UNUM(&op2); break;
+                    case VAL_BOOL: res = AS_BOOL(&op1) != AS_BOOL(&op2); break;
                     case VAL_FNUM:
-                        val->as.bval = op1->as.fnum != op2->as.fnum;
+                        res = AS_FNUM(&op1) != AS_FNUM(&op2);
                         runtime_warning("comparing floats for equality can produce unexpected results");
                         break;
                     default:
@@ -363,11 +778,11 @@ static inline InterpretResult __attribute__((always_inline)) compare_op(uint16_t
                 break;
             case OP_LT:
                 switch(vt) {
-                    case VAL_OBJ:  val->as.bval = compare_objects(op1, op2, op); break;
-                    case VAL_INUM: val->as.bval = op1->as.inum < op2->as.inum; break;
-                    case VAL_UNUM: val->as.bval = op1->as.unum < op2->as.unum; break;
-                    case VAL_BOOL: val->as.bval = op1->as.bval < op2->as.bval; break;
-                    case VAL_FNUM: val->as.bval = op1->as.fnum < op2->as.fnum; break;
+                    case VAL_OBJ:  res = compare_objects(&op1, &op2, op); break;
+                    case VAL_INUM: res = AS_INUM(&op1) < AS_INUM(&op2); break;
+                    case VAL_UNUM: res = AS_UNUM(&op1) < AS_UNUM(&op2); break;
+                    case VAL_BOOL: res = AS_BOOL(&op1) < AS_BOOL(&op2); break;
+                    case VAL_FNUM: res = AS_FNUM(&op1) < AS_FNUM(&op2); break;
                     default:
                         result = INTERPRET_RUNTIME_ERROR;
                         runtime_error("unknown value type: %d at %d", vt, ip);
@@ -375,11 +790,11 @@ static inline InterpretResult __attribute__((always_inline)) compare_op(uint16_t
                 break;
             case OP_GT:
                 switch(vt) {
-                    case VAL_OBJ:  val->as.bval = compare_objects(op1, op2, op); break;
-                    case VAL_INUM: val->as.bval = op1->as.inum > op2->as.inum; break;
-                    case VAL_UNUM: val->as.bval = op1->as.unum > op2->as.unum; break;
-                    case VAL_BOOL: val->as.bval = op1->as.bval > op2->as.bval; break;
-                    case VAL_FNUM: val->as.bval = op1->as.fnum > op2->as.fnum; break;
+                    case VAL_OBJ:  res = compare_objects(&op1, &op2, op); break;
+                    case VAL_INUM: res = AS_INUM(&op1) > AS_INUM(&op2); break;
+                    case VAL_UNUM: res = AS_UNUM(&op1) > AS_UNUM(&op2); break;
+                    case VAL_BOOL: res = AS_BOOL(&op1) > AS_BOOL(&op2); break;
+                    case VAL_FNUM: res = AS_FNUM(&op1) > AS_FNUM(&op2); break;
                     default:
                         result = INTERPRET_RUNTIME_ERROR;
                         runtime_error("unknown value type: %d at %d", vt, ip);
@@ -387,11 +802,11 @@ static inline InterpretResult __attribute__((always_inline)) compare_op(uint16_t
                 break;
             case OP_LTE:
                 switch(vt) {
-                    case VAL_OBJ:  val->as.bval = compare_objects(op1, op2, op); break;
-                    case VAL_INUM: val->as.bval = op1->as.inum <= op2->as.inum; break;
-                    case VAL_UNUM: val->as.bval = op1->as.unum <= op2->as.unum; break;
-                    case VAL_BOOL: val->as.bval = op1->as.bval <= op2->as.bval; break;
-                    case VAL_FNUM: val->as.bval = op1->as.fnum <= op2->as.fnum; break;
+                    case VAL_OBJ:  res = compare_objects(&op1, &op2, op); break;
+                    case VAL_INUM: res = AS_INUM(&op1) <= AS_INUM(&op2); break;
+                    case VAL_UNUM: res = AS_UNUM(&op1) <= AS_UNUM(&op2); break;
+                    case VAL_BOOL: res = AS_BOOL(&op1) <= AS_BOOL(&op2); break;
+                    case VAL_FNUM: res = AS_FNUM(&op1) <= AS_FNUM(&op2); break;
                     default:
                         result = INTERPRET_RUNTIME_ERROR;
                         runtime_error("unknown value type: %d at %d", vt, ip);
@@ -399,11 +814,11 @@ static inline InterpretResult __attribute__((always_inline)) compare_op(uint16_t
                 break;
             case OP_GTE:
                 switch(vt) {
-                    case VAL_OBJ:  val->as.bval = compare_objects(op1, op2, op); break;
-                    case VAL_INUM: val->as.bval = op1->as.inum >= op2->as.inum; break;
-                    case VAL_UNUM: val->as.bval = op1->as.unum >= op2->as.unum; break;
-                    case VAL_BOOL: val->as.bval = op1->as.bval >= op2->as.bval; break;
-                    case VAL_FNUM: val->as.bval = op1->as.fnum >= op2->as.fnum; break;
+                    case VAL_OBJ:  res = compare_objects(&op1, &op2, op); break;
+                    case VAL_INUM: res = AS_INUM(&op1) >= AS_INUM(&op2); break;
+                    case VAL_UNUM: res = AS_UNUM(&op1) >= AS_UNUM(&op2); break;
+                    case VAL_BOOL: res = AS_BOOL(&op1) >= AS_BOOL(&op2); break;
+                    case VAL_FNUM: res = AS_FNUM(&op1) >= AS_FNUM(&op2); break;
                     default:
                         result = INTERPRET_RUNTIME_ERROR;
                         runtime_error("unknown value type: %d at %d", vt, ip);
@@ -413,7 +828,9 @@ static inline InterpretResult __attribute__((always_inline)) compare_op(uint16_t
                 result = INTERPRET_RUNTIME_ERROR;
                 runtime_error("invalid opcode in compare_op()");
         }
-        push_value_stack(val);
+        release_operand(&op1, type1);
+        release_operand(&op2, type2);
+        push_value_stack(vm, BOOL_VALUE(res));
     }
     else {
         result = INTERPRET_RUNTIME_ERROR;
@@ -424,23 +841,57 @@ static inline InterpretResult __attribute__((always_inline)) compare_op(uint16_t
     return result;
 }
 
-static inline InterpretResult __attribute__((always_inline)) arithmetic_op(uint16_t op, size_t ip) {
+/*
+    INT64_MIN / -1 does not fit, and the CPU traps on it the same as it does
+    on a zero divisor. Unsigned division cannot overflow.
+*/
+#define DIVIDE_OVERFLOWS_INUM(n1, n2) ((n2) == -1 && (n1) == INT64_MIN)
+#define DIVIDE_OVERFLOWS_UNUM(n1, n2) false
+
+/*
+    Signed overflow is undefined in C, so the int add, subtract, multiply and
+    negate are done on the bits as unsigned numbers. They wrap the way that
+    the hardware does, and the same way that fold_arithmetic() folds them.
+*/
+#define ARITHMETIC_INUM(n1, oper, n2) ((int64_t)((uint64_t)(n1) oper (uint64_t)(n2)))
+#define ARITHMETIC_UNUM(n1, oper, n2) ((n1) oper (n2))
+#define ARITHMETIC_FNUM(n1, oper, n2) ((n1) oper (n2))
+
+/**
+    @brief Do the arithmetic on the operands and push the result. The operands
+    have been taken off the stack, or out of the constants for a
+    superinstruction.
+
+    @param vm
+    @param op -- one of the generic arithmetic opcodes
+    @param op1
+    @param op2
+    @param ip
+    @return InterpretResult
+**/
+static InterpretResult arithmetic_op(VMachine* vm, uint16_t op, Value op1, Value op2, size_t ip) {
 
     log_debug("binary arithmetic operation start");
 
     InterpretResult result = INTERPRET_OK;
-    Value* op2 = pop_value_stack();
-    Value* op1 = pop_value_stack();
-    ValueType vt = normalize_operands(op1, op2);
+    ValueType type1 = VALUE_TYPE(&op1);
+    ValueType type2 = VALUE_TYPE(&op2);
+    ValueType vt = normalize_operands(&op1, &op2);
+    if((op == OP_DIV || op == OP_MOD) && (vt == VAL_INUM || vt == VAL_UNUM)) {
+        if((vt == VAL_INUM)? AS_INUM(&op2) == 0: AS_UNUM(&op2) == 0)
+            runtime_error("divide by zero at %d", ip);
+        if(vt == VAL_INUM && DIVIDE_OVERFLOWS_INUM(AS_INUM(&op1), AS_INUM(&op2)))
+            runtime_error("integer overflow in division at %d", ip);
+    }
     if(vt != VAL_INVALID) {
-        Value* val = create_value(vt);
+        Value val = INVALID_VALUE;
         switch(op) {
             case OP_ADD:
                 switch(vt) {
-                    case VAL_OBJ:  val->as.obj = arithmetic_objects(op1, op2, op); break;
-                    case VAL_INUM: val->as.inum = op1->as.inum + op2->as.inum; break;
-                    case VAL_UNUM: val->as.unum = op1->as.unum + op2->as.unum; break;
-                    case VAL_FNUM: val->as.fnum = op1->as.fnum + op2->as.fnum; break;
+                    case VAL_OBJ:  val = OBJ_VALUE(arithmetic_objects(&op1, &op2, op)); break;
+                    case VAL_INUM: val = INUM_VALUE(ARITHMETIC_INUM(AS_INUM(&op1), +, AS_INUM(&op2))); break;
+                    case VAL_UNUM: val = UNUM_VALUE(AS_UNUM(&op1) + AS_UNUM(&op2)); break;
+                    case VAL_FNUM: val = FNUM_VALUE(AS_FNUM(&op1) + AS_FNUM(&op2)); break;
                     case VAL_BOOL:
                         result = INTERPRET_RUNTIME_ERROR;
                         runtime_error("arithmetic operation on boolean type at %d", ip);
@@ -452,10 +903,10 @@ static inline InterpretResult __attribute__((always_inline)) arithmetic_op(uint1
                 break;
             case OP_SUB:
                 switch(vt) {
-                    case VAL_OBJ:  val->as.obj = arithmetic_objects(op1, op2, op); break;
-                    case VAL_INUM: val->as.inum = op1->as.inum - op2->as.inum; break;
-                    case VAL_UNUM: val->as.unum = op1->as.unum - op2->as.unum; break;
-                    case VAL_FNUM: val->as.fnum = op1->as.fnum - op2->as.fnum; break;
+                    case VAL_OBJ:  val = OBJ_VALUE(arithmetic_objects(&op1, &op2, op)); break;
+                    case VAL_INUM: val = INUM_VALUE(ARITHMETIC_INUM(AS_INUM(&op1), -, AS_INUM(&op2))); break;
+                    case VAL_UNUM: val = UNUM_VALUE(AS_UNUM(&op1) - AS_UNUM(&op2)); break;
+                    case VAL_FNUM: val = FNUM_VALUE(AS_FNUM(&op1) - AS_FNUM(&op2)); break;
                     case VAL_BOOL:
                         result = INTERPRET_RUNTIME_ERROR;
                         runtime_error("arithmetic operation on boolean type at %d", ip);
@@ -467,10 +918,10 @@ static inline InterpretResult __attribute__((always_inline)) arithmetic_op(uint1
                 break;
             case OP_MUL:
                 switch(vt) {
-                    case VAL_OBJ:  val->as.obj = arithmetic_objects(op1, op2, op); break;
-                    case VAL_INUM: val->as.inum = op1->as.inum * op2->as.inum; break;
-                    case VAL_UNUM: val->as.unum = op1->as.unum * op2->as.unum; break;
-                    case VAL_FNUM: val->as.fnum = op1->as.fnum * op2->as.fnum; break;
+                    case VAL_OBJ:  val = OBJ_VALUE(arithmetic_objects(&op1, &op2, op)); break;
+                    case VAL_INUM: val = INUM_VALUE(ARITHMETIC_INUM(AS_INUM(&op1), *, AS_INUM(&op2))); break;
+                    case VAL_UNUM: val = UNUM_VALUE(AS_UNUM(&op1) * AS_UNUM(&op2)); break;
+                    case VAL_FNUM: val = FNUM_VALUE(AS_FNUM(&op1) * AS_FNUM(&op2)); break;
                     case VAL_BOOL:
                         result = INTERPRET_RUNTIME_ERROR;
                         runtime_error("arithmetic operation on boolean type at %d", ip);
@@ -482,10 +933,10 @@ static inline InterpretResult __attribute__((always_inline)) arithmetic_op(uint1
                 break;
             case OP_DIV:
                 switch(vt) {
-                    case VAL_OBJ:  val->as.obj = arithmetic_objects(op1, op2, op); break;
-                    case VAL_INUM: val->as.inum = op1->as.inum / op2->as.inum; break;
-                    case VAL_UNUM: val->as.unum = op1->as.unum / op2->as.unum; break;
-                    case VAL_FNUM: val->as.fnum = op1->as.fnum / op2->as.fnum; break;
+                    case VAL_OBJ:  val = OBJ_VALUE(arithmetic_objects(&op1, &op2, op)); break;
+                    case VAL_INUM: val = INUM_VALUE(AS_INUM(&op1) / AS_INUM(&op2)); break;
+                    case VAL_UNUM: val = UNUM_VALUE(AS_UNUM(&op1) / AS_UNUM(&op2)); break;
+                    case VAL_FNUM: val = FNUM_VALUE(AS_FNUM(&op1) / AS_FNUM(&op2)); break;
                     case VAL_BOOL:
                         result = INTERPRET_RUNTIME_ERROR;
                         runtime_error("arithmetic operation on boolean type at %d", ip);
@@ -497,10 +948,10 @@ static inline InterpretResult __attribute__((always_inline)) arithmetic_op(uint1
                 break;
             case OP_MOD:
                 switch(vt) {
-                    case VAL_OBJ:  val->as.obj = arithmetic_objects(op1, op2, op); break;
-                    case VAL_INUM: val->as.inum = op1->as.inum % op2->as.inum; break;
-                    case VAL_UNUM: val->as.unum = op1->as.unum % op2->as.unum; break;
-                    case VAL_FNUM: val->as.fnum = fmod(op1->as.fnum, op2->as.fnum); break;
+                    case VAL_OBJ:  val = OBJ_VALUE(arithmetic_objects(&op1, &op2, op)); break;
+                    case VAL_INUM: val = INUM_VALUE(AS_INUM(&op1) % AS_INUM(&op2)); break;
+                    case VAL_UNUM: val = UNUM_VALUE(AS_UNUM(&op1) % AS_UNUM(&op2)); break;
+                    case VAL_FNUM: val = FNUM_VALUE(fmod(AS_FNUM(&op1), AS_FNUM(&op2))); break;
                     case VAL_BOOL:
                         result = INTERPRET_RUNTIME_ERROR;
                         runtime_error("arithmetic operation on boolean type at %d", ip);
@@ -515,7 +966,11 @@ static inline InterpretResult __attribute__((always_inline)) arithmetic_op(uint1
                 result = INTERPRET_RUNTIME_ERROR;
                 runtime_error("invalid opcode in arithmetic_op()");
         }
-        push_value_stack(val);
+        if(vt == VAL_OBJ)
+            track_object(vm, AS_OBJ(&val));
+        release_operand(&op1, type1);
+        release_operand(&op2, type2);
+        push_value_stack(vm, val);
     }
     else {
         result = INTERPRET_RUNTIME_ERROR;
@@ -530,11 +985,11 @@ static inline InterpretResult __attribute__((always_inline)) arithmetic_op(uint1
 #define trace_instruction(ofst) \
     do {\
         printf("     stack: "); \
-        Value** stack = raw_value_stack(); \
-        size_t limit = value_stack_size(); \
+        Value* stack = raw_value_stack(vm); \
+        size_t limit = value_stack_size(vm); \
         for(size_t idx = 0;  idx < limit; idx++) { \
             printf("[ "); \
-            print_value(stack[idx]); \
+            print_value(&stack[idx]); \
             printf(" ]"); \
         } \
         printf("\n"); \
@@ -544,137 +999,451 @@ static inline InterpretResult __attribute__((always_inline)) arithmetic_op(uint1
 #define trace_instruction(ofst)
 #endif
 
-InterpretResult run_vmachine(VMachine* vm) {
+/*
+    The type-specialized operations work on the top of the stack in place.
+    The compiler only emits them when it knows that both operands have the
+    type, so there is nothing to normalize.
+*/
+#define TYPED_ARITHMETIC(kind, oper) \
+    do { \
+        Value op2 = pop_value_stack(vm); \
+        Value* op1 = top_value_stack(vm); \
+        *op1 = kind##_VALUE(ARITHMETIC_##kind(AS_##kind(op1), oper, AS_##kind(&op2))); \
+        ip++; \
+    } while(false)
 
-    if(vm == NULL)
-        return INTERPRET_RUNTIME_ERROR;
-    if(vm->block == NULL)
-        return INTERPRET_RUNTIME_ERROR;
+#define TYPED_DIVIDE(kind, oper) \
+    do { \
+        Value op2 = pop_value_stack(vm); \
+        Value* op1 = top_value_stack(vm); \
+        if(AS_##kind(&op2) == 0) \
+            runtime_error("divide by zero at %d", ip); \
+        if(DIVIDE_OVERFLOWS_##kind(AS_##kind(op1), AS_##kind(&op2))) \
+            runtime_error("integer overflow in division at %d", ip); \
+        *op1 = kind##_VALUE(AS_##kind(op1) oper AS_##kind(&op2)); \
+        ip++; \
+    } while(false)
+
+#define TYPED_COMPARE(kind, oper) \
+    do { \
+        Value op2 = pop_value_stack(vm); \
+        Value* op1 = top_value_stack(vm); \
+        *op1 = BOOL_VALUE(AS_##kind(op1) oper AS_##kind(&op2)); \
+        ip++; \
+    } while(false)
+
+/*
+    The dispatch loop is written with the macros below so that it can be built
+    in two ways. When _USE_COMPUTED_GOTO is defined, the handlers are threaded
+    together with the GCC labels-as-values extension and every handler jumps
+    directly to the next one. Otherwise it is a portable switch inside of a
+    loop.
+
+    With computed goto, --trace, --pairs and --profile swap in a table that sends every
+    opcode to the hook handler, which records it and then jumps to the real
+    handler. The switch build has to test for them before each instruction.
+*/
+#ifdef _USE_COMPUTED_GOTO
+#   define VM_LABEL(op)     label_##op
+#   define VM_CASE(op)      VM_LABEL(op):
+#   define VM_DEFAULT       VM_LABEL(OP_COUNT):
+#   define VM_DISPATCH() \
+        do { \
+            instruction = instruction_list[ip]; \
+            trace_instruction(ip); \
+            goto *((instruction < OP_COUNT)? \
+                    table[instruction]: &&VM_LABEL(OP_COUNT)); \
+        } while(false)
+#   define VM_NEXT()        VM_DISPATCH()
+#   define VM_LOOP_START()  VM_DISPATCH();
+#   define VM_HOOK_CASE() \
+        VM_LABEL(hook): \
+            record_hooks(vm, ip, instruction); \
+            goto *dispatch_table[instruction];
+#   define VM_LOOP_END()
+#else
+#   define VM_CASE(op)      case op:
+#   define VM_DEFAULT       default:
+#   define VM_NEXT()        continue
+#   define VM_LOOP_START() \
+        while(true) { \
+            instruction = instruction_list[ip]; \
+            trace_instruction(ip); \
+            if(vm->trace != NULL || vm->pairs != NULL || vm->profile != NULL) \
+                record_hooks(vm, ip, instruction); \
+            switch(instruction) {
+#   define VM_HOOK_CASE()
+#   define VM_LOOP_END()    } }
+#endif
+
+/*
+ * Record the instruction in the profile, the trace and the pair counts,
+ * whichever are on.
+ */
+static inline void __attribute__((always_inline)) record_hooks(VMachine* vm, size_t ip, uint16_t op) {
+
+    if(vm->profile != NULL)
+        record_profile(vm, op);
+    if(vm->trace != NULL)
+        record_trace(vm, ip, op);
+    if(vm->pairs != NULL)
+        record_pair(vm, op);
+}
+
+/*
+ * The generic operation that each superinstruction does.
+ */
+static const uint16_t fused_base[OP_COUNT] = {
+    [OP_ADD_CONST] = OP_ADD,        [OP_ADD_CONST_CONST] = OP_ADD,
+    [OP_SUB_CONST] = OP_SUB,        [OP_SUB_CONST_CONST] = OP_SUB,
+    [OP_MUL_CONST] = OP_MUL,        [OP_MUL_CONST_CONST] = OP_MUL,
+    [OP_DIV_CONST] = OP_DIV,        [OP_DIV_CONST_CONST] = OP_DIV,
+    [OP_MOD_CONST] = OP_MOD,        [OP_MOD_CONST_CONST] = OP_MOD,
+    [OP_EQ_CONST]  = OP_EQUALITY,   [OP_EQ_CONST_CONST]  = OP_EQUALITY,
+    [OP_NEQ_CONST] = OP_NEQ,        [OP_NEQ_CONST_CONST] = OP_NEQ,
+    [OP_LT_CONST]  = OP_LT,         [OP_LT_CONST_CONST]  = OP_LT,
+    [OP_GT_CONST]  = OP_GT,         [OP_GT_CONST_CONST]  = OP_GT,
+    [OP_LTE_CONST] = OP_LTE,        [OP_LTE_CONST_CONST] = OP_LTE,
+    [OP_GTE_CONST] = OP_GTE,        [OP_GTE_CONST_CONST] = OP_GTE,
+};
+
+static InterpretResult dispatch_code(VMachine* vm) {
+
+#ifdef _USE_COMPUTED_GOTO
+    static void* dispatch_table[OP_COUNT] = {
+        [OP_CONSTANT]   = &&VM_LABEL(OP_CONSTANT),
+        [OP_ADD]        = &&VM_LABEL(OP_ADD),
+        [OP_SUB]        = &&VM_LABEL(OP_SUB),
+        [OP_MUL]        = &&VM_LABEL(OP_MUL),
+        [OP_DIV]        = &&VM_LABEL(OP_DIV),
+        [OP_MOD]        = &&VM_LABEL(OP_MOD),
+        [OP_NEG]        = &&VM_LABEL(OP_NEG),
+        [OP_NOTHING]    = &&VM_LABEL(OP_NOTHING),
+        [OP_TRUE]       = &&VM_LABEL(OP_TRUE),
+        [OP_FALSE]      = &&VM_LABEL(OP_FALSE),
+        [OP_NOT]        = &&VM_LABEL(OP_NOT),
+        [OP_EQUALITY]   = &&VM_LABEL(OP_EQUALITY),
+        [OP_NEQ]        = &&VM_LABEL(OP_NEQ),
+        [OP_LT]         = &&VM_LABEL(OP_LT),
+        [OP_GT]         = &&VM_LABEL(OP_GT),
+        [OP_LTE]        = &&VM_LABEL(OP_LTE),
+        [OP_GTE]        = &&VM_LABEL(OP_GTE),
+        [OP_RETURN]     = &&VM_LABEL(OP_RETURN),
+        [OP_ADD_I64]    = &&VM_LABEL(OP_ADD_I64),
+        [OP_SUB_I64]    = &&VM_LABEL(OP_SUB_I64),
+        [OP_MUL_I64]    = &&VM_LABEL(OP_MUL_I64),
+        [OP_DIV_I64]    = &&VM_LABEL(OP_DIV_I64),
+        [OP_MOD_I64]    = &&VM_LABEL(OP_MOD_I64),
+        [OP_ADD_U64]    = &&VM_LABEL(OP_ADD_U64),
+        [OP_SUB_U64]    = &&VM_LABEL(OP_SUB_U64),
+        [OP_MUL_U64]    = &&VM_LABEL(OP_MUL_U64),
+        [OP_DIV_U64]    = &&VM_LABEL(OP_DIV_U64),
+        [OP_MOD_U64]    = &&VM_LABEL(OP_MOD_U64),
+        [OP_ADD_F64]    = &&VM_LABEL(OP_ADD_F64),
+        [OP_SUB_F64]    = &&VM_LABEL(OP_SUB_F64),
+        [OP_MUL_F64]    = &&VM_LABEL(OP_MUL_F64),
+        [OP_DIV_F64]    = &&VM_LABEL(OP_DIV_F64),
+        [OP_MOD_F64]    = &&VM_LABEL(OP_MOD_F64),
+        [OP_EQ_I64]     = &&VM_LABEL(OP_EQ_I64),
+        [OP_NEQ_I64]    = &&VM_LABEL(OP_NEQ_I64),
+        [OP_LT_I64]     = &&VM_LABEL(OP_LT_I64),
+        [OP_GT_I64]     = &&VM_LABEL(OP_GT_I64),
+        [OP_LTE_I64]    = &&VM_LABEL(OP_LTE_I64),
+        [OP_GTE_I64]    = &&VM_LABEL(OP_GTE_I64),
+        [OP_EQ_U64]     = &&VM_LABEL(OP_EQ_U64),
+        [OP_NEQ_U64]    = &&VM_LABEL(OP_NEQ_U64),
+        [OP_LT_U64]     = &&VM_LABEL(OP_LT_U64),
+        [OP_GT_U64]     = &&VM_LABEL(OP_GT_U64),
+        [OP_LTE_U64]    = &&VM_LABEL(OP_LTE_U64),
+        [OP_GTE_U64]    = &&VM_LABEL(OP_GTE_U64),
+        [OP_LT_F64]     = &&VM_LABEL(OP_LT_F64),
+        [OP_GT_F64]     = &&VM_LABEL(OP_GT_F64),
+        [OP_LTE_F64]    = &&VM_LABEL(OP_LTE_F64),
+        [OP_GTE_F64]    = &&VM_LABEL(OP_GTE_F64),
+        [OP_ADD_CONST]   = &&VM_LABEL(OP_ADD_CONST),
+        [OP_SUB_CONST]   = &&VM_LABEL(OP_SUB_CONST),
+        [OP_MUL_CONST]   = &&VM_LABEL(OP_MUL_CONST),
+        [OP_DIV_CONST]   = &&VM_LABEL(OP_DIV_CONST),
+        [OP_MOD_CONST]   = &&VM_LABEL(OP_MOD_CONST),
+        [OP_EQ_CONST]    = &&VM_LABEL(OP_EQ_CONST),
+        [OP_NEQ_CONST]   = &&VM_LABEL(OP_NEQ_CONST),
+        [OP_LT_CONST]    = &&VM_LABEL(OP_LT_CONST),
+        [OP_GT_CONST]    = &&VM_LABEL(OP_GT_CONST),
+        [OP_LTE_CONST]   = &&VM_LABEL(OP_LTE_CONST),
+        [OP_GTE_CONST]   = &&VM_LABEL(OP_GTE_CONST),
+        [OP_ADD_CONST_CONST] = &&VM_LABEL(OP_ADD_CONST_CONST),
+        [OP_SUB_CONST_CONST] = &&VM_LABEL(OP_SUB_CONST_CONST),
+        [OP_MUL_CONST_CONST] = &&VM_LABEL(OP_MUL_CONST_CONST),
+        [OP_DIV_CONST_CONST] = &&VM_LABEL(OP_DIV_CONST_CONST),
+        [OP_MOD_CONST_CONST] = &&VM_LABEL(OP_MOD_CONST_CONST),
+        [OP_EQ_CONST_CONST]  = &&VM_LABEL(OP_EQ_CONST_CONST),
+        [OP_NEQ_CONST_CONST] = &&VM_LABEL(OP_NEQ_CONST_CONST),
+        [OP_LT_CONST_CONST]  = &&VM_LABEL(OP_LT_CONST_CONST),
+        [OP_GT_CONST_CONST]  = &&VM_LABEL(OP_GT_CONST_CONST),
+        [OP_LTE_CONST_CONST] = &&VM_LABEL(OP_LTE_CONST_CONST),
+        [OP_GTE_CONST_CONST] = &&VM_LABEL(OP_GTE_CONST_CONST),
+    };
+    static void* hook_table[OP_COUNT] = {
+        [0 ... OP_COUNT - 1] = &&VM_LABEL(hook),
+    };
+    void** table = (vm->trace != NULL || vm->pairs != NULL || vm->profile != NULL)?
+                        hook_table: dispatch_table;
+#endif
 
     printf("\nrun vm\n");
-    bool finished = false;
     InterpretResult result = INTERPRET_OK;
     Value** value_list = raw_value_list(vm->block);
     uint16_t* instruction_list = raw_code_list(vm->block);
     size_t ip = vm->lastIp;
+    uint16_t instruction;
+    Value op1, op2;     // operands of the generic binary operations
+    size_t size;        // words in the instruction that has the operands
 
-    while(!finished) {
-        uint16_t instruction = instruction_list[ip];
-        trace_instruction(ip);
-        switch(instruction) {
-            case OP_CONSTANT: {
-                ip++;
-                Value* value = value_list[instruction_list[ip++]];
-                push_value_stack(value);
-            }
-            break;
+    if(vm->pairs != NULL)
+        vm->pairs->prev = OP_COUNT;     // pairs do not span runs
 
-            case OP_EQUALITY:
-            case OP_NEQ:
-            case OP_LT:
-            case OP_GT:
-            case OP_LTE:
-            case OP_GTE:
-                result = compare_op(instruction, ip);
-                if(result == INTERPRET_OK)
-                    ip++;
-                else
-                    finished = true; // error already posted.
-                break;
+    // numbers that are too wide to NaN box belong to this machine until it
+    // is reset, and the intern table is left to the compiler
+    box_wide_numbers_in(vm->boxes);
 
-            case OP_ADD:
-            case OP_SUB:
-            case OP_MUL:
-            case OP_DIV:
-            case OP_MOD:
-                result = arithmetic_op(instruction, ip);
-                if(result == INTERPRET_OK)
-                    ip++;
-                else
-                    finished = true; // error already posted.
-                break;
+    VM_LOOP_START()
+        VM_HOOK_CASE()
 
-            case OP_NEG: { // unary operation
-                    Value* op = pop_value_stack();
-                    ValueType vt = op->type;
-                    Value* val = create_value(vt); // avoid double free();
-                    if(value_is_number(op) || value_is_bool(op)) {
-                        switch(vt) {
-                            case VAL_INUM: val->as.inum = -op->as.inum; break;
-                            case VAL_UNUM: val->as.unum = -op->as.unum; break;
-                            case VAL_FNUM: val->as.fnum = -op->as.fnum; break;
-                            case VAL_BOOL: val->as.bval = -op->as.bval; break;
-                            default:
-                                finished = true;
-                                result = INTERPRET_RUNTIME_ERROR;
-                                runtime_error("unknown value type: %d at %d", vt, ip);
-                        }
-                        push_value_stack(val);
-                        ip++;
-                    }
-                    else {
-                        finished = true;
-                        result = INTERPRET_RUNTIME_ERROR;
-                        runtime_error("expected number or bool, but got: %d at %d", vt, ip);
+        VM_CASE(OP_CONSTANT)
+            ip++;
+            push_value_stack(vm, *value_list[instruction_list[ip++]]);
+            VM_NEXT();
+
+        VM_CASE(OP_EQUALITY)
+        VM_CASE(OP_NEQ)
+        VM_CASE(OP_LT)
+        VM_CASE(OP_GT)
+        VM_CASE(OP_LTE)
+        VM_CASE(OP_GTE)
+            op2 = pop_value_stack(vm);
+            op1 = pop_value_stack(vm);
+            size = 1;
+        compare:
+            result = compare_op(vm, instruction, op1, op2, ip);
+            if(result != INTERPRET_OK)
+                goto finished; // error already posted.
+            ip += size;
+            VM_NEXT();
+
+        VM_CASE(OP_ADD)
+        VM_CASE(OP_SUB)
+        VM_CASE(OP_MUL)
+        VM_CASE(OP_DIV)
+        VM_CASE(OP_MOD)
+            op2 = pop_value_stack(vm);
+            op1 = pop_value_stack(vm);
+            size = 1;
+        arithmetic:
+            result = arithmetic_op(vm, instruction, op1, op2, ip);
+            if(result != INTERPRET_OK)
+                goto finished; // error already posted.
+            ip += size;
+            VM_NEXT();
+
+        // The superinstructions take their operands from the constants and
+        // then do what the generic operation does.
+        VM_CASE(OP_ADD_CONST)
+        VM_CASE(OP_SUB_CONST)
+        VM_CASE(OP_MUL_CONST)
+        VM_CASE(OP_DIV_CONST)
+        VM_CASE(OP_MOD_CONST)
+            op2 = *value_list[instruction_list[ip + 1]];
+            op1 = pop_value_stack(vm);
+            instruction = fused_base[instruction];
+            size = 2;
+            goto arithmetic;
+
+        VM_CASE(OP_ADD_CONST_CONST)
+        VM_CASE(OP_SUB_CONST_CONST)
+        VM_CASE(OP_MUL_CONST_CONST)
+        VM_CASE(OP_DIV_CONST_CONST)
+        VM_CASE(OP_MOD_CONST_CONST)
+            op1 = *value_list[instruction_list[ip + 1]];
+            op2 = *value_list[instruction_list[ip + 2]];
+            instruction = fused_base[instruction];
+            size = 3;
+            goto arithmetic;
+
+        VM_CASE(OP_EQ_CONST)
+        VM_CASE(OP_NEQ_CONST)
+        VM_CASE(OP_LT_CONST)
+        VM_CASE(OP_GT_CONST)
+        VM_CASE(OP_LTE_CONST)
+        VM_CASE(OP_GTE_CONST)
+            op2 = *value_list[instruction_list[ip + 1]];
+            op1 = pop_value_stack(vm);
+            instruction = fused_base[instruction];
+            size = 2;
+            goto compare;
+
+        VM_CASE(OP_EQ_CONST_CONST)
+        VM_CASE(OP_NEQ_CONST_CONST)
+        VM_CASE(OP_LT_CONST_CONST)
+        VM_CASE(OP_GT_CONST_CONST)
+        VM_CASE(OP_LTE_CONST_CONST)
+        VM_CASE(OP_GTE_CONST_CONST)
+            op1 = *value_list[instruction_list[ip + 1]];
+            op2 = *value_list[instruction_list[ip + 2]];
+            instruction = fused_base[instruction];
+            size = 3;
+            goto compare;
+
+        VM_CASE(OP_NEG) { // unary operation
+                Value op = pop_value_stack(vm);
+                ValueType vt = VALUE_TYPE(&op);
+                Value val;
+                if(IS_NUMBER(&op) || IS_BOOL(&op)) {
+                    switch(vt) {
+                        case VAL_INUM: val = INUM_VALUE(ARITHMETIC_INUM(0, -, AS_INUM(&op))); break;
+                        case VAL_UNUM: val = UNUM_VALUE(-AS_UNUM(&op)); break;
+                        case VAL_FNUM: val = FNUM_VALUE(-AS_FNUM(&op)); break;
+                        case VAL_BOOL: val = BOOL_VALUE(-AS_BOOL(&op)); break;
+                        default:
+                            result = INTERPRET_RUNTIME_ERROR;
+                            runtime_error("unknown value type: %d at %d", vt, ip);
+                            goto finished;
                     }
+                    push_value_stack(vm, val);
+                    ip++;
                 }
-                break;
+                else {
+                    result = INTERPRET_RUNTIME_ERROR;
+                    runtime_error("expected number or bool, but got: %d at %d", vt, ip);
+                    goto finished;
+                }
+            }
+            VM_NEXT();
+
+        VM_CASE(OP_NOTHING)
+            ip++;
+            push_value_stack(vm, NOTHING_VALUE);
+            VM_NEXT();
+
+        VM_CASE(OP_TRUE)
+            ip++;
+            push_value_stack(vm, BOOL_VALUE(true));
+            VM_NEXT();
+
+        VM_CASE(OP_FALSE)
+            ip++;
+            push_value_stack(vm, BOOL_VALUE(false));
+            VM_NEXT();
 
-            case OP_NOTHING:
+        VM_CASE(OP_RETURN)
+            ip++;
+            vm->lastIp = ip;
+            goto finished;
+
+        VM_CASE(OP_NOT) {
                 ip++;
-                push_value_stack(create_value(VAL_NOTHING));
-                break;
+                Value op = pop_value_stack(vm);
+                push_value_stack(vm, BOOL_VALUE(IS_NOTHING(&op) || (IS_BOOL(&op) && !AS_BOOL(&op))));
+            }
+            VM_NEXT();
 
-            case OP_TRUE: {
-                    ip++;
-                    Value* val = create_value(VAL_BOOL);
-                    val->as.bval = true;
-                    push_value_stack(val);
-                }
-                break;
+        VM_CASE(OP_ADD_I64) TYPED_ARITHMETIC(INUM, +); VM_NEXT();
+        VM_CASE(OP_SUB_I64) TYPED_ARITHMETIC(INUM, -); VM_NEXT();
+        VM_CASE(OP_MUL_I64) TYPED_ARITHMETIC(INUM, *); VM_NEXT();
+        VM_CASE(OP_DIV_I64) TYPED_DIVIDE(INUM, /); VM_NEXT();
+        VM_CASE(OP_MOD_I64) TYPED_DIVIDE(INUM, %); VM_NEXT();
 
-            case OP_FALSE: {
-                    ip++;
-                    Value* val = create_value(VAL_BOOL);
-                    val->as.bval = false;
-                    push_value_stack(val);
-                }
-                break;
+        VM_CASE(OP_ADD_U64) TYPED_ARITHMETIC(UNUM, +); VM_NEXT();
+        VM_CASE(OP_SUB_U64) TYPED_ARITHMETIC(UNUM, -); VM_NEXT();
+        VM_CASE(OP_MUL_U64) TYPED_ARITHMETIC(UNUM, *); VM_NEXT();
+        VM_CASE(OP_DIV_U64) TYPED_DIVIDE(UNUM, /); VM_NEXT();
+        VM_CASE(OP_MOD_U64) TYPED_DIVIDE(UNUM, %); VM_NEXT();
 
-            case OP_RETURN:
+        VM_CASE(OP_ADD_F64) TYPED_ARITHMETIC(FNUM, +); VM_NEXT();
+        VM_CASE(OP_SUB_F64) TYPED_ARITHMETIC(FNUM, -); VM_NEXT();
+        VM_CASE(OP_MUL_F64) TYPED_ARITHMETIC(FNUM, *); VM_NEXT();
+        VM_CASE(OP_DIV_F64) TYPED_ARITHMETIC(FNUM, /); VM_NEXT();
+        VM_CASE(OP_MOD_F64) {
+                Value op2 = pop_value_stack(vm);
+                Value* op1 = top_value_stack(vm);
+                *op1 = FNUM_VALUE(fmod(AS_FNUM(op1), AS_FNUM(&op2)));
                 ip++;
-                vm->lastIp = ip;
-                finished = true;
-                break;
+            }
+            VM_NEXT();
 
-            case OP_NOT: {
-                    ip++;
-                    Value* op = pop_value_stack();
-                    Value* val = create_value(VAL_BOOL);
-                    val->as.bval = (value_is_nothing(op) || (value_is_bool(op) && !op->as.bval));
-                    push_value_stack(val);
-                }
-                break;
+        VM_CASE(OP_EQ_I64)  TYPED_COMPARE(INUM, ==); VM_NEXT();
+        VM_CASE(OP_NEQ_I64) TYPED_COMPARE(INUM, !=); VM_NEXT();
+        VM_CASE(OP_LT_I64)  TYPED_COMPARE(INUM, <); VM_NEXT();
+        VM_CASE(OP_GT_I64)  TYPED_COMPARE(INUM, >); VM_NEXT();
+        VM_CASE(OP_LTE_I64) TYPED_COMPARE(INUM, <=); VM_NEXT();
+        VM_CASE(OP_GTE_I64) TYPED_COMPARE(INUM, >=); VM_NEXT();
 
-            default:
-                finished = true;
-                result = INTERPRET_RUNTIME_ERROR;
-                runtime_error("unknown opcode: %d, %d", instruction, ip);   // does not return
-        }
-    }
+        VM_CASE(OP_EQ_U64)  TYPED_COMPARE(UNUM, ==); VM_NEXT();
+        VM_CASE(OP_NEQ_U64) TYPED_COMPARE(UNUM, !=); VM_NEXT();
+        VM_CASE(OP_LT_U64)  TYPED_COMPARE(UNUM, <); VM_NEXT();
+        VM_CASE(OP_GT_U64)  TYPED_COMPARE(UNUM, >); VM_NEXT();
+        VM_CASE(OP_LTE_U64) TYPED_COMPARE(UNUM, <=); VM_NEXT();
+        VM_CASE(OP_GTE_U64) TYPED_COMPARE(UNUM, >=); VM_NEXT();
+
+        VM_CASE(OP_LT_F64)  TYPED_COMPARE(FNUM, <); VM_NEXT();
+        VM_CASE(OP_GT_F64)  TYPED_COMPARE(FNUM, >); VM_NEXT();
+        VM_CASE(OP_LTE_F64) TYPED_COMPARE(FNUM, <=); VM_NEXT();
+        VM_CASE(OP_GTE_F64) TYPED_COMPARE(FNUM, >=); VM_NEXT();
 
+        VM_DEFAULT
+            result = INTERPRET_RUNTIME_ERROR;
+            runtime_error("unknown opcode: %d, %d", instruction, ip);   // does not return
+            goto finished;
+    VM_LOOP_END()
+
+finished:
+    box_wide_numbers_in(NULL);
+    if(vm->profile != NULL)
+        end_profile_sample(vm->profile);
     return result;
 }
 
+/**
+    @brief Run the code from where the last run stopped to the end of the
+    block. A runtime error stops only this machine. It returns here with
+    INTERPRET_RUNTIME_ERROR, and the rest of the code is skipped, so other
+    machines on other threads carry on.
 
+    @param vm
+    @return InterpretResult
+**/
+InterpretResult run_vmachine(VMachine* vm) {
 
+    if(vm == NULL)
+        return INTERPRET_RUNTIME_ERROR;
+    if(vm->block == NULL)
+        return INTERPRET_RUNTIME_ERROR;
+
+    // the dispatch loop is a function of its own so that none of its locals
+    // live across the setjmp()
+    jmp_buf handler;
+    jmp_buf* outer = set_runtime_handler(&handler);
+    InterpretResult result = INTERPRET_RUNTIME_ERROR;
+
+    if(setjmp(handler) == 0)
+        result = dispatch_code(vm);
+    else {
+        box_wide_numbers_in(NULL);
+        if(vm->profile != NULL)
+            end_profile_sample(vm->profile);
+        create_value_stack(vm);
+        vm->lastIp = code_offset(vm->block);
+    }
+
+    set_runtime_handler(outer);
+    return result;
+}
 
 #if 0
 #define BINARY_COP(oper) \
     do { \
         log_debug("binary comparison operation start"); \
-        Value* op2 = pop_value_stack(); \
-        Value* op1 = pop_value_stack(); \
+        Value* op2 = pop_value_stack(vm); \
+        Value* op1 = pop_value_stack(vm); \
         ValueType vt = normalize_operands(op1, op2); \
         if(vt != VAL_INVALID) { \
             log_debug("vt = %d", vt); \
@@ -692,7 +1461,7 @@ InterpretResult run_vmachine(VMachine* vm) {
                     result = INTERPRET_RUNTIME_ERROR; \
                     runtime_error("unknown value type: %d at %d", vt, ip); \
             } \
-            push_value_stack(val); \
+            push_value_stack(vm, val); \
             ip++; \
         } \
         else { \
@@ -708,8 +1477,8 @@ InterpretResult run_vmachine(VMachine* vm) {
 #define BINARY_AOP(oper) \
     do { \
         log_debug("binary arithmetic operation start"); \
-        Value* op2 = pop_value_stack(); \
-        Value* op1 = pop_value_stack(); \
+        Value* op2 = pop_value_stack(vm); \
+        Value* op1 = pop_value_stack(vm); \
         ValueType vt = normalize_operands(op1, op2); \
         if(vt != VAL_INVALID) { \
             Value* val = create_value(vt); \
@@ -727,7 +1496,7 @@ InterpretResult run_vmachine(VMachine* vm) {
                     result = INTERPRET_RUNTIME_ERROR; \
                     runtime_error("unknown value type: %d at %d", vt, ip); \
             } \
-            push_value_stack(val); \
+            push_value_stack(vm, val); \
             ip++; \
         } \
         else { \
@@ -15,20 +15,93 @@ typedef enum {
     INTERPRET_RUNTIME_ERROR,
 } InterpretResult;
 
-typedef ptr_list_t valueStack;
+#define VALUE_STACK_MAX 256
+
+/**
+    @brief The value stack holds the Value structs themselves, rather than
+    pointers to them, so pushing and popping never calls the allocator.
+**/
+typedef struct {
+    Value* top;
+    Value items[VALUE_STACK_MAX];
+} valueStack;
+
+/*
+ * With --trace, the machine records each instruction that it runs in a ring
+ * buffer, and the last TRACE_ENTRIES of them are printed at exit. Only the
+ * dispatch table changes when tracing is on, so it costs nothing when it is
+ * off.
+ */
+#define TRACE_ENTRIES 1024  // must be a power of 2
+
+typedef struct {
+    uint32_t ip;
+    uint16_t opcode;
+    uint16_t depth;     // values on the stack before the instruction
+    uint8_t type;       // ValueType of the top of the stack
+} traceEntry;
+
+typedef struct {
+    size_t count;       // entries recorded, the newest is at count - 1
+    traceEntry entries[TRACE_ENTRIES];
+} traceBuffer;
+
+/*
+ * With --pairs, the machine counts how often each opcode runs right after
+ * each other one. The counts are the profile that fuse_code() uses to pick
+ * the superinstructions. Like the trace, it only changes the dispatch table.
+ */
+typedef struct {
+    uint16_t prev;          // opcode that ran last, or OP_COUNT at the start
+    uint64_t count[OP_COUNT][OP_COUNT];     // [first][second]
+} pairCounts;
+
+/*
+ * With --profile, the machine counts each opcode that runs and times one in
+ * every rate of them, with the cycle counter where there is one and with
+ * clock_gettime() where there is not. A sample runs from the dispatch of the
+ * opcode to the dispatch of the next one, so it includes the hook. The
+ * samples for each opcode are kept in a histogram of powers of 2. The pairs
+ * are counted as for --pairs.
+ */
+#define PROFILE_BUCKETS 32
+
+typedef struct {
+    uint64_t count[OP_COUNT];
+    uint64_t samples[OP_COUNT];
+    uint64_t ticks[OP_COUNT];   // total of the samples
+    uint64_t histogram[OP_COUNT][PROFILE_BUCKETS];  // [op][log2 of ticks]
+    uint32_t rate;              // time one in this many dispatches
+    uint32_t countdown;         // dispatches until the next sample
+    uint16_t timing;            // opcode being timed, or OP_COUNT
+    uint64_t start;             // clock at the start of the sample
+} opProfile;
 
 typedef struct {
     codeBlock* block;
-    valueStack* vstack;
+    valueStack vstack;
+    traceBuffer* trace;     // NULL when tracing is off
+    pairCounts* pairs;      // NULL when not counting
+    opProfile* profile;     // NULL when not profiling
+    ptr_list_t* objects;    // objects created while the code runs
+    ptr_list_t* boxes;      // wide numbers boxed while the code runs
     size_t lastIp;
     //uint16_t* ip;   // instruction pointer
 } VMachine;
 
-void init_vmachine();
-void destroy_vmachine();
-void reset_vmachine();
+VMachine* create_vmachine();
+void destroy_vmachine(VMachine*);
+void reset_vmachine(VMachine*);
+void load_vmachine(VMachine*, codeBlock*);
 //void free_vmachine(VMachine*);
 //void set_codeblock(VMachine*, codeBlock*);
 InterpretResult run_vmachine(VMachine*);
-Value* peek_value_stack();
+Value* peek_value_stack(VMachine*);
+void trace_vmachine(VMachine*, bool);
+void dump_vmachine_trace(VMachine*, FILE*);
+void count_vmachine_pairs(VMachine*, bool);
+void write_vmachine_pairs(VMachine*, FILE*);
+void profile_vmachine(VMachine*, uint32_t);
+void report_vmachine_profile(VMachine*, FILE*);
+void write_vmachine_profile(VMachine*, FILE*);
 #endif
@@ -0,0 +1,66 @@
+/**
+    @file bench.h
+
+    @brief Helpers for the benchmarks. Each benchmark is built once for each
+    configuration that it compares, and BENCH_NAME names the build. Every
+    result is printed as one line of "name variant value unit", so the lines
+    from the builds can be put side by side.
+
+    Include this in one file of the benchmark only. It has the configuration
+    table that the compiler sources read.
+
+**/
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+
+#ifndef BENCH_NAME
+#   define BENCH_NAME "bench"
+#endif
+
+BEGIN_CONFIG
+    CONFIG_NUM("-n", "REPEAT", "Run each measurement this many times and keep the best", 0, 5, 0)
+    CONFIG_BOOL("-q", "QUICK", "Run a small amount of work, to check that the benchmark works", 0, 0, 0)
+    CONFIG_BOOL("-b", "BATCH_SCAN", "Scan each input into a token array before parsing", 0, 0, 0)
+    CONFIG_LIST(NULL, "INFILES", "Not used", 0, NULL, 0)
+END_CONFIG
+
+static FILE* bench_out = NULL;
+
+/*
+ * The machine prints to stdout while it runs. Send that to /dev/null, so
+ * that it is not part of the time, and keep the real stdout for the results.
+ */
+static inline void bench_quiet() {
+
+    fflush(stdout);
+    bench_out = fdopen(dup(fileno(stdout)), "w");
+    if(bench_out == NULL || freopen("/dev/null", "w", stdout) == NULL)
+        fatal_error("cannot redirect the output of the benchmark");
+}
+
+/*
+ * Seconds on the monotonic clock.
+ */
+static inline double bench_now() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Print one result.
+ */
+static inline void bench_report(const char* what, double value, const char* unit) {
+
+    fprintf((bench_out != NULL)? bench_out: stdout, "%-28s %-28s %14.2f %s\n",
+            BENCH_NAME, what, value, unit);
+    fflush((bench_out != NULL)? bench_out: stdout);
+}
+
+#endif
@@ -0,0 +1,85 @@
+/**
+    @file bench_alloc.c
+
+    @brief Calls to the libc allocator per REPL line. Each line is compiled
+    and run the same way that repl() does it, and the calls that memory.c
+    makes to libc are counted. The benchmark is built with and without the
+    arenas and the pools.
+
+**/
+// clock_gettime() and dup() are POSIX, and --std=c99 hides them.
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#define LINES 2000
+
+/*
+ * The kinds of line that are typed into the REPL. The %d is replaced with
+ * the number of the line, so the constants are not all the same.
+ */
+static const char* templates[] = {
+    "%d + 2 * 3 - 4 / 2",
+    "(%d + 2.5) * 3 - 4 / 2",
+    "0x%X + 0x20 > 0x10",
+    "\"word%d\" == \"word\"",
+    "\"ab\\tc%d\" + \"d\" == \"ab\\tcd\"",
+    "%d %% 5 <= 3 * 2",
+};
+
+#define TEMPLATES (int)(sizeof(templates) / sizeof(templates[0]))
+
+/*
+ * Compile and run one line into a fresh block.
+ */
+static void run_line(VMachine* vm, const char* line) {
+
+    reset_vmachine(vm);
+    open_scanner_string(line);
+    if(!compile(vm->block) || run_vmachine(vm) != INTERPRET_OK)
+        fatal_error("the benchmark line \"%s\" failed", line);
+}
+
+int main(int argc, char** argv) {
+
+    init_memory();
+    configure(argc, argv);
+    init_errors(stderr);
+    init_scanner();
+    init_fusion("all");
+    bench_quiet();
+
+    bool quick = GET_CONFIG_BOOL("QUICK");
+    int repeat = quick? 1: GET_CONFIG_NUM("REPEAT");
+    int lines = quick? 20: LINES;
+
+    char line[128];
+    double per_line = 0.0;
+    double best = 0.0;
+
+    for(int r = 0; r < repeat; r++) {
+        // the same as the REPL, which keeps one machine for all of its lines
+        VMachine* vm = create_vmachine();
+        size_t calls = count_libc_calls();
+        double start = bench_now();
+        for(int i = 0; i < lines; i++) {
+            snprintf(line, sizeof(line), templates[i % TEMPLATES], i);
+            run_line(vm, line);
+        }
+        double rate = lines / (bench_now() - start) / 1e3;
+        per_line = (double)(count_libc_calls() - calls) / lines;
+        if(rate > best)
+            best = rate;
+        destroy_vmachine(vm);
+    }
+
+    bench_report("libc calls per line", per_line, "calls");
+    bench_report("lines", best, "Klines/s");
+
+    destroy_config();
+    destroy_scanner();
+    destroy_strings();
+    destroy_wide_numbers();
+    destroy_memory();
+    fclose(bench_out);
+    return 0;
+}
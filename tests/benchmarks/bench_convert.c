@@ -0,0 +1,132 @@
+/**
+    @file bench_convert.c
+
+    @brief Conversions per second from strings to values through
+    conv_obj_to_val(), for each type that a string can be converted to. The
+    same strings are also checked with the regcomp() and regexec() patterns
+    and converted with strto*(), the way conv_obj_to_val() used to do it, so
+    the two can be compared on one machine.
+
+**/
+// clock_gettime(), dup() and regcomp() are POSIX, and --std=c99 hides them.
+#define _POSIX_C_SOURCE 200809L
+#include <regex.h>
+
+#include "bench.h"
+
+#define STRINGS 1000
+#define RUNS 200
+
+typedef struct {
+    const char* name;
+    ValueType type;
+    const char* regex;  // what conv_obj_to_val() used to check with
+} conversion_t;
+
+static const conversion_t conversions[] = {
+    {"int", VAL_INUM, "^[^0][0-9]+$"},
+    {"hex", VAL_UNUM, "^0x[0-9a-f]+$"},
+    {"float", VAL_FNUM, "^[+-]?([0-9]*\\.)?[0-9]+(e[-+]?[0-9]+)?$"},
+    {"bool", VAL_BOOL, "^true|false$"},
+};
+
+#define CONVERSIONS (int)(sizeof(conversions) / sizeof(conversions[0]))
+
+/*
+ * Make a string of the kind that converts to the type.
+ */
+static Value make_string(ValueType type, int n) {
+
+    char buf[64];
+
+    switch(type) {
+        case VAL_INUM: snprintf(buf, sizeof(buf), "%d", 10 + n * 7919); break;  // the old pattern needs two digits
+        case VAL_UNUM: snprintf(buf, sizeof(buf), "0x%x", 0x10 + n * 104729); break;
+        case VAL_FNUM: snprintf(buf, sizeof(buf), "%d.%03de%d", n % 1000, n % 997, n % 40 - 20); break;
+        case VAL_BOOL: strcpy(buf, (n % 2)? "true": "false"); break;
+        default: fatal_error("no strings for type %d", type);
+    }
+
+    return OBJ_VALUE(create_string_object(buf, strlen(buf)));
+}
+
+/*
+ * The old way: compile the pattern, match, free the pattern, then convert.
+ */
+static ValueType regex_convert(Value* val, const conversion_t* conv) {
+
+    const char* str = value_as_cstring(val);
+    regex_t re;
+
+    if(regcomp(&re, conv->regex, REG_EXTENDED | REG_ICASE | REG_NOSUB) != 0)
+        fatal_error("cannot compile \"%s\"", conv->regex);
+    int status = regexec(&re, str, 0, NULL, 0);
+    regfree(&re);
+    if(status != 0)
+        return VAL_INVALID;
+
+    switch(conv->type) {
+        case VAL_INUM: *val = INUM_VALUE(strtol(str, NULL, 10)); break;
+        case VAL_UNUM: *val = UNUM_VALUE(strtoul(str, NULL, 16)); break;
+        case VAL_FNUM: *val = FNUM_VALUE(strtod(str, NULL)); break;
+        default: *val = BOOL_VALUE(str[0] == 't'); break;
+    }
+    return conv->type;
+}
+
+/*
+ * Convert all of the strings the number of times and return the best rate
+ * of the repeats, in millions of conversions per second.
+ */
+static double measure(Value* strings, const conversion_t* conv, bool regex, int runs, int repeat) {
+
+    double best = 0.0;
+
+    for(int r = 0; r < repeat; r++) {
+        double start = bench_now();
+        for(int i = 0; i < runs; i++) {
+            for(int n = 0; n < STRINGS; n++) {
+                Value val = strings[n];
+                ValueType type = regex? regex_convert(&val, conv): conv_obj_to_val(&val, conv->type);
+                if(type != conv->type)
+                    fatal_error("\"%s\" did not convert", value_as_cstring(&strings[n]));
+            }
+        }
+        double rate = (double)STRINGS * runs / (bench_now() - start) / 1e6;
+        if(rate > best)
+            best = rate;
+    }
+
+    return best;
+}
+
+int main(int argc, char** argv) {
+
+    init_memory();
+    configure(argc, argv);
+    init_errors(stderr);
+    bench_quiet();
+
+    bool quick = GET_CONFIG_BOOL("QUICK");
+    int repeat = quick? 1: GET_CONFIG_NUM("REPEAT");
+    int runs = quick? 1: RUNS;
+    Value strings[STRINGS];
+    char what[64];
+
+    for(int i = 0; i < CONVERSIONS; i++) {
+        const conversion_t* conv = &conversions[i];
+        for(int n = 0; n < STRINGS; n++)
+            strings[n] = make_string(conv->type, n);
+
+        bench_report(conv->name, measure(strings, conv, false, runs, repeat), "Mconv/s");
+        snprintf(what, sizeof(what), "%s (regex)", conv->name);
+        // the regex is slow enough that fewer runs are plenty
+        bench_report(what, measure(strings, conv, true, MAX(1, runs / 20), repeat), "Mconv/s");
+    }
+
+    destroy_config();
+    destroy_strings();
+    destroy_memory();
+    fclose(bench_out);
+    return 0;
+}
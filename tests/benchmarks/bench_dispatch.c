@@ -0,0 +1,134 @@
+/**
+    @file bench_dispatch.c
+
+    @brief Instructions per second through run_vmachine(). The program is one
+    long expression of mixed integer and float literals, so constant folding
+    leaves every operation in, and the VM runs it over and over.
+
+    It is built with threaded dispatch and with the switch, and with each
+    layout of a Value. See codeblocks.h. Each build also runs the program
+    with and without the superinstructions. See fusion.c.
+
+**/
+// clock_gettime() and dup() are POSIX, and --std=c99 hides it.
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#define TERMS 2000
+
+/*
+ * Make "1 + 2.5 - 3 * 4.5 + ..." with the given number of terms. Each
+ * operation has an integer on one side and a float on the other.
+ */
+static char* make_program(int terms) {
+
+    static const char* ops[] = {" + ", " - ", " * ", " + "};
+    char_buffer_t buf = create_char_buffer();
+    char num[32];
+
+    for(int i = 0; i < terms; i++) {
+        if(i > 0)
+            add_char_buffer_str(buf, ops[i % 4]);
+        if(i % 2 == 0)
+            snprintf(num, sizeof(num), "%d", i % 7 + 1);
+        else
+            snprintf(num, sizeof(num), "%d.5", i % 5 + 1);
+        add_char_buffer_str(buf, num);
+    }
+
+    char* text = STRDUP(get_char_buffer(buf));
+    destroy_char_buffer(buf);
+    return text;
+}
+
+/*
+ * The number of instructions in the block. The code has no jumps, so this is
+ * also the number that run.
+ */
+static size_t count_instructions(codeBlock* block) {
+
+    size_t count = 0;
+    for(size_t ip = 0; ip < code_offset(block); ip += 1 + opcode_operands(get_code(block, ip)))
+        count++;
+    return count;
+}
+
+/*
+ * Run the code in the machine the given number of times and return the best
+ * rate of the repeats, in thousands of runs per second.
+ */
+static double measure(VMachine* vm, int runs, int repeat) {
+
+    double best = 0.0;
+
+    for(int r = 0; r < repeat; r++) {
+        double start = bench_now();
+        for(int i = 0; i < runs; i++) {
+            reset_vmachine(vm);
+            vm->lastIp = 0;
+            if(run_vmachine(vm) != INTERPRET_OK)
+                fatal_error("the benchmark program failed");
+        }
+        double rate = runs / (bench_now() - start) / 1e3;
+        if(rate > best)
+            best = rate;
+    }
+
+    return best;
+}
+
+/*
+ * Compile the program with the superinstructions in the spec and return the
+ * machine that runs it.
+ */
+static VMachine* compile_program(const char* text, const char* fusion) {
+
+    init_fusion(fusion);
+    VMachine* vm = create_vmachine();
+    open_scanner_string(text);
+    if(!compile(vm->block))
+        fatal_error("the benchmark program did not compile");
+    return vm;
+}
+
+int main(int argc, char** argv) {
+
+    init_memory();
+    configure(argc, argv);
+    init_errors(stderr);
+    init_scanner();
+    bench_quiet();
+
+    bool quick = GET_CONFIG_BOOL("QUICK");
+    int repeat = quick? 1: GET_CONFIG_NUM("REPEAT");
+    int runs = quick? 10: 2000;
+
+    char* text = make_program(TERMS);
+
+    // the dispatch rate is of the generic opcodes, without superinstructions
+    VMachine* vm = compile_program(text, "none");
+    size_t count = count_instructions(vm->block);
+    double unfused = measure(vm, runs, repeat);
+    destroy_vmachine(vm);
+
+    vm = compile_program(text, "all");
+    size_t fused_count = count_instructions(vm->block);
+    double fused = measure(vm, runs, repeat);
+    destroy_vmachine(vm);
+
+    bench_report("dispatch", unfused * count / 1e3, "Minstr/s");
+    bench_report("runs, unfused", unfused, "Kruns/s");
+    bench_report("runs, fused", fused, "Kruns/s");
+    bench_report("instructions, unfused", (double)count, "instrs");
+    bench_report("instructions, fused", (double)fused_count, "instrs");
+    bench_report("value size", (double)sizeof(Value), "bytes");
+
+    FREE(text);
+    destroy_config();
+    destroy_scanner();
+    destroy_strings();
+    destroy_wide_numbers();
+    destroy_memory();
+    fclose(bench_out);
+    return 0;
+}
@@ -0,0 +1,149 @@
+/**
+    @file bench_scan.c
+
+    @brief Megabytes and tokens per second through the scanner alone. Each
+    input is made in memory and scanned from a string with get_tok(), the way
+    the parser pulls tokens, so neither the disk nor the parser is part of the
+    time.
+
+    It is built with the scalar spans, with SSE2 and with AVX2, to compare
+    them, and with the scalar spans and the <ctype.h> functions in place of
+    the char_class table, to compare the table with what it replaced. See
+    charspan.h.
+
+**/
+// clock_gettime() and dup() are POSIX, and --std=c99 hides them.
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#define INPUT_SIZE (4*1024*1024)
+
+/*
+ * One line of an input. The %d is replaced with the number of the line.
+ */
+typedef struct {
+    const char* name;
+    const char* lines[4];
+} input_t;
+
+static const input_t inputs[] = {
+    {"code", {
+        "    alpha_value%d = beta + 12345 * gamma_delta - 3.25 / epsilon\n",
+        "    if zeta_%d >= 0x1F and not eta or theta != 6.02e23 {\n",
+        "        print(\"iteration %d of the loop\", iota, kappa_lambda)\n",
+        "    } // line %d\n",
+    }},
+    // mostly comments, which memchr() skips, with the indents between them
+    {"comments", {
+        "    /* the term for line %d is computed below, see the notes */\n",
+        "    // a line comment for line %d of the input, with more words in it\n",
+        "    /*\n     * a block comment over several lines, number %d,\n"
+            "     * with some more text in it\n     */\n",
+        "    alpha_%d = beta + 1\n",
+    }},
+    // long identifiers and long runs of white space, which the spans skip
+    {"identifiers", {
+        "a_rather_long_identifier_name_%d + another_identifier_that_is_long\n",
+        "                                x%d                                \n",
+        "\t\tthe_identifier_is_thirty_two_byte + b%d\n",
+        "SHOUTING_IDENTIFIERS_ARE_STILL_IDENTIFIERS_%d * z\n",
+    }},
+};
+
+#define INPUTS (int)(sizeof(inputs) / sizeof(inputs[0]))
+
+/*
+ * Repeat the lines of the input, in turn, until the text is about the size.
+ */
+static char* make_input(const input_t* input, size_t size) {
+
+    char_buffer_t buf = create_char_buffer();
+    char line[256];
+    size_t len = 0;
+
+    for(int i = 0; len < size; i++) {
+        len += snprintf(line, sizeof(line), input->lines[i % 4], i);
+        add_char_buffer_str(buf, line);
+    }
+
+    char* text = STRDUP(get_char_buffer(buf));
+    destroy_char_buffer(buf);
+    return text;
+}
+
+/*
+ * Scan the whole text and return the number of tokens.
+ */
+static size_t scan_text(const char* text) {
+
+    TokenType type;
+    size_t count = 0;
+
+    open_scanner_string(text);
+    do {
+        Token* tok = get_tok();
+        type = tok->type;
+        free_token(tok);
+        count++;
+    } while(type != END_OF_INPUT);
+
+    reset_arena(ARENA_LINE);
+    return count;
+}
+
+/*
+ * Scan the text the number of times and return the best time, in seconds,
+ * and the number of tokens.
+ */
+static double measure(const char* text, int repeat, size_t* tokens) {
+
+    double best = 0.0;
+
+    for(int r = 0; r < repeat; r++) {
+        double start = bench_now();
+        *tokens = scan_text(text);
+        double time = bench_now() - start;
+        if(r == 0 || time < best)
+            best = time;
+    }
+
+    return best;
+}
+
+int main(int argc, char** argv) {
+
+    init_memory();
+    configure(argc, argv);
+    init_errors(stderr);
+    init_scanner();
+    bench_quiet();
+
+#if defined(__AVX2__)
+    if(!__builtin_cpu_supports("avx2")) {
+        fprintf(bench_out, "%-28s skipped, the CPU does not have AVX2\n", BENCH_NAME);
+        return 0;
+    }
+#endif
+
+    bool quick = GET_CONFIG_BOOL("QUICK");
+    int repeat = quick? 1: GET_CONFIG_NUM("REPEAT");
+    size_t size = quick? 64*1024: INPUT_SIZE;
+
+    for(int i = 0; i < INPUTS; i++) {
+        char* text = make_input(&inputs[i], size);
+        size_t tokens = 0;
+        double time = measure(text, repeat, &tokens);
+        if(get_num_errors() + get_num_warnings() > 0)
+            fatal_error("the \"%s\" input did not scan cleanly", inputs[i].name);
+        bench_report(inputs[i].name, strlen(text) / (1024.0 * 1024) / time, "MB/s");
+        bench_report(inputs[i].name, tokens / time / 1e6, "Mtok/s");
+        FREE(text);
+    }
+
+    destroy_config();
+    destroy_scanner();
+    destroy_strings();
+    destroy_memory();
+    fclose(bench_out);
+    return 0;
+}
@@ -0,0 +1,334 @@
+/**
+    @file test_bytecode.c
+
+    @brief Tests for the bytecode loader. A block is written with
+    write_bytecode(), and then the file is cut short, made longer or has a
+    field broken, and try_load_bytecode() must turn each one down before the
+    VM could see it. The constants that folding removes must not be in the
+    file either.
+
+**/
+// mkstemp() is POSIX, and --std=c99 hides it.
+#define _POSIX_C_SOURCE 200809L
+#include <unistd.h>
+
+#define USE_MEMORY 0
+#include "common.h"
+#include "unit_tests.h"
+
+BEGIN_CONFIG
+    CONFIG_BOOL("-b", "BATCH_SCAN", "Scan each input into a token array before parsing", 0, 0, 0)
+    CONFIG_LIST(NULL, "INFILES", "Not used", 0, NULL, 0)
+END_CONFIG
+
+// the file that the broken copies are written to
+static char path[] = "/tmp/test_bytecode_XXXXXX";
+
+// the good file, read back into memory
+static char* image = NULL;
+static size_t image_size = 0;
+
+#define CONSTANT_OFFSET(n) (sizeof(bc_header_t) + (n) * sizeof(bc_constant_t))
+
+// the index of "hello" in the block that make_block() makes
+#define STRING_CONSTANT 4
+
+/*
+ * A block with one constant of each type that a file can hold.
+ */
+static codeBlock* make_block() {
+
+    codeBlock* block = create_codeblock();
+    emit_inum_value(block, -5);
+    emit_fnum_value(block, 2.5);
+    emit_opcode(block, OP_ADD);
+    emit_unum_value(block, 0x10);
+    emit_opcode(block, OP_CONSTANT);
+    add_constant(block, create_value(BOOL_VALUE(true)));
+    emit_obj_value(block, create_string_object("hello", 5));
+    emit_opcode(block, OP_RETURN);
+    return block;
+}
+
+static void write_image(const void* data, size_t size) {
+
+    FILE* fp = fopen(path, "wb");
+    if(fp == NULL || fwrite(data, 1, size, fp) != size || fclose(fp) != 0)
+        fatal_error("cannot write \"%s\"", path);
+}
+
+static void read_image() {
+
+    FILE* fp = fopen(path, "rb");
+    if(fp == NULL)
+        fatal_error("cannot read \"%s\"", path);
+    fseek(fp, 0, SEEK_END);
+    image_size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    image = MALLOC(image_size);
+    if(fread(image, 1, image_size, fp) != image_size)
+        fatal_error("cannot read \"%s\"", path);
+    fclose(fp);
+}
+
+/*
+ * Write the data and return true if the loader takes it.
+ */
+static bool loads(const void* data, size_t size) {
+
+    write_image(data, size);
+    codeBlock* block = try_load_bytecode(path);
+    if(block == NULL)
+        return false;
+    free_codeblock(block);
+    return true;
+}
+
+/*
+ * Return a copy of the good file, to be broken.
+ */
+static char* copy_image() {
+
+    char* copy = MALLOC(image_size + 16);
+    memcpy(copy, image, image_size);
+    return copy;
+}
+
+DEF_TEST(round_trip)
+
+    codeBlock* block = make_block();
+    write_bytecode(block, path);
+    codeBlock* loaded = try_load_bytecode(path);
+    assert_ptr_not_null(loaded);
+
+    if(loaded != NULL) {
+        assert_int_equal((int)code_offset(block), (int)code_offset(loaded));
+        assert_buffer_equal(raw_code_list(block), raw_code_list(loaded),
+                code_offset(block) * sizeof(uint16_t));
+        assert_int_equal(-5, (int)AS_INUM(get_constant(loaded, 0)));
+        assert_double_equal(2.5, AS_FNUM(get_constant(loaded, 1)), 0.0);
+        assert_int_equal(0x10, (int)AS_UNUM(get_constant(loaded, 2)));
+        assert_int_equal(true, AS_BOOL(get_constant(loaded, 3)));
+        assert_string_equal("hello", value_as_cstring(get_constant(loaded, 4)));
+        free_codeblock(loaded);
+    }
+    free_codeblock(block);
+
+END_TEST
+
+DEF_TEST(truncated)
+
+    // every length that is shorter than the file
+    for(size_t len = 0; len < image_size; len++)
+        assert_int_equal(false, loads(image, len));
+    assert_int_equal(true, loads(image, image_size));
+
+END_TEST
+
+DEF_TEST(wrong_size)
+
+    char* copy = copy_image();
+    bc_header_t* header = (bc_header_t*)copy;
+
+    // extra bytes at the end
+    memset(copy + image_size, 0, 16);
+    for(size_t extra = 1; extra <= 16; extra++)
+        assert_int_equal(false, loads(copy, image_size + extra));
+
+    // each count in the header is one more, and one less, than the file holds
+    uint32_t* counts[] = {&header->nconstants, &header->ncode, &header->nstrings};
+    for(size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        uint32_t good = *counts[i];
+        *counts[i] = good + 1;
+        assert_int_equal(false, loads(copy, image_size));
+        *counts[i] = good - 1;
+        assert_int_equal(false, loads(copy, image_size));
+        *counts[i] = 0xFFFFFFFF;
+        assert_int_equal(false, loads(copy, image_size));
+        *counts[i] = good;
+    }
+    assert_int_equal(true, loads(copy, image_size));
+
+    FREE(copy);
+
+END_TEST
+
+DEF_TEST(bad_header)
+
+    char* copy = copy_image();
+    bc_header_t* header = (bc_header_t*)copy;
+
+    header->magic[0] = 'X';
+    assert_int_equal(false, loads(copy, image_size));
+    memcpy(copy, image, image_size);
+
+    header->version = BYTECODE_VERSION + 1;
+    assert_int_equal(false, loads(copy, image_size));
+    memcpy(copy, image, image_size);
+
+    header->byte_order = 0x0201;
+    assert_int_equal(false, loads(copy, image_size));
+
+    FREE(copy);
+
+END_TEST
+
+DEF_TEST(bad_type)
+
+    char* copy = copy_image();
+    uint32_t nconstants = ((bc_header_t*)image)->nconstants;
+
+    // types that a constant cannot have, in every slot
+    static const int types[] = {VAL_INVALID, VAL_OBJ + 1, 99, 255};
+    for(uint32_t n = 0; n < nconstants; n++) {
+        bc_constant_t* constant = (bc_constant_t*)(copy + CONSTANT_OFFSET(n));
+        for(size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            constant->type = (uint8_t)types[i];
+            assert_int_equal(false, loads(copy, image_size));
+        }
+        memcpy(copy, image, image_size);
+    }
+
+    // a number that claims to be a string, which is out of the string area
+    bc_constant_t* constant = (bc_constant_t*)(copy + CONSTANT_OFFSET(0));
+    constant->type = VAL_OBJ;
+    constant->bits = 1000;
+    assert_int_equal(false, loads(copy, image_size));
+    memcpy(copy, image, image_size);
+
+    // the string, with an offset and a length that wrap around when they are
+    // added, or that run past the end of the string area
+    constant = (bc_constant_t*)(copy + CONSTANT_OFFSET(STRING_CONSTANT));
+    uint32_t nstrings = ((bc_header_t*)image)->nstrings;
+    static const struct {
+        uint64_t bits;
+        uint32_t len;
+    } ranges[] = {
+        {UINT64_MAX - 0x10000000 + 1, 0x10000000},
+        {UINT64_MAX, 1},
+        {UINT64_MAX, 0},
+        {0, 0xFFFFFFFF},
+        {1, 0xFFFFFFFF},
+        // inside the area, but without the terminator after them
+        {0, 0},
+        {0, 4},
+    };
+    for(size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+        constant->bits = ranges[i].bits;
+        constant->len = ranges[i].len;
+        assert_int_equal(false, loads(copy, image_size));
+    }
+    constant->bits = nstrings;
+    constant->len = 0;
+    assert_int_equal(false, loads(copy, image_size));
+    constant->bits = 0;
+    constant->len = nstrings;
+    assert_int_equal(false, loads(copy, image_size));
+
+    FREE(copy);
+
+END_TEST
+
+DEF_TEST(bad_code)
+
+    char* copy = copy_image();
+    const bc_header_t* header = (const bc_header_t*)image;
+    uint16_t* code = (uint16_t*)(copy + CONSTANT_OFFSET(header->nconstants));
+    uint32_t ncode = header->ncode;
+
+    code[0] = OP_COUNT;
+    assert_int_equal(false, loads(copy, image_size));
+    memcpy(copy, image, image_size);
+
+    // the operand of the first OP_CONSTANT
+    code[1] = (uint16_t)header->nconstants;
+    assert_int_equal(false, loads(copy, image_size));
+    memcpy(copy, image, image_size);
+
+    // no return at the end
+    code[ncode - 1] = OP_NOT;
+    assert_int_equal(false, loads(copy, image_size));
+    memcpy(copy, image, image_size);
+
+    // the last instruction needs an operand that is not there
+    code[ncode - 1] = OP_CONSTANT;
+    assert_int_equal(false, loads(copy, image_size));
+
+    FREE(copy);
+
+END_TEST
+
+DEF_TEST(not_there)
+
+    assert_ptr_null(try_load_bytecode("/nonexistent/file.atc"));
+
+END_TEST
+
+DEF_TEST(folded_constants)
+
+    // 5 and 6 are folded away with their keys, so the last 5 is added again
+    // instead of being taken for the 11 that is in their slot now
+    codeBlock* block = create_codeblock();
+    open_scanner_string("(5 + 6) + 0x1 + 5");
+    assert_int_equal(true, compile(block));
+    assert_int_equal(3, (int)value_list_size(block));
+    write_bytecode(block, path);
+    free_codeblock(block);
+
+    codeBlock* loaded = try_load_bytecode(path);
+    assert_ptr_not_null(loaded);
+    if(loaded != NULL) {
+        assert_int_equal(3, (int)value_list_size(loaded));
+        VMachine* vm = create_vmachine();
+        load_vmachine(vm, loaded);
+        assert_int_equal(INTERPRET_OK, run_vmachine(vm));
+        assert_int_equal(17, (int)AS_INUM(peek_value_stack(vm)));
+        destroy_vmachine(vm);
+    }
+
+    // the 1s were in the pool before the fold, so they stay
+    block = create_codeblock();
+    open_scanner_string("1 + 0x1 + (1 + 1)");
+    assert_int_equal(true, compile(block));
+    assert_int_equal(3, (int)value_list_size(block));
+    assert_int_equal(1, (int)AS_INUM(get_constant(block, 0)));
+    assert_int_equal(2, (int)AS_INUM(get_constant(block, 2)));
+    free_codeblock(block);
+
+END_TEST
+
+static void remove_image() {
+
+    unlink(path);
+    if(image != NULL)
+        FREE(image);
+}
+
+DEF_TEST_MAIN("bytecode")
+
+    init_memory();
+    init_errors(stdout);
+    init_scanner();
+
+    int fd = mkstemp(path);
+    if(fd < 0)
+        fatal_error("cannot make a temporary file");
+    close(fd);
+    atexit(remove_image);
+
+    // the good file that the others are made from
+    codeBlock* block = make_block();
+    write_bytecode(block, path);
+    free_codeblock(block);
+    read_image();
+
+    ADD_TEST(round_trip);
+    ADD_TEST(truncated);
+    ADD_TEST(wrong_size);
+    ADD_TEST(bad_header);
+    ADD_TEST(bad_type);
+    ADD_TEST(bad_code);
+    ADD_TEST(not_there);
+    ADD_TEST(folded_constants);
+
+END_TEST_MAIN
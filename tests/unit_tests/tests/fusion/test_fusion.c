@@ -0,0 +1,239 @@
+/**
+    @file test_fusion.c
+
+    @brief Tests for fuse_code(). Blocks are built by hand and fused, and the
+    code is checked word by word. Expressions are also compiled and run with
+    all of the superinstructions and with none, and must get the same values.
+
+**/
+#define USE_MEMORY 0
+#include "common.h"
+#include "unit_tests.h"
+
+BEGIN_CONFIG
+    CONFIG_BOOL("-b", "BATCH_SCAN", "Scan each input into a token array before parsing", 0, 0, 0)
+    CONFIG_LIST(NULL, "INFILES", "Not used", 0, NULL, 0)
+END_CONFIG
+
+#define PAIR_FILE "test_fusion_pairs.txt"
+
+// the code must be exactly the expected words
+#define CHECK_CODE(block, exp) \
+    do { \
+        assert_int_equal((int)(sizeof(exp) / sizeof(exp[0])), (int)code_offset(block)); \
+        if(code_offset(block) == sizeof(exp) / sizeof(exp[0])) \
+            assert_buffer_equal((exp), raw_code_list(block), sizeof(exp)); \
+    } while(false)
+
+DEF_TEST(const_op)
+
+    init_fusion("all");
+
+    // the first constant has no operation after it
+    codeBlock* block = create_codeblock();
+    emit_inum_value(block, 1);
+    emit_opcode(block, OP_NEG);
+    emit_inum_value(block, 2);
+    emit_opcode(block, OP_ADD);
+    emit_opcode(block, OP_RETURN);
+
+    static const uint16_t exp[] = {
+        OP_CONSTANT, 0, OP_NEG, OP_ADD_CONST, 1, OP_RETURN,
+    };
+    assert_int_equal(1, fuse_code(block, 0));
+    CHECK_CODE(block, exp);
+    free_codeblock(block);
+
+END_TEST
+
+DEF_TEST(const_const_op)
+
+    init_fusion("all");
+
+    codeBlock* block = create_codeblock();
+    emit_inum_value(block, 6);
+    emit_fnum_value(block, 2.5);
+    emit_opcode(block, OP_LT);
+    emit_opcode(block, OP_RETURN);
+
+    static const uint16_t exp[] = {
+        OP_LT_CONST_CONST, 0, 1, OP_RETURN,
+    };
+    assert_int_equal(2, fuse_code(block, 0));
+    CHECK_CODE(block, exp);
+    free_codeblock(block);
+
+END_TEST
+
+DEF_TEST(three_constants)
+
+    init_fusion("all");
+
+    // 1 - (2 + 3): only the last two constants are before an operation
+    codeBlock* block = create_codeblock();
+    emit_inum_value(block, 1);
+    emit_inum_value(block, 2);
+    emit_inum_value(block, 3);
+    emit_opcode(block, OP_ADD);
+    emit_opcode(block, OP_SUB);
+    emit_opcode(block, OP_RETURN);
+
+    static const uint16_t exp[] = {
+        OP_CONSTANT, 0, OP_ADD_CONST_CONST, 1, 2, OP_SUB, OP_RETURN,
+    };
+    assert_int_equal(2, fuse_code(block, 0));
+    CHECK_CODE(block, exp);
+    free_codeblock(block);
+
+END_TEST
+
+DEF_TEST(fuse_none)
+
+    init_fusion("none");
+    assert_int_equal(0, (int)fusion_mask());
+
+    codeBlock* block = create_codeblock();
+    emit_inum_value(block, 1);
+    emit_inum_value(block, 2);
+    emit_opcode(block, OP_ADD);
+    emit_opcode(block, OP_RETURN);
+
+    static const uint16_t exp[] = {
+        OP_CONSTANT, 0, OP_CONSTANT, 1, OP_ADD, OP_RETURN,
+    };
+    assert_int_equal(0, fuse_code(block, 0));
+    CHECK_CODE(block, exp);
+    free_codeblock(block);
+
+END_TEST
+
+DEF_TEST(pair_file)
+
+    // the add pairs are common, the subtract pair is under 1% of the total
+    FILE* fp = fopen(PAIR_FILE, "w");
+    assert_ptr_not_null(fp);
+    if(fp == NULL)
+        return;
+    fprintf(fp, "# opcode pairs counted with --pairs\n# count first second\n");
+    fprintf(fp, "5000 OP_CONSTANT OP_ADD\n");
+    fprintf(fp, "3000 OP_CONSTANT OP_CONSTANT\n");
+    fprintf(fp, "2000 OP_ADD OP_RETURN\n");
+    fprintf(fp, "10 OP_CONSTANT OP_SUB\n");
+    fprintf(fp, "7 OP_NO_SUCH_OPCODE OP_ADD\n");
+    fclose(fp);
+
+    init_fusion(PAIR_FILE);
+    remove(PAIR_FILE);
+    uint32_t mask = (1u << (OP_ADD_CONST - OP_ADD_CONST)) |
+                    (1u << (OP_ADD_CONST_CONST - OP_ADD_CONST));
+    assert_uint_equal(mask, fusion_mask());
+
+    codeBlock* block = create_codeblock();
+    emit_inum_value(block, 1);
+    emit_inum_value(block, 2);
+    emit_opcode(block, OP_ADD);
+    emit_inum_value(block, 3);
+    emit_opcode(block, OP_SUB);
+    emit_inum_value(block, 4);
+    emit_opcode(block, OP_ADD);
+    emit_opcode(block, OP_RETURN);
+
+    static const uint16_t exp[] = {
+        OP_ADD_CONST_CONST, 0, 1, OP_CONSTANT, 2, OP_SUB, OP_ADD_CONST, 3, OP_RETURN,
+    };
+    assert_int_equal(3, fuse_code(block, 0));
+    CHECK_CODE(block, exp);
+    free_codeblock(block);
+
+END_TEST
+
+/*
+ * Compile and run the text with the superinstructions in the spec. The
+ * value is left in the result, and fused is set if the code has a
+ * superinstruction in it.
+ */
+static InterpretResult run_text(const char* spec, const char* text, Value* result, bool* fused) {
+
+    init_fusion(spec);
+    VMachine* vm = create_vmachine();
+    open_scanner_string(text);
+
+    InterpretResult res = INTERPRET_COMPILE_ERROR;
+    if(compile(vm->block))
+        res = run_vmachine(vm);
+    if(res == INTERPRET_OK)
+        *result = *peek_value_stack(vm);
+
+    *fused = false;
+    for(size_t i = 0; i < code_offset(vm->block); i += 1 + opcode_operands(get_code(vm->block, i)))
+        if(opcode_operands(get_code(vm->block, i)) > 0 && get_code(vm->block, i) != OP_CONSTANT)
+            *fused = true;
+
+    destroy_vmachine(vm);
+    return res;
+}
+
+static bool same_value(Value* v1, Value* v2) {
+
+    if(VALUE_TYPE(v1) != VALUE_TYPE(v2))
+        return false;
+    switch(VALUE_TYPE(v1)) {
+        case VAL_INUM: return AS_INUM(v1) == AS_INUM(v2);
+        case VAL_UNUM: return AS_UNUM(v1) == AS_UNUM(v2);
+        case VAL_BOOL: return AS_BOOL(v1) == AS_BOOL(v2);
+        case VAL_FNUM: {
+                // the bits, so that a NaN is the same as itself
+                double f1 = AS_FNUM(v1), f2 = AS_FNUM(v2);
+                return !memcmp(&f1, &f2, sizeof(double));
+            }
+        default: return false;
+    }
+}
+
+DEF_TEST(same_results)
+
+    // mixed types are left to the machine, so these have constants before
+    // generic operations
+    static const char* texts[] = {
+        "1 + 0x2",
+        "0x10 - 3 * 2.5",
+        "1.5 - (2 + 0x3)",
+        "7 % 0x3 + 0.5",
+        "0x8 / 2 * 1.0",
+        "1 < 0x2",
+        "2.5 >= 0x3",
+        "0x4 == 4",
+        "1 != 0x1",
+        "(0x7FFFFFFFFFFFFFFF + 1) * 2",
+        "7 / (0x0 + 0)",
+    };
+
+    for(size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        Value fused_val = NOTHING_VALUE, plain_val = NOTHING_VALUE;
+        bool fused, plain;
+        InterpretResult r1 = run_text("all", texts[i], &fused_val, &fused);
+        InterpretResult r2 = run_text("none", texts[i], &plain_val, &plain);
+
+        bool ok = fused && !plain && r1 == r2 &&
+                    (r1 != INTERPRET_OK || same_value(&fused_val, &plain_val));
+        if(!ok)
+            printf("failed: \"%s\"\n", texts[i]);
+        assert_int_equal(true, ok);
+    }
+
+END_TEST
+
+DEF_TEST_MAIN("fusion")
+
+    init_memory();
+    init_errors(stdout);
+    init_scanner();
+
+    ADD_TEST(const_op);
+    ADD_TEST(const_const_op);
+    ADD_TEST(three_constants);
+    ADD_TEST(fuse_none);
+    ADD_TEST(pair_file);
+    ADD_TEST(same_results);
+
+END_TEST_MAIN
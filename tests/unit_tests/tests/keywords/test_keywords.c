@@ -0,0 +1,137 @@
+/**
+    @file test_keywords.c
+
+    @brief Tests for the keyword lookup in the scanner. The keywords come from
+    the same list that mkkeywords builds the perfect hash from, so every one
+    of them is checked, along with the words that are one change away from
+    each of them.
+
+**/
+#define USE_MEMORY 0
+#include "common.h"
+#include "unit_tests.h"
+
+BEGIN_CONFIG
+    CONFIG_BOOL("-b", "BATCH_SCAN", "Scan each input into a token array before parsing", 0, 0, 0)
+    CONFIG_LIST(NULL, "INFILES", "Not used", 0, NULL, 0)
+END_CONFIG
+
+typedef struct {
+    const char* str;
+    TokenType tok;
+} keyword_t;
+
+static const keyword_t keywords[] = {
+#include "../../../keywordlist.txt"
+};
+
+#define NUM_KEYWORDS (int)(sizeof(keywords) / sizeof(keywords[0]))
+#define MAX_WORD 64
+
+/*
+ * Scan the text and return the type of the first token. The rest of the
+ * text is scanned too, so that the next text starts clean.
+ */
+static TokenType first_token(const char* text) {
+
+    TokenType first = END_OF_INPUT;
+    TokenType type;
+    bool seen = false;
+
+    reset_arena(ARENA_LINE);
+    open_scanner_string(text);
+    do {
+        Token* tok = get_tok();
+        type = tok->type;
+        if(!seen) {
+            first = type;
+            seen = true;
+        }
+        free_token(tok);
+    } while(type != END_OF_INPUT);
+
+    return first;
+}
+
+/*
+ * The token that a word should scan to.
+ */
+static TokenType expected_token(const char* word) {
+
+    for(int i = 0; i < NUM_KEYWORDS; i++)
+        if(!strcmp(keywords[i].str, word))
+            return keywords[i].tok;
+    return SYMBOL_TOKEN;
+}
+
+DEF_TEST(every_keyword)
+
+    char text[MAX_WORD];
+
+    for(int i = 0; i < NUM_KEYWORDS; i++) {
+        assert_int_equal(keywords[i].tok, first_token(keywords[i].str));
+
+        // with something on each side
+        snprintf(text, sizeof(text), "  %s(", keywords[i].str);
+        assert_int_equal(keywords[i].tok, first_token(text));
+    }
+
+END_TEST
+
+DEF_TEST(near_misses)
+
+    static const char* words[] = {
+        "truex", "_true", "xtrue", "true_", "true1", "tru", "True", "TRUE",
+        "nothin", "nothingx", "gtx", "g", "whilee", "whil", "_", "__while",
+    };
+
+    for(size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+        assert_int_equal(SYMBOL_TOKEN, first_token(words[i]));
+
+END_TEST
+
+DEF_TEST(one_change_away)
+
+    char word[MAX_WORD];
+
+    // a word is only a keyword if it is in the list, so "gt" is still a
+    // keyword when "gte" is cut short
+    for(int i = 0; i < NUM_KEYWORDS; i++) {
+        const char* kw = keywords[i].str;
+        size_t len = strlen(kw);
+
+        snprintf(word, sizeof(word), "%sx", kw);
+        assert_int_equal(expected_token(word), first_token(word));
+
+        snprintf(word, sizeof(word), "_%s", kw);
+        assert_int_equal(SYMBOL_TOKEN, first_token(word));
+
+        snprintf(word, sizeof(word), "%s_", kw);
+        assert_int_equal(SYMBOL_TOKEN, first_token(word));
+
+        snprintf(word, sizeof(word), "%.*s", (int)len - 1, kw);
+        if(len > 1)
+            assert_int_equal(expected_token(word), first_token(word));
+
+        snprintf(word, sizeof(word), "%s", kw);
+        word[0] ^= 0x20;
+        assert_int_equal(SYMBOL_TOKEN, first_token(word));
+
+        snprintf(word, sizeof(word), "%s", kw);
+        word[len - 1] = (word[len - 1] == 'z')? 'a': word[len - 1] + 1;
+        assert_int_equal(expected_token(word), first_token(word));
+    }
+
+END_TEST
+
+DEF_TEST_MAIN("keywords")
+
+    init_memory();
+    init_errors(stdout);
+    init_scanner();
+
+    ADD_TEST(every_keyword);
+    ADD_TEST(near_misses);
+    ADD_TEST(one_change_away);
+
+END_TEST_MAIN
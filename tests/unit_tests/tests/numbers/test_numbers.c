@@ -0,0 +1,238 @@
+/**
+    @file test_numbers.c
+
+    @brief Tests for the number parsers in numbers.c. Every result is checked
+    against strtod(), strtoll() or strtoull() on the same text, so that the
+    scanner and the VM agree with libc to the last bit. The cases are picked
+    to go down each path of parse_float_number(): the Clinger fast path,
+    Eisel-Lemire, and the strtod() fallback for long mantissas that cannot be
+    decided from 19 digits.
+
+**/
+#define USE_MEMORY 0
+#include <errno.h>
+#include <math.h>
+
+#include "common.h"
+#include "unit_tests.h"
+
+BEGIN_CONFIG
+    CONFIG_LIST(NULL, "INFILES", "Not used", 0, NULL, 0)
+END_CONFIG
+
+#define MAX_NUMBER 128
+#define RANDOM_FLOATS 200000
+
+/*
+ * Return true if the text parses to the same bits that strtod() gives.
+ */
+static bool same_as_strtod(const char* text) {
+
+    double got;
+    if(!parse_float_number(text, strlen(text), &got))
+        return false;
+
+    double want = strtod(text, NULL);
+    return !memcmp(&got, &want, sizeof(double));
+}
+
+/*
+ * Check a list of floats against strtod().
+ */
+#define assert_floats(test, list) \
+    do { \
+        for(size_t i = 0; i < sizeof(list) / sizeof(list[0]); i++) { \
+            if(same_as_strtod(list[i])) \
+                unit_pass("\"%s\"", list[i]); \
+            else \
+                unit_fail("\"%s\" is not the same as strtod()", list[i]); \
+        } \
+    } while(0)
+
+DEF_TEST(clinger)
+
+    // at most 2^53 and at most 10^22, so one exact multiply or divide
+    static const char* floats[] = {
+        "0", "0.0", "-0.0", "1", "1.5", "-2.25", ".5", "5.", "3.14159",
+        "9007199254740992", "9007199254740992e22", "1e22", "1e-22",
+        "123456789012345e-22", "0.000001", "4503599627370497.5",
+        "+7.0e+3", "1E5", "2e0",
+    };
+    assert_floats(test, floats);
+
+END_TEST
+
+DEF_TEST(eisel_lemire)
+
+    // outside the exact range, but 19 digits or fewer
+    static const char* floats[] = {
+        "1e23", "1e-23", "0.1", "0.3", "9007199254740993", "9007199254740995",
+        "9007199254740993e1", "1.7976931348623157e308", "2.2250738585072014e-308",
+        "2.2250738585072011e-308", "4.9406564584124654e-324", "5e-324",
+        "2.4703282292062328e-324", "2.4703282292062327e-324", "1e-324",
+        "7.2057594037927933e16", "8.98846567431158e307", "123456789e-300",
+        "1844674407370955161e10", "1e308", "1e-307",
+    };
+    assert_floats(test, floats);
+
+END_TEST
+
+DEF_TEST(strtod_fallback)
+
+    // more than 19 digits, some of them right at a half way point, so that
+    // the digits after the 19th decide which way it rounds
+    static const char* floats[] = {
+        "1.00000000000000011102230246251565404236316680908203125",
+        "1.00000000000000011102230246251565404236316680908203124",
+        "1.00000000000000011102230246251565404236316680908203126",
+        "9007199254740993.0000000000000000000001",
+        "9007199254740992.9999999999999999999999",
+        "3.14159265358979323846264338327950288",
+        "2.47032822920623272088284396434110686182529901307162382212792841250337753635104375932649918180817996189898282347722858865463328355177969898199387398005390939063150356595155702263922908583924491051844359318028499365361525003193704576782492193656236698636584807570015857692699037063119282795585513329278343384093519780155312465972635795746227664652728272200563740064854999770965994704540208281662262378573934507363390079677619305775067401763246736009689513405355374585166611342237666786041621596804619144672918403005300575308490487653917113865916462395249126236538818796362393732804238910186723484976682350898633885879256283027559956575244555072551893136908362547791869486679949683240497058210285131854513962138377228261454376934125320985913276672363281255",
+        "0.00000000000000000000000000000000001000000000000000000000000000000000001",
+        "00000000000000000000000000000001.5",
+        "1.50000000000000000000000000000000",
+    };
+    assert_floats(test, floats);
+
+END_TEST
+
+DEF_TEST(float_overflow)
+
+    // too big is infinity and too small is zero, the same as strtod()
+    static const char* floats[] = {
+        "1e309", "-1e309", "1.7976931348623159e308", "1e400", "1e-400",
+        "-1e-400", "1e99999999999", "1e-99999999999", "0e999999",
+        "179769313486231580793728971405301e276",
+    };
+    assert_floats(test, floats);
+
+END_TEST
+
+DEF_TEST(float_syntax)
+
+    static const char* bad[] = {"", ".", "-", "+.", "e5", "1e", "1e+", "1.2.3", "1x", "0x10", " 1", "1 "};
+    double num;
+
+    for(size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+        assert_int_equal(false, parse_float_number(bad[i], strlen(bad[i]), &num));
+
+END_TEST
+
+/*
+ * The same numbers every run.
+ */
+static uint64_t random_state = 0x9E3779B97F4A7C15u;
+
+static uint64_t next_random() {
+
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+DEF_TEST(random_floats)
+
+    char text[MAX_NUMBER];
+    int failures = 0;
+
+    // 1 to 25 digits, with the point anywhere and an exponent that covers
+    // the whole range of double
+    for(int n = 0; n < RANDOM_FLOATS; n++) {
+        int digits = 1 + next_random() % 25;
+        int point = next_random() % (digits + 1);
+        int len = 0;
+
+        for(int i = 0; i < digits; i++) {
+            if(i == point)
+                text[len++] = '.';
+            text[len++] = '0' + next_random() % 10;
+        }
+        snprintf(&text[len], sizeof(text) - len, "e%d", (int)(next_random() % 700) - 350);
+
+        if(!same_as_strtod(text) && failures++ < 10)
+            unit_fail("\"%s\" is not the same as strtod()", text);
+    }
+
+    if(failures == 0)
+        unit_pass("%d random floats", RANDOM_FLOATS);
+
+END_TEST
+
+DEF_TEST(signed_overflow)
+
+    static const char* numbers[] = {
+        "0", "-0", "+5", "9223372036854775807", "-9223372036854775808",
+        "9223372036854775808", "-9223372036854775809", "18446744073709551615",
+        "99999999999999999999", "1000000000000000000", "-1000000000000000000",
+    };
+
+    for(size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+        int64_t got;
+        bool ok = parse_signed_number(numbers[i], strlen(numbers[i]), &got);
+
+        errno = 0;
+        long long want = strtoll(numbers[i], NULL, 10);
+        if(errno == ERANGE)
+            assert_int_equal(false, ok);
+        else if(!ok || got != want)
+            unit_fail("\"%s\" is not the same as strtoll()", numbers[i]);
+        else
+            unit_pass("\"%s\"", numbers[i]);
+    }
+
+    // a leading zero is not a decimal number
+    int64_t num;
+    assert_int_equal(false, parse_signed_number("012", 3, &num));
+
+END_TEST
+
+DEF_TEST(unsigned_overflow)
+
+    static const char* numbers[] = {
+        "0x0", "0x1", "0XaBcD", "0x7FFFFFFFFFFFFFFF", "0x8000000000000000",
+        "0xFFFFFFFFFFFFFFFF", "0x10000000000000000", "0x00000000000000000001",
+        "0xFFFFFFFFFFFFFFFFF",
+    };
+
+    for(size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+        uint64_t got;
+        bool ok = parse_unsigned_number(numbers[i], strlen(numbers[i]), &got);
+
+        errno = 0;
+        unsigned long long want = strtoull(numbers[i], NULL, 16);
+        if(errno == ERANGE)
+            assert_int_equal(false, ok);
+        else if(!ok || got != want)
+            unit_fail("\"%s\" is not the same as strtoull()", numbers[i]);
+        else
+            unit_pass("\"%s\"", numbers[i]);
+    }
+
+    // the digits alone, as the scanner uses them
+    uint64_t num;
+    assert_int_equal(true, parse_decimal_digits("18446744073709551615", 20, &num));
+    assert_int_equal(true, (num == UINT64_MAX));
+    assert_int_equal(false, parse_decimal_digits("18446744073709551616", 20, &num));
+    assert_int_equal(false, parse_unsigned_number("0x", 2, &num));
+    assert_int_equal(false, parse_hex_digits("", 0, &num));
+    assert_int_equal(false, parse_hex_digits("12g", 3, &num));
+
+END_TEST
+
+DEF_TEST_MAIN("numbers")
+
+    init_memory();
+    init_errors(stdout);
+
+    ADD_TEST(clinger);
+    ADD_TEST(eisel_lemire);
+    ADD_TEST(strtod_fallback);
+    ADD_TEST(float_overflow);
+    ADD_TEST(float_syntax);
+    ADD_TEST(random_floats);
+    ADD_TEST(signed_overflow);
+    ADD_TEST(unsigned_overflow);
+
+END_TEST_MAIN
@@ -0,0 +1,266 @@
+/**
+    @file test_scanner.c
+
+    @brief Tests for the scanner where it skips ahead in blocks. White space
+    and identifiers are spanned 16 or 32 bytes at a time (see charspan.h) and
+    comments are skipped with memchr(), so the tests put the ends of those
+    runs on every offset around the block boundaries. A number that is too
+    large is also checked, because its error is posted by the scanner.
+
+**/
+#define USE_MEMORY 0
+#include "common.h"
+#include "unit_tests.h"
+
+BEGIN_CONFIG
+    CONFIG_BOOL("-b", "BATCH_SCAN", "Scan each input into a token array before parsing", 0, 0, 0)
+    CONFIG_LIST(NULL, "INFILES", "Not used", 0, NULL, 0)
+END_CONFIG
+
+#define MAX_TOKENS 16
+#define MAX_TEXT 256
+#define MAX_IDENT 80
+
+/*
+ * Scan all of the text, through END_OF_INPUT, and copy the first tokens.
+ * Returns the number of tokens that were scanned.
+ */
+static int scan_all(const char* text, Token* toks) {
+
+    int count = 0;
+    TokenType type;
+
+    reset_arena(ARENA_LINE);
+    open_scanner_string(text);
+    do {
+        Token* tok = get_tok();
+        type = tok->type;
+        if(count < MAX_TOKENS)
+            toks[count] = *tok;
+        count++;
+        free_token(tok);
+    } while(type != END_OF_INPUT);
+
+    return count;
+}
+
+/*
+ * Make an identifier of the length that mixes all of the kinds of identifier
+ * character. It is never a keyword, because no keyword starts with 'x'.
+ */
+static void make_ident(char* buf, int len) {
+
+    static const char chars[] = "xY_7q";
+    for(int i = 0; i < len; i++)
+        buf[i] = chars[i % 5];
+    buf[len] = '\0';
+}
+
+DEF_TEST(block_comments)
+
+    Token toks[MAX_TOKENS];
+    static const char* texts[] = {
+        "/* one */ 12",
+        "/**/12",
+        "/***/ 12",
+        "/** stars * inside **/ 12",
+        "/* a / * b */ 12",
+        "/*\n\n\n*/ 12",
+        "12 /* after */",
+    };
+
+    for(size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        scan_all(texts[i], toks);
+        int index = (toks[0].type == INUM_TOKEN)? 0: 1;
+        assert_int_equal(INUM_TOKEN, toks[index].type);
+        assert_int_equal(12, (int)toks[index].num.inum);
+    }
+
+END_TEST
+
+DEF_TEST(block_comment_lines)
+
+    Token toks[MAX_TOKENS];
+    scan_all("x", toks);
+    int first = toks[0].line_no;
+
+    scan_all("/*\n\n\n*/ x", toks);
+    assert_int_equal(SYMBOL_TOKEN, toks[0].type);
+    assert_int_equal(first + 3, toks[0].line_no);
+
+    scan_all("// one\n// two\nx", toks);
+    assert_int_equal(SYMBOL_TOKEN, toks[0].type);
+    assert_int_equal(first + 2, toks[0].line_no);
+
+END_TEST
+
+DEF_TEST(block_comment_boundaries)
+
+    Token toks[MAX_TOKENS];
+    char text[MAX_TEXT];
+
+    // the closing */ lands on every offset, and straddles each boundary
+    for(int len = 0; len <= 70; len++) {
+        int n = 0;
+        text[n++] = '/';
+        text[n++] = '*';
+        for(int i = 0; i < len; i++)
+            text[n++] = (i % 7 == 6)? '*': 'c';
+        strcpy(&text[n], "*/z");
+
+        scan_all(text, toks);
+        assert_int_equal(SYMBOL_TOKEN, toks[0].type);
+        assert_int_equal(1, (int)toks[0].len);
+        assert_int_equal('z', toks[0].str[0]);
+    }
+
+END_TEST
+
+DEF_TEST(unterminated_comment)
+
+    Token toks[MAX_TOKENS];
+    static const char* texts[] = {"/* no end", "/* no end *", "/*", "/* / */ /*"};
+
+    for(size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        int errors = get_num_errors();
+        int count = scan_all(texts[i], toks);
+        assert_int_equal(errors + 1, get_num_errors());
+        assert_int_equal(END_OF_FILE, toks[count - 2].type);
+    }
+
+END_TEST
+
+DEF_TEST(number_overflow)
+
+    // one error, and the number is still a number token, so the parser has
+    // nothing more to report
+    Token toks[MAX_TOKENS];
+    static const struct {
+        const char* text;
+        TokenType type;
+    } texts[] = {
+        {"99999999999999999999999 + 1", INUM_TOKEN},
+        {"9223372036854775809 + 1", INUM_TOKEN},
+        {"0xFFFFFFFFFFFFFFFFF + 1", UNUM_TOKEN},
+    };
+
+    for(size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        int errors = get_num_errors();
+        int count = scan_all(texts[i].text, toks);
+        assert_int_equal(errors + 1, get_num_errors());
+        assert_int_equal(5, count);
+        assert_int_equal(texts[i].type, toks[0].type);
+        assert_int_equal(ADD_TOKEN, toks[1].type);
+        assert_int_equal(INUM_TOKEN, toks[2].type);
+    }
+
+END_TEST
+
+DEF_TEST(identifier_boundaries)
+
+    Token toks[MAX_TOKENS];
+    char ident[MAX_IDENT];
+    char text[MAX_TEXT];
+
+    // the end of the identifier lands on every offset from the start of the
+    // text, and from the start of the identifier
+    for(int pad = 0; pad <= 33; pad++) {
+        for(int len = 1; len <= 70; len++) {
+            make_ident(ident, len);
+            snprintf(text, sizeof(text), "%*s%s+1", pad, "", ident);
+
+            scan_all(text, toks);
+            assert_int_equal(SYMBOL_TOKEN, toks[0].type);
+            assert_int_equal(len, (int)toks[0].len);
+            assert_buffer_equal(ident, toks[0].str, len);
+            assert_int_equal(ADD_TOKEN, toks[1].type);
+        }
+    }
+
+END_TEST
+
+DEF_TEST(identifier_at_end)
+
+    Token toks[MAX_TOKENS];
+    char text[MAX_TEXT];
+
+    // nothing after the identifier, so the block loads stop at the end
+    for(int len = 1; len <= 70; len++) {
+        make_ident(text, len);
+        scan_all(text, toks);
+        assert_int_equal(SYMBOL_TOKEN, toks[0].type);
+        assert_int_equal(len, (int)toks[0].len);
+        assert_int_equal(END_OF_FILE, toks[1].type);
+    }
+
+END_TEST
+
+DEF_TEST(identifier_terminators)
+
+    Token toks[MAX_TOKENS];
+    char ident[MAX_IDENT];
+    char text[MAX_TEXT];
+
+    // the characters on each side of the ranges that the vector code tests
+    static const char stops[] = "/:@[`{()+-*.,<>=!&|";
+
+    for(size_t s = 0; s < sizeof(stops) - 1; s++) {
+        for(int len = 14; len <= 34; len++) {
+            make_ident(ident, len);
+            snprintf(text, sizeof(text), "%s%c", ident, stops[s]);
+
+            scan_all(text, toks);
+            assert_int_equal(SYMBOL_TOKEN, toks[0].type);
+            assert_int_equal(len, (int)toks[0].len);
+        }
+    }
+
+END_TEST
+
+DEF_TEST(white_space_boundaries)
+
+    Token toks[MAX_TOKENS];
+    char text[MAX_TEXT];
+
+    scan_all("x", toks);
+    int first_line = toks[0].line_no;
+    int first_col = toks[0].column_no;
+
+    for(int len = 0; len <= 70; len++) {
+        snprintf(text, sizeof(text), "%*sx", len, "");
+        scan_all(text, toks);
+        assert_int_equal(SYMBOL_TOKEN, toks[0].type);
+        assert_int_equal(first_line, toks[0].line_no);
+        assert_int_equal(first_col + len, toks[0].column_no);
+
+        // every kind of white space, with a newline every 8 characters
+        int lines = 0;
+        for(int i = 0; i < len; i++) {
+            text[i] = "\t \v\f \r \n"[i % 8];
+            lines += (text[i] == '\n');
+        }
+        strcpy(&text[len], "x");
+        scan_all(text, toks);
+        assert_int_equal(SYMBOL_TOKEN, toks[0].type);
+        assert_int_equal(first_line + lines, toks[0].line_no);
+    }
+
+END_TEST
+
+DEF_TEST_MAIN("scanner")
+
+    init_memory();
+    init_errors(stdout);
+    init_scanner();
+
+    ADD_TEST(block_comments);
+    ADD_TEST(block_comment_lines);
+    ADD_TEST(block_comment_boundaries);
+    ADD_TEST(unterminated_comment);
+    ADD_TEST(number_overflow);
+    ADD_TEST(identifier_boundaries);
+    ADD_TEST(identifier_at_end);
+    ADD_TEST(identifier_terminators);
+    ADD_TEST(white_space_boundaries);
+
+END_TEST_MAIN
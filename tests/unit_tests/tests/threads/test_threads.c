@@ -0,0 +1,118 @@
+/**
+    @file test_threads.c
+
+    @brief Tests for machines that run on more than one thread at once. Each
+    thread has its own machine and scanner, and they all count their warnings
+    and errors in the same totals. A runtime error must only stop the machine
+    that had it.
+
+**/
+#define USE_MEMORY 0
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+
+#include "common.h"
+#include "unit_tests.h"
+
+BEGIN_CONFIG
+    CONFIG_BOOL("-b", "BATCH_SCAN", "Scan each input into a token array before parsing", 0, 0, 0)
+    CONFIG_LIST(NULL, "INFILES", "Not used", 0, NULL, 0)
+END_CONFIG
+
+#define ROUNDS 200
+
+/*
+ * What one thread runs, and what happened. Every round posts a runtime
+ * warning. The thread that has fail_at set also runs a division by zero in
+ * that round, and must carry on afterward.
+ */
+typedef struct {
+    const char* text;
+    int fail_at;
+    int ok;         // runs that returned INTERPRET_OK
+    int failed;     // runs that returned INTERPRET_RUNTIME_ERROR
+    bool values;    // every value was the expected one
+} worker_t;
+
+static pthread_barrier_t start;
+
+static InterpretResult run_text(VMachine* vm, const char* text) {
+
+    reset_vmachine(vm);
+    open_scanner_string(text);
+    if(!compile(vm->block))
+        return INTERPRET_COMPILE_ERROR;
+    return run_vmachine(vm);
+}
+
+static void* worker(void* arg) {
+
+    worker_t* work = arg;
+    scanner_t* scanner = create_scanner();
+    set_scanner(scanner);
+    VMachine* vm = create_vmachine();
+    work->values = true;
+
+    pthread_barrier_wait(&start);
+    for(int i = 0; i < ROUNDS; i++) {
+        if(i == work->fail_at) {
+            if(run_text(vm, "1 / 0") == INTERPRET_RUNTIME_ERROR)
+                work->failed++;
+        }
+
+        if(run_text(vm, work->text) == INTERPRET_OK) {
+            work->ok++;
+            Value* val = peek_value_stack(vm);
+            if(val == NULL || !IS_BOOL(val) || !AS_BOOL(val))
+                work->values = false;
+        }
+    }
+
+    destroy_vmachine(vm);
+    set_scanner(NULL);
+    free_scanner(scanner);
+    release_thread_memory();
+    return NULL;
+}
+
+DEF_TEST(two_machines)
+
+    // floats compared for equality are left to the machine, which warns
+    worker_t works[2] = {
+        {.text = "1.5 == 1.5", .fail_at = ROUNDS / 2},
+        {.text = "2.5 == 2.5", .fail_at = -1},
+    };
+    int errors = get_num_errors();
+    int warnings = get_num_warnings();
+
+    pthread_t tids[2];
+    pthread_barrier_init(&start, NULL, 2);
+    for(int i = 0; i < 2; i++)
+        pthread_create(&tids[i], NULL, worker, &works[i]);
+    for(int i = 0; i < 2; i++)
+        pthread_join(tids[i], NULL);
+    pthread_barrier_destroy(&start);
+
+    // the error stopped one run on one thread, and nothing else
+    assert_int_equal(1, works[0].failed);
+    assert_int_equal(0, works[1].failed);
+    assert_int_equal(ROUNDS, works[0].ok);
+    assert_int_equal(ROUNDS, works[1].ok);
+    assert_int_equal(true, (works[0].values && works[1].values));
+
+    // and no count was lost
+    assert_int_equal(errors + 1, get_num_errors());
+    assert_int_equal(warnings + ROUNDS * 2, get_num_warnings());
+
+END_TEST
+
+DEF_TEST_MAIN("threads")
+
+    init_memory();
+    init_errors(stdout);
+    init_scanner();
+    init_fusion("all");
+
+    ADD_TEST(two_machines);
+
+END_TEST_MAIN
@@ -0,0 +1,204 @@
+/**
+    @file test_values.c
+
+    @brief Tests for the conversions that the VM does when the operands of an
+    operation have different types. The folder leaves those for the VM, so
+    each expression is compiled and run, and the value that it leaves on the
+    stack is checked. The test is built with each layout of a Value (see
+    codeblocks.h), and both builds must get the same results.
+
+**/
+#define USE_MEMORY 0
+#include <math.h>
+
+#include "common.h"
+#include "unit_tests.h"
+
+BEGIN_CONFIG
+    CONFIG_BOOL("-b", "BATCH_SCAN", "Scan each input into a token array before parsing", 0, 0, 0)
+    CONFIG_LIST(NULL, "INFILES", "Not used", 0, NULL, 0)
+END_CONFIG
+
+/*
+ * An expression and the value that it must leave on the stack.
+ */
+typedef struct {
+    const char* text;
+    ValueType type;
+    double fnum;
+    int64_t inum;
+    uint64_t unum;
+} expected_t;
+
+#define FNUM(t, n) {(t), VAL_FNUM, (n), 0, 0}
+#define INUM(t, n) {(t), VAL_INUM, 0.0, (n), 0}
+#define UNUM(t, n) {(t), VAL_UNUM, 0.0, 0, (n)}
+#define BOOL(t, n) {(t), VAL_BOOL, 0.0, (n), 0}
+
+/*
+ * Compile and run the text in a new machine, and check the value that is
+ * left on the stack. Returns false if the text did not compile and run.
+ */
+static bool check_value(const expected_t* exp) {
+
+    VMachine* vm = create_vmachine();
+    open_scanner_string(exp->text);
+    bool ok = compile(vm->block) && run_vmachine(vm) == INTERPRET_OK;
+
+    Value* val = ok? peek_value_stack(vm): NULL;
+    if(val == NULL)
+        ok = false;
+    else if(VALUE_TYPE(val) != exp->type) {
+        printf("\"%s\" is type %d, expected %d\n", exp->text, VALUE_TYPE(val), exp->type);
+        ok = false;
+    }
+    else {
+        switch(exp->type) {
+            case VAL_FNUM: {
+                    // the bits, so that a NaN is never taken for a number
+                    double got = AS_FNUM(val);
+                    ok = !memcmp(&got, &exp->fnum, sizeof(double));
+                    if(!ok)
+                        printf("\"%s\" is %g, expected %g\n", exp->text, got, exp->fnum);
+                }
+                break;
+            case VAL_INUM: ok = AS_INUM(val) == exp->inum; break;
+            case VAL_UNUM: ok = AS_UNUM(val) == exp->unum; break;
+            case VAL_BOOL: ok = AS_BOOL(val) == (exp->inum != 0); break;
+            default: ok = false;
+        }
+    }
+
+    destroy_vmachine(vm);
+    return ok;
+}
+
+// the asserts only work inside of a test, so this is a macro
+#define CHECK_VALUES(exps) \
+    for(size_t i = 0; i < sizeof(exps) / sizeof(exps[0]); i++) { \
+        bool ok = check_value(&exps[i]); \
+        if(!ok) \
+            printf("failed: \"%s\"\n", exps[i].text); \
+        assert_int_equal(true, ok); \
+    }
+
+DEF_TEST(float_and_int)
+
+    static const expected_t exps[] = {
+        FNUM("2.5 + 1", 3.5),
+        FNUM("1 + 2.5", 3.5),
+        FNUM("7.5 % 2", 1.5),
+        FNUM("2 - 0.5", 1.5),
+        FNUM("1.0 / 3", 1.0 / 3),
+        FNUM("10.0 / 0", INFINITY),
+        FNUM("-10.0 / 0", -INFINITY),
+        FNUM("1.0e308 * 10", INFINITY),
+        FNUM("281474976710656 * 2.0", 562949953421312.0),
+        BOOL("2.5 < 3", true),
+        BOOL("3 > 2.5", true),
+        BOOL("1 == 1.0", true),
+    };
+    CHECK_VALUES(exps);
+
+END_TEST
+
+DEF_TEST(float_and_unsigned)
+
+    static const expected_t exps[] = {
+        FNUM("2.5 + 0x10", 18.5),
+        FNUM("0x10 + 2.5", 18.5),
+        FNUM("0x10 / 4.0", 4.0),
+        BOOL("2.5 < 0x10", true),
+        BOOL("0x10 < 2.5", false),
+    };
+    CHECK_VALUES(exps);
+
+END_TEST
+
+DEF_TEST(int_and_unsigned)
+
+    static const expected_t exps[] = {
+        INUM("0x10 + 1", 17),
+        INUM("1 + 0x10", 17),
+        INUM("0x3 - 5", -2),
+        INUM("5 - 0x3", 2),
+        INUM("0x10 * -2", -32),
+        BOOL("-1 < 0x1", true),
+        BOOL("0x10 == 16", true),
+        // wider than the 48 bits that a NaN boxed number holds
+        INUM("0x1000000000000 + 1", 0x1000000000001),
+        INUM("1 - 0x1000000000000", -0x0FFFFFFFFFFFF),
+        INUM("0x7FFFFFFFFFFFFFFF + 0", INT64_MAX),
+        UNUM("0xFFFFFFFFFFFFFFFF + 0x0", UINT64_MAX),
+    };
+    CHECK_VALUES(exps);
+
+END_TEST
+
+DEF_TEST(int_wraps)
+
+    // ints wrap around in the VM the way that they do when they are folded
+    static const expected_t exps[] = {
+        INUM("0x7FFFFFFFFFFFFFFF + 1", INT64_MIN),
+        INUM("(0x8000000000000000 + 0) - 1", INT64_MAX),
+        INUM("(0x7FFFFFFFFFFFFFFF + 0) * 2", -2),
+        INUM("(0x4000000000000000 + 0) * (0x2 + 0)", INT64_MIN),
+        INUM("-(0x8000000000000000 + 0)", INT64_MIN),
+        INUM("7 + -(0x8000000000000000 + 0)", INT64_MIN + 7),
+    };
+    CHECK_VALUES(exps);
+
+END_TEST
+
+#ifdef NAN_BOXING
+DEF_TEST(wide_number_boxes)
+
+    // outside of a machine the boxes are interned
+    const wideNumber* box1 = box_wide_number(VAL_INUM, (uint64_t)INT64_MAX);
+    const wideNumber* box2 = box_wide_number(VAL_INUM, (uint64_t)INT64_MAX);
+    assert_int_equal(true, (box1 == box2));
+
+    // a machine gets a new box each time, on its own list
+    ptr_list_t* list = create_ptr_list();
+    box_wide_numbers_in(list);
+    const wideNumber* box3 = box_wide_number(VAL_INUM, (uint64_t)INT64_MAX);
+    const wideNumber* box4 = box_wide_number(VAL_INUM, (uint64_t)INT64_MAX);
+    box_wide_numbers_in(NULL);
+    assert_int_equal(true, (box3 != box1 && box3 != box4));
+    assert_int_equal(2, list->nitems);
+    assert_int_equal(VAL_INUM, box4->type);
+    assert_int_equal(true, (box4->as.inum == INT64_MAX));
+
+    free_wide_numbers(list);
+    assert_int_equal(0, list->nitems);
+    destroy_ptr_list(list);
+
+    // and the machine's boxes are freed when it is reset. The uint is
+    // converted to an int and then added, and each is a box.
+    VMachine* vm = create_vmachine();
+    open_scanner_string("0x1000000000000 + 1");
+    assert_int_equal(true, (compile(vm->block) && run_vmachine(vm) == INTERPRET_OK));
+    assert_int_equal(2, vm->boxes->nitems);
+    reset_vmachine(vm);
+    assert_int_equal(0, vm->boxes->nitems);
+    destroy_vmachine(vm);
+
+END_TEST
+#endif
+
+DEF_TEST_MAIN("values")
+
+    init_memory();
+    init_errors(stdout);
+    init_scanner();
+    init_fusion("all");
+
+    ADD_TEST(float_and_int);
+    ADD_TEST(float_and_unsigned);
+    ADD_TEST(int_and_unsigned);
+    ADD_TEST(int_wraps);
+#ifdef NAN_BOXING
+    ADD_TEST(wide_number_boxes);
+#endif
+
+END_TEST_MAIN